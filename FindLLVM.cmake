@@ -87,7 +87,11 @@ else (LLVM_INCLUDE_DIR)
   if(LLVM_CONFIG_EXECUTABLE)
     MESSAGE(STATUS "LLVM llvm-config found at: ${LLVM_CONFIG_EXECUTABLE}")
   else(LLVM_CONFIG_EXECUTABLE)
-    MESSAGE(FATAL_ERROR "Could NOT find LLVM")
+    if(LLVM_FIND_REQUIRED)
+      MESSAGE(FATAL_ERROR "Could NOT find LLVM")
+    endif(LLVM_FIND_REQUIRED)
+    MESSAGE(STATUS "Could NOT find LLVM")
+    return()
   endif(LLVM_CONFIG_EXECUTABLE)
 
 
@@ -7,20 +7,226 @@
 //
 
 #include <string>
+#include <vector>
 #include <iostream>
 #include <fstream>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include "bfopt.h"
+#include "bffork.h"
+#include "bfinterp.h"
+#include "bfnative.h"
+#include "bfrt.h"
+#include "bfstats.h"
+#include "bftape.h"
+#ifdef BF_WITH_LLVM
+#include "bfbatch.h"
+#include "bfcache.h"
 #include "bfjit.h"
+#include "bfprofile.h"
+#include "bfserve.h"
+#include "bftier.h"
+#endif
+
+// Program output goes first, stats follow it on stderr
+static void print_stats(brainfuck::stats::format fmt)
+{
+    if (fmt==brainfuck::stats::Off) return;
+    bf_flush();
+    brainfuck::stats::print(std::cerr, fmt);
+}
+
+// Open the program file, an empty program would run in place of one that can not be read
+static void open_program(std::ifstream &src, const char *filename)
+{
+    src.open(filename);
+    if (!src) {
+        std::cerr << "Could not open " << filename << ": " << strerror(errno) << "\n";
+        exit(1);
+    }
+}
 
 // TODO: Use some real command line option parser
 int main(int argc, const char * argv[])
 {
+    int optimization_level=0;
+    brainfuck::opt::options opts;
+    brainfuck::tape::options tape_opts;
+    brainfuck::stats::format stats_format=brainfuck::stats::Off;
+    brainfuck::fork::options fork_opts;
+    bool engine_given=false;
+#ifdef BF_WITH_LLVM
+    std::string engine="jit";
+    brainfuck::tier::options tier_opts;
+    brainfuck::cache::options cache_opts;
+    brainfuck::jit::options jit_opts;
+    brainfuck::profile::options profile_opts;
+    brainfuck::serve::options serve_opts;
+    brainfuck::batch::options batch_opts;
+#else
+    std::string engine=brainfuck::native::supported() ? "native" : "interp";
+#endif
+    const char *filename=0;
+    std::vector<std::string> inputs;    // Files after the program, for --batch
+    for (int i=1; i<argc; i++) {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 2, "-O")==0) {
+            optimization_level=std::atoi(arg.c_str()+2);
+#ifdef BF_WITH_LLVM
+            tier_opts.optimization_level=optimization_level;
+#endif
+        } else if (arg.compare(0, 9, "--engine=")==0) {
+            engine=arg.substr(9);
+            engine_given=true;
+        } else if (arg.compare(0, 8, "--flush=")==0) {
+            int policy=bf_parse_flush_policy(arg.c_str()+8);
+            if (policy<0) {
+                std::cerr << "Unknown flush policy " << arg.substr(8) << "\n";
+                return 1;
+            }
+            bf_set_flush_policy(bf_flush_policy(policy));
+        } else if (brainfuck::stats::parse_option(arg, stats_format)) {
+            brainfuck::stats::enable();
+        } else if (brainfuck::fork::parse_option(arg, fork_opts)) {
+            // Handled
+#ifdef BF_WITH_LLVM
+        } else if (arg.compare(0, 17, "--tier-threshold=")==0) {
+            tier_opts.threshold=std::strtoul(arg.c_str()+17, 0, 10);
+        } else if (brainfuck::cache::parse_option(arg, cache_opts)
+                   || brainfuck::jit::parse_option(arg, jit_opts)
+                   || brainfuck::profile::parse_option(arg, profile_opts)
+                   || brainfuck::serve::parse_option(arg, serve_opts)
+                   || brainfuck::batch::parse_option(arg, batch_opts)) {
+            // Handled
+#endif
+        } else if (brainfuck::opt::parse_option(arg, opts) || brainfuck::tape::parse_option(arg, tape_opts)) {
+            // Handled
+        } else if (arg.size()>1 && arg[0]=='-') {
+            std::cerr << "Unknown option " << arg << "\n";
+            return 1;
+        } else if (!filename) {
+            filename=argv[i];
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    
+    if (fork_opts.enabled) {
+        // Forked tasks resume between any two ops, which only an interpreter can do
+        bool alone=!engine_given && inputs.empty();
+#ifdef BF_WITH_LLVM
+        alone=alone && !profile_opts.enabled && profile_opts.use.empty() && !serve_opts.enabled
+              && !batch_opts.enabled && !jit_opts.lazy;
+#endif
+        if (!alone) {
+            std::cerr << "--brainfork runs programs in an interpreter of its own, it does not go with --engine,\n"
+                         "--profile, --use-profile, --lazy, --serve or --batch\n";
+            return 1;
+        }
+        if (filename) {
+            std::ifstream src;
+            open_program(src, filename);
+            brainfuck::fork::run(src, fork_opts, opts, tape_opts);
+        } else {
+            std::cerr << "--brainfork reads the program from a file, stdin is its input\n";
+            return 1;
+        }
+        print_stats(stats_format);
+        return 0;
+    }
+    
+#ifdef BF_WITH_LLVM
+    if ((profile_opts.enabled || !profile_opts.use.empty() || serve_opts.enabled) && engine!="jit") {
+        std::cerr << "--profile, --use-profile and --serve need --engine=jit\n";
+        return 1;
+    }
+    if (jit_opts.lazy && (profile_opts.enabled || !profile_opts.use.empty() || serve_opts.enabled || engine!="jit")) {
+        std::cerr << "--lazy needs --engine=jit, and does not go with --profile, --use-profile or --serve\n";
+        return 1;
+    }
+    if (serve_opts.enabled) {
+        int status=brainfuck::serve::run(serve_opts, optimization_level, opts, tape_opts);
+        print_stats(stats_format);
+        return status;
+    }
+    if (batch_opts.enabled) {
+        if (engine!="jit" || profile_opts.enabled || !filename) {
+            std::cerr << "--batch needs --engine=jit, a program and input files, and can not --profile\n";
+            return 1;
+        }
+        std::ifstream src;
+        open_program(src, filename);
+        brainfuck::jit::entry_func_type entry=brainfuck::jit::compile_entry(src, optimization_level, opts, tape_opts,
+                                                                             cache_opts, profile_opts, jit_opts);
+        int status=brainfuck::batch::run(batch_opts, entry, inputs, tape_opts);
+        print_stats(stats_format);
+        return status;
+    }
+#endif
+    if (!inputs.empty()) {
+        std::cerr << "More than one program given, input files need --batch\n";
+        return 1;
+    }
+    
+    if (engine=="interp") {
+        if (filename) {
+            std::ifstream src;
+            open_program(src, filename);
+            brainfuck::interp::run(src, opts, tape_opts);
+        } else {
+            brainfuck::interp::run(std::cin, opts, tape_opts);
+        }
+        print_stats(stats_format);
+        return 0;
+    }
+    
+    if (engine=="native") {
+        if (filename) {
+            std::ifstream src;
+            open_program(src, filename);
+            brainfuck::native::run(src, opts, tape_opts);
+        } else {
+            brainfuck::native::run(std::cin, opts, tape_opts);
+        }
+        print_stats(stats_format);
+        return 0;
+    }
+    
+#ifdef BF_WITH_LLVM
+    if (engine=="tiered") {
+        tier_opts.tape=tape_opts;
+        if (filename) {
+            std::ifstream src;
+            open_program(src, filename);
+            brainfuck::tier::run(src, tier_opts, opts);
+        } else {
+            brainfuck::tier::run(std::cin, tier_opts, opts);
+        }
+        print_stats(stats_format);
+        return 0;
+    } else if (engine!="jit") {
+        std::cerr << "Unknown engine " << engine << "\n";
+        return 1;
+    }
+    
     brainfuck::jit::main_func_type fp;
-    if (argc>1) {
-        std::ifstream src(argv[1]);
-        fp=brainfuck::jit::compile(src);
+    if (filename) {
+        std::ifstream src;
+        open_program(src, filename);
+        fp=brainfuck::jit::compile(src, optimization_level, opts, tape_opts, cache_opts, profile_opts, jit_opts);
     } else {
-        fp=brainfuck::jit::compile(std::cin);
+        fp=brainfuck::jit::compile(std::cin, optimization_level, opts, tape_opts, cache_opts, profile_opts, jit_opts);
+    }
+    {
+        brainfuck::stats::timer t("run");
+        fp();
+        bf_flush();
     }
-    fp();
+    print_stats(stats_format);
     return 0;
+#else
+    std::cerr << "Unknown engine " << engine << "\n";
+    return 1;
+#endif
 }
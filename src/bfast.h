@@ -5,6 +5,9 @@
 //  Created by Xu Chen on 12-9-8.
 //  Copyright (c) 2012 Xu Chen. All rights reserved.
 //
+//  Syntax tree of the Boost.Spirit grammar in bfgrammar.h, engines work on the
+//  flat IR in bfir.h instead.
+//
 
 #include <string>
 #include <vector>
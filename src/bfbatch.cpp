@@ -0,0 +1,214 @@
+//
+//  bfbatch.cpp
+//  brainfuck
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bfbatch.h"
+#include "bfrt.h"
+#include "bfstats.h"
+
+namespace brainfuck {
+    namespace batch {
+        namespace details {
+            double now() {
+                struct timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                return ts.tv_sec + ts.tv_nsec * 1e-9;
+            }
+
+            // Inputs waiting for a worker, the owner takes from the front and thieves from the back
+            struct queue {
+                std::mutex mutex;
+                std::deque<size_t> jobs;
+            };
+
+            struct pool {
+                pool(size_t jobs, size_t workers);
+
+                // Next input for worker, false once every queue is empty
+                bool next(size_t worker, size_t &job);
+
+            private:
+                std::vector<std::unique_ptr<queue> > queues_;
+            };  // End of pool
+
+            pool::pool(size_t jobs, size_t workers) {
+                // Neighbouring inputs go to the same worker until it has to steal
+                for (size_t i = 0; i < workers; i++) {
+                    queues_.push_back(std::make_unique<queue>());
+                    for (size_t j = jobs * i / workers; j < jobs * (i + 1) / workers; j++) {
+                        queues_.back()->jobs.push_back(j);
+                    }
+                }
+            }
+
+            bool pool::next(size_t worker, size_t &job) {
+                queue &own = *queues_[worker];
+                {
+                    std::lock_guard<std::mutex> lock(own.mutex);
+                    if (!own.jobs.empty()) {
+                        job = own.jobs.front();
+                        own.jobs.pop_front();
+                        return true;
+                    }
+                }
+
+                // Nothing adds work once the batch started, a sweep finding every queue empty is the end
+                for (size_t i = 1; i < queues_.size(); i++) {
+                    queue &victim = *queues_[(worker + i) % queues_.size()];
+                    std::vector<size_t> stolen;
+                    {
+                        std::lock_guard<std::mutex> lock(victim.mutex);
+                        size_t half = (victim.jobs.size() + 1) / 2;
+                        for (size_t k = 0; k < half; k++) {
+                            stolen.push_back(victim.jobs.back());
+                            victim.jobs.pop_back();
+                        }
+                    }
+                    if (stolen.empty()) continue;
+                    job = stolen.back();
+                    stolen.pop_back();
+                    std::lock_guard<std::mutex> lock(own.mutex);
+                    own.jobs.insert(own.jobs.end(), stolen.rbegin(), stolen.rend());
+                    return true;
+                }
+                return false;
+            }
+
+            // What one worker keeps between inputs
+            struct worker {
+                jit::entry_func_type entry;
+                bf_tape *tape;
+                bf_io io;
+                std::string input;
+            };
+
+            void call(void *arg, void *origin) {
+                worker *w = static_cast<worker *>(arg);
+                w->entry(&w->io, origin);
+            }
+
+            bool read_file(const std::string &path, std::string &data) {
+                FILE *f = fopen(path.c_str(), "rb");
+                if (!f) return false;
+                data.clear();
+                char buf[64 * 1024];
+                size_t n;
+                while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+                    data.append(buf, n);
+                }
+                bool ok = !ferror(f);
+                fclose(f);
+                return ok;
+            }
+
+            bool write_file(const std::string &path, const char *data, size_t n) {
+                FILE *f = fopen(path.c_str(), "wb");
+                if (!f) return false;
+                bool ok = fwrite(data, 1, n, f) == n;
+                return fclose(f) == 0 && ok;
+            }
+
+            std::string output_path(const options &opts, const std::string &input) {
+                if (opts.output.empty()) return input + ".out";
+                size_t slash = input.rfind('/');
+                return opts.output + "/" + (slash == std::string::npos ? input : input.substr(slash + 1)) + ".out";
+            }
+        }   // End of namespace details
+
+        bool parse_option(const std::string &arg, options &opts) {
+            if (arg == "--batch") {
+                opts.enabled = true;
+            } else if (arg.compare(0, 10, "--threads=") == 0) {
+                opts.threads = (unsigned int)strtoul(arg.c_str() + 10, 0, 10);
+            } else if (arg.compare(0, 15, "--batch-output=") == 0) {
+                opts.output = arg.substr(15);
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        int run(const options &batch_opts, jit::entry_func_type entry, const std::vector<std::string> &inputs,
+                const tape::options &tape_opts) {
+            size_t threads = batch_opts.threads ? batch_opts.threads : std::thread::hardware_concurrency();
+            if (threads == 0) threads = 1;
+            if (threads > inputs.size()) threads = inputs.size() ? inputs.size() : 1;
+
+            // Tapes are mapped up front, the fault handler is installed before any worker runs
+            std::vector<details::worker> workers(threads);
+            for (details::worker &w : workers) {
+                w.entry = entry;
+                w.tape = bf_tape_create(tape_opts.cell_size / 8, tape_opts.size, tape_opts.limit, tape_opts.growth);
+                if (!w.tape) {
+                    perror("bf_tape_create");
+                    exit(1);
+                }
+                memset(&w.io, 0, sizeof(w.io));
+            }
+
+            stats::timer t("run");
+            double start = details::now();
+            details::pool pool(inputs.size(), threads);
+            std::mutex report;
+            std::atomic<size_t> failed(0);
+            std::vector<std::thread> running;
+            for (size_t i = 0; i < threads; i++) {
+                running.emplace_back([&, i]() {
+                    details::worker &w = workers[i];
+                    size_t job;
+                    while (pool.next(i, job)) {
+                        const std::string &input = inputs[job];
+                        std::string error;
+                        if (!details::read_file(input, w.input)) {
+                            error = strerror(errno);
+                        } else {
+                            w.io.in = reinterpret_cast<const unsigned char *>(w.input.data());
+                            w.io.in_len = w.input.size();
+                            w.io.in_pos = 0;
+                            w.io.out_len = 0;
+                            // Output up to a tape error is kept, as bf would have written it
+                            if (bf_tape_run(w.tape, details::call, &w) != 0) error = bf_tape_message(w.tape);
+                            std::string path = details::output_path(batch_opts, input);
+                            if (!details::write_file(path, w.io.out, w.io.out_len) && error.empty()) {
+                                error = path + ": " + strerror(errno) + "\n";
+                            }
+                        }
+                        if (error.empty()) continue;
+                        if (error.back() != '\n') error += '\n';
+                        failed++;
+                        std::lock_guard<std::mutex> lock(report);
+                        fprintf(stderr, "%s: %s", input.c_str(), error.c_str());
+                    }
+                });
+            }
+            for (std::thread &r : running) {
+                r.join();
+            }
+            double elapsed = details::now() - start;
+            t.stop();
+
+            for (details::worker &w : workers) {
+                bf_tape_destroy(w.tape);
+                free(w.io.out);
+            }
+            stats::add("batch inputs", inputs.size());
+            stats::add("batch failed", failed);
+            fprintf(stderr, "bf --batch: %zu inputs in %.3fs, %.1f inputs/s on %zu threads, %zu failed\n",
+                    inputs.size(), elapsed, elapsed > 0 ? inputs.size() / elapsed : 0.0, threads, size_t(failed));
+            return failed ? 1 : 0;
+        }
+    }   // End of namespace batch
+}   // End of namespace brainfuck
@@ -0,0 +1,45 @@
+//
+//  bfbatch.h
+//  brainfuck
+//
+//  Run one compiled program against many input files, bf --batch. The program
+//  is compiled once to its bf_main entry, then worker threads each take
+//  inputs from their own queue and steal half of another queue when theirs
+//  runs dry. Every worker has its own tape and I/O buffers, so runs share
+//  nothing but the code. A tape error only fails the input it happened on.
+//
+
+#include <string>
+#include <vector>
+#include "bfjit.h"
+#include "bftape.h"
+
+#ifndef brainfuck_bfbatch_h
+#define brainfuck_bfbatch_h
+
+namespace brainfuck {
+    namespace batch {
+        struct options {
+            inline options()
+            : enabled(false)
+            , threads(0)
+            {}
+
+            bool enabled;
+            unsigned int threads;   // Workers, 0 for one per core
+            std::string output;     // Directory for outputs, empty for <input>.out next to each input
+        };
+
+        // Handle --batch, --threads=N and --batch-output=DIR, returns false if arg is not
+        // a batch option
+        bool parse_option(const std::string &arg, options &opts);
+
+        // Run entry on each input, writing the output of input to <input>.out, or to
+        // <dir>/<input name>.out with --batch-output. Reports failed inputs and throughput
+        // on stderr, returns the exit status of bf, 1 if any input failed
+        int run(const options &batch_opts, jit::entry_func_type entry, const std::vector<std::string> &inputs,
+                const tape::options &tape_opts=tape::options());
+    }   // End of namespace batch
+}   // End of namespace brainfuck
+
+#endif
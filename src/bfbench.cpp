@@ -0,0 +1,666 @@
+//
+//  bfbench.cpp
+//  brainfuck
+//
+//  Runs a corpus through every engine and optimization level, timing each
+//  phase separately over repeated trials. Results are written as JSON and
+//  can be compared against an earlier run to catch regressions.
+//
+//  With --scaling the synthetic programs are timed at doubling sizes instead,
+//  and the growth of each phase is fitted to a power law, so a phase whose
+//  time grows faster than the program is caught.
+//
+//  Every trial runs in a child process, since the runtime keeps its tape and
+//  output buffer in globals and the JIT never gives back its code.
+//
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "bfcodegen.h"
+#include "bffrontend.h"
+#include "bfinterp.h"
+#include "bfir.h"
+#include "bfjit.h"
+#include "bfnative.h"
+#include "bfopt.h"
+#include "bfrt.h"
+#include "bftape.h"
+#include "bftier.h"
+
+using namespace llvm;
+
+namespace brainfuck {
+    namespace bench {
+        enum phase {
+            Parse,          // Source to IR
+            Optimize,       // Idiom passes
+            Codegen,        // IR to LLVM IR, to bytecode for the interpreter or to machine code for the native engine
+            Passes,         // LLVM pass pipeline
+            Link,           // Machine code generation and JIT linking
+            Run,            // Running the program, including the final flush
+            PhaseCount,
+        };
+
+        const char *const phase_names[PhaseCount] = {
+            "parse", "optimize", "codegen", "passes", "link", "run",
+        };
+
+        // Seconds per phase, negative for phases an engine does not have
+        typedef std::vector<double> timings;
+
+        struct program {
+            std::string name_;
+            std::string source_;
+            std::string input_;
+        };
+
+        struct config {
+            std::string engine_;
+            int level_;             // -1 for the interpreter and the native engine, which have no LLVM level
+        };
+
+        struct options {
+            inline options()
+            : trials(5)
+            , timeout(300)
+            , threshold(10)
+            , synthetic(true)
+            , large_size(256*1024)
+            , depth(1000)
+            , scaling_steps(0)
+            , max_exponent(1.2)
+            {}
+
+            int trials;
+            unsigned int timeout;           // Seconds per trial
+            double threshold;               // Percent slower than the baseline median
+            std::map<std::string, double> phase_thresholds;
+            bool synthetic;
+            size_t large_size;              // Bytes of the synthetic large program
+            size_t depth;                   // Nesting of the synthetic nested program
+            int scaling_steps;              // Sizes per synthetic program with --scaling, 0 without
+            double max_exponent;            // Steepest growth of a phase with --scaling
+            std::vector<std::string> engines;
+            std::vector<int> levels;
+            std::string baseline;
+            std::string output;
+        };
+
+        // Phases faster than this are dominated by noise and never flagged
+        const double noise_floor = 0.001;
+
+        // Growth is only fitted to the sizes where a phase takes longer than this
+        const double scaling_floor = 0.01;
+
+        namespace details {
+            double now() {
+                return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            }
+
+            bool read_file(const std::string &path, std::string &text) {
+                std::ifstream is(path.c_str(), std::ios::binary);
+                if (!is) return false;
+                text.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+                return true;
+            }
+
+            std::string basename(const std::string &path) {
+                size_t slash=path.rfind('/');
+                return slash==std::string::npos ? path : path.substr(slash+1);
+            }
+
+            // Input is read from NAME.in next to NAME.b, if there is one
+            program load_program(const std::string &path) {
+                program p;
+                p.name_=basename(path);
+                if (!read_file(path, p.source_)) {
+                    std::cerr << "Can not read " << path << "\n";
+                    exit(1);
+                }
+                size_t dot=path.rfind('.'), slash=path.rfind('/');
+                bool has_ext=dot!=std::string::npos && (slash==std::string::npos || dot>slash);
+                read_file((has_ext ? path.substr(0, dot) : path) + ".in", p.input_);
+                return p;
+            }
+
+            // Straight-line code that keeps the data pointer within a few cells
+            program large_program(size_t size) {
+                program p;
+                p.name_="synthetic-large";
+                for (size_t i=0; p.source_.size()<size; i++) {
+                    p.source_+=std::string(1+i%7, '+');
+                    p.source_+="[>";
+                    p.source_+=std::string(1+i%5, '+');
+                    p.source_+="<-]>[-<+>]<[>+>+<<-]>>[-<<+>>]<<";
+                    if (i%16==15) p.source_+="[-]>[-]>[-]<<\n";
+                }
+                return p;
+            }
+
+            // Every level enters its loop exactly once
+            program nested_program(size_t depth) {
+                program p;
+                p.name_="synthetic-nested";
+                for (size_t i=0; i<depth; i++) p.source_+="+[->+<";
+                p.source_+=std::string(depth, ']');
+                return p;
+            }
+
+            opt::options no_idioms() {
+                opt::options none;
+                opt::parse_option("-fno-idioms", none);
+                return none;
+            }
+
+            // Runs in the child, stdin and stdout are already redirected
+            timings measure(const program &p, const config &c) {
+                timings t(PhaseCount, -1);
+                tape::options tape_opts;
+
+                double start=now();
+                frontend::loader loader;
+                loader.reserve(p.source_.size());
+                loader.feed(p.source_.data(), p.source_.size());
+                ir::Program prog=loader.finish(no_idioms());
+                t[Parse]=now()-start;
+
+                start=now();
+                opt::optimize(prog);
+                t[Optimize]=now()-start;
+
+                if (c.engine_=="interp") {
+                    start=now();
+                    interp::Bytecode code=interp::compile(prog);
+                    t[Codegen]=now()-start;
+
+                    start=now();
+                    interp::run(code, tape_opts);
+                    bf_flush();
+                    t[Run]=now()-start;
+                } else if (c.engine_=="native") {
+                    start=now();
+                    native::Code code=native::compile(prog, tape_opts.cell_size);
+                    t[Codegen]=now()-start;
+
+                    start=now();
+                    native::run(code, tape_opts);
+                    bf_flush();
+                    t[Run]=now()-start;
+                } else if (c.engine_=="tiered") {
+                    tier::options tier_opts;
+                    tier_opts.optimization_level=c.level_;
+                    tier_opts.tape=tape_opts;
+                    start=now();
+                    tier::run(prog, tier_opts);
+                    bf_flush();
+                    t[Run]=now()-start;
+                } else {
+                    jit::initialize();
+                    start=now();
+                    auto context=std::make_unique<LLVMContext>();
+                    auto module=std::make_unique<Module>("brainfuck", *context);
+                    codegen(*module, prog, tape_opts);
+                    t[Codegen]=now()-start;
+
+                    start=now();
+                    jit::optimize_for_host(*module, c.level_);
+                    t[Passes]=now()-start;
+
+                    start=now();
+                    std::unique_ptr<orc::LLJIT> JIT=jit::create_jit();
+                    if (auto Err=JIT->addIRModule(orc::ThreadSafeModule(std::move(module), std::move(context)))) {
+                        fprintf(stderr, "Could not add IR module: %s\n", toString(std::move(Err)).c_str());
+                        exit(1);
+                    }
+                    jit::main_func_type fp=reinterpret_cast<jit::main_func_type>(jit::lookup(*JIT, "main"));
+                    t[Link]=now()-start;
+
+                    start=now();
+                    fp();
+                    bf_flush();
+                    t[Run]=now()-start;
+                    JIT.release();
+                }
+                return t;
+            }
+
+            // One trial in a child process, returns false if it failed
+            bool trial(const program &p, const config &c, const std::string &input_path,
+                       unsigned int timeout, timings &t) {
+                int fds[2];
+                if (pipe(fds)!=0) {
+                    perror("pipe");
+                    exit(1);
+                }
+                std::cout.flush();
+                pid_t pid=fork();
+                if (pid<0) {
+                    perror("fork");
+                    exit(1);
+                }
+                if (pid==0) {
+                    close(fds[0]);
+                    int in=open(input_path.c_str(), O_RDONLY);
+                    int out=open("/dev/null", O_WRONLY);
+                    if (in<0 || out<0 || dup2(in, 0)<0 || dup2(out, 1)<0) _exit(1);
+                    alarm(timeout);
+                    timings r=measure(p, c);
+                    ssize_t n=write(fds[1], &r[0], sizeof(double)*PhaseCount);
+                    _exit(n==ssize_t(sizeof(double)*PhaseCount) ? 0 : 1);
+                }
+                close(fds[1]);
+                t.assign(PhaseCount, -1);
+                size_t got=0;
+                char *buf=reinterpret_cast<char *>(&t[0]);
+                while (got<sizeof(double)*PhaseCount) {
+                    ssize_t n=read(fds[0], buf+got, sizeof(double)*PhaseCount-got);
+                    if (n<=0) break;
+                    got+=n;
+                }
+                close(fds[0]);
+                int status=0;
+                waitpid(pid, &status, 0);
+                if (WIFSIGNALED(status)) {
+                    std::cerr << p.name_ << ": " << (WTERMSIG(status)==SIGALRM ? "timed out" : strsignal(WTERMSIG(status))) << "\n";
+                    return false;
+                }
+                return WIFEXITED(status) && WEXITSTATUS(status)==0 && got==sizeof(double)*PhaseCount;
+            }
+
+            // Trials of p under c, samples per phase and the total last; false if one failed
+            bool sample(const program &p, const config &c, const std::string &input_path, const options &opts,
+                        std::vector<std::vector<double> > &samples) {
+                samples.assign(PhaseCount+1, std::vector<double>());
+                for (int n=0; n<opts.trials; n++) {
+                    timings t;
+                    if (!trial(p, c, input_path, opts.timeout, t)) return false;
+                    double total=0;
+                    for (int ph=0; ph<PhaseCount; ph++) {
+                        if (t[ph]<0) continue;
+                        samples[ph].push_back(t[ph]);
+                        total+=t[ph];
+                    }
+                    samples[PhaseCount].push_back(total);
+                }
+                return true;
+            }
+
+            struct summary {
+                double median_;
+                double mean_;
+                double variance_;   // Sample variance, 0 for a single trial
+                double min_;
+            };
+
+            summary summarize(std::vector<double> v) {
+                summary s = { 0, 0, 0, 0 };
+                std::sort(v.begin(), v.end());
+                size_t n=v.size();
+                s.median_=n%2 ? v[n/2] : (v[n/2-1]+v[n/2])/2;
+                for (double x : v) s.mean_+=x;
+                s.mean_/=n;
+                for (double x : v) s.variance_+=(x-s.mean_)*(x-s.mean_);
+                s.variance_=n>1 ? s.variance_/(n-1) : 0;
+                s.min_=v[0];
+                return s;
+            }
+
+            // Slope of the least squares line through (log size, log seconds), the exponent
+            // of the power law the points follow: 1 for linear growth, 2 for quadratic
+            double exponent(const std::vector<double> &sizes, const std::vector<double> &seconds) {
+                double n=sizes.size(), sx=0, sy=0, sxx=0, sxy=0;
+                for (size_t i=0; i<sizes.size(); i++) {
+                    double x=std::log(sizes[i]), y=std::log(seconds[i]);
+                    sx+=x;
+                    sy+=y;
+                    sxx+=x*x;
+                    sxy+=x*y;
+                }
+                return (n*sxy-sx*sy)/(n*sxx-sx*sx);
+            }
+
+            std::string config_name(const config &c) {
+                return c.level_<0 ? c.engine_ : c.engine_ + " -O" + std::to_string(c.level_);
+            }
+
+            std::string result_key(const std::string &name, const std::string &engine, int64_t level) {
+                return name + '\n' + engine + '\n' + std::to_string(level);
+            }
+
+            // Baseline medians by result_key, then phase
+            typedef std::map<std::string, std::map<std::string, double> > baseline_type;
+
+            baseline_type load_baseline(const std::string &path) {
+                std::string text;
+                if (!read_file(path, text)) {
+                    std::cerr << "Can not read baseline " << path << "\n";
+                    exit(1);
+                }
+                Expected<json::Value> parsed=json::parse(text);
+                if (!parsed) {
+                    std::cerr << "Bad baseline " << path << ": " << toString(parsed.takeError()) << "\n";
+                    exit(1);
+                }
+                baseline_type ret;
+                const json::Object *root=parsed->getAsObject();
+                const json::Array *results=root ? root->getArray("results") : nullptr;
+                if (!results) return ret;
+                for (const json::Value &r : *results) {
+                    const json::Object *o=r.getAsObject();
+                    if (!o) continue;
+                    auto name=o->getString("program");
+                    auto engine=o->getString("engine");
+                    auto level=o->getInteger("level");
+                    const json::Object *phases=o->getObject("phases");
+                    if (!name || !engine || !phases) continue;
+                    auto &medians=ret[result_key(name->str(), engine->str(), level ? *level : -1)];
+                    for (const auto &ph : *phases) {
+                        const json::Object *s=ph.second.getAsObject();
+                        if (!s) continue;
+                        if (auto median=s->getNumber("median")) medians[ph.first.str()]=*median;
+                    }
+                }
+                return ret;
+            }
+
+            std::vector<std::string> split(const std::string &s) {
+                std::vector<std::string> ret;
+                std::stringstream ss(s);
+                std::string item;
+                while (std::getline(ss, item, ',')) {
+                    if (!item.empty()) ret.push_back(item);
+                }
+                return ret;
+            }
+
+            void add_corpus(const std::string &dir, std::vector<program> &programs) {
+                DIR *d=opendir(dir.c_str());
+                if (!d) {
+                    std::cerr << "Can not open corpus " << dir << "\n";
+                    exit(1);
+                }
+                std::vector<std::string> files;
+                while (struct dirent *e=readdir(d)) {
+                    std::string name(e->d_name);
+                    size_t dot=name.rfind('.');
+                    if (dot==std::string::npos) continue;
+                    std::string ext=name.substr(dot);
+                    if (ext==".b" || ext==".bf") files.push_back(dir + "/" + name);
+                }
+                closedir(d);
+                std::sort(files.begin(), files.end());
+                for (const auto &f : files) programs.push_back(load_program(f));
+            }
+        }   // End of namespace details
+    }   // End of namespace bench
+}   // End of namespace brainfuck
+
+using namespace brainfuck::bench;
+
+// TODO: Use some real command line option parser
+int main(int argc, const char * argv[])
+{
+    options opts;
+    std::vector<program> programs;
+    for (int i=1; i<argc; i++) {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 9, "--trials=")==0) {
+            opts.trials=std::max(1, atoi(arg.c_str()+9));
+        } else if (arg.compare(0, 10, "--timeout=")==0) {
+            opts.timeout=strtoul(arg.c_str()+10, 0, 10);
+        } else if (arg.compare(0, 10, "--engines=")==0) {
+            opts.engines=details::split(arg.substr(10));
+        } else if (arg.compare(0, 9, "--levels=")==0) {
+            opts.levels.clear();
+            for (const auto &l : details::split(arg.substr(9))) opts.levels.push_back(atoi(l.c_str()));
+        } else if (arg.compare(0, 9, "--corpus=")==0) {
+            details::add_corpus(arg.substr(9), programs);
+        } else if (arg=="--no-synthetic") {
+            opts.synthetic=false;
+        } else if (arg.compare(0, 8, "--large=")==0) {
+            opts.large_size=strtoull(arg.c_str()+8, 0, 10)*1024;
+        } else if (arg.compare(0, 8, "--depth=")==0) {
+            opts.depth=strtoull(arg.c_str()+8, 0, 10);
+        } else if (arg=="--scaling") {
+            opts.scaling_steps=5;
+        } else if (arg.compare(0, 10, "--scaling=")==0) {
+            opts.scaling_steps=std::max(2, atoi(arg.c_str()+10));
+        } else if (arg.compare(0, 15, "--max-exponent=")==0) {
+            opts.max_exponent=atof(arg.c_str()+15);
+        } else if (arg.compare(0, 11, "--baseline=")==0) {
+            opts.baseline=arg.substr(11);
+        } else if (arg.compare(0, 12, "--threshold=")==0) {
+            // --threshold=PCT for all phases, --threshold=PHASE=PCT for one
+            std::string value=arg.substr(12);
+            size_t eq=value.find('=');
+            if (eq==std::string::npos) {
+                opts.threshold=atof(value.c_str());
+            } else {
+                opts.phase_thresholds[value.substr(0, eq)]=atof(value.c_str()+eq+1);
+            }
+        } else if (arg=="-o" && i+1<argc) {
+            opts.output=argv[++i];
+        } else if (arg.size()>1 && arg[0]=='-') {
+            std::cerr << "Unknown option " << arg << "\n";
+            return 1;
+        } else {
+            programs.push_back(details::load_program(arg));
+        }
+    }
+    if (opts.engines.empty()) {
+        opts.engines={"interp", "jit", "tiered"};
+        if (brainfuck::native::supported()) opts.engines.insert(opts.engines.begin()+1, "native");
+    }
+    if (opts.levels.empty()) opts.levels={0, 1, 2, 3};
+    if (opts.synthetic && !opts.scaling_steps) {
+        programs.push_back(details::large_program(opts.large_size));
+        programs.push_back(details::nested_program(opts.depth));
+    }
+    if (programs.empty() && !opts.scaling_steps) {
+        std::cerr << "Usage: bf-bench [options] [--corpus=DIR] [files...]\n";
+        return 1;
+    }
+
+    std::vector<config> configs;
+    for (const auto &e : opts.engines) {
+        if (e=="interp" || e=="native") {
+            configs.push_back(config{e, -1});
+        } else if (e=="jit" || e=="tiered") {
+            for (int l : opts.levels) configs.push_back(config{e, l});
+        } else {
+            std::cerr << "Unknown engine " << e << "\n";
+            return 1;
+        }
+    }
+
+    details::baseline_type baseline;
+    if (!opts.baseline.empty()) baseline=details::load_baseline(opts.baseline);
+
+    char input_path[]="/tmp/bf-bench.XXXXXX";
+    int input_fd=mkstemp(input_path);
+    if (input_fd<0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(input_fd);
+
+    std::string json_text;
+    raw_string_ostream os(json_text);
+    json::OStream J(os, 2);
+    int regressions=0, failures=0, steep=0;
+    J.objectBegin();
+    J.attribute("llvm", LLVM_VERSION_STRING);
+    J.attribute("trials", opts.trials);
+    J.attributeBegin("results");
+    J.arrayBegin();
+    for (const auto &p : programs) {
+        std::ofstream(input_path, std::ios::binary) << p.input_;
+        for (const auto &c : configs) {
+            std::cerr << p.name_ << ", " << details::config_name(c) << std::flush;
+            std::vector<std::vector<double> > samples;
+            if (!details::sample(p, c, input_path, opts, samples)) {
+                std::cerr << ": failed\n";
+                failures++;
+                continue;
+            }
+
+            const auto &base=baseline[details::result_key(p.name_, c.engine_, c.level_)];
+            J.objectBegin();
+            J.attribute("program", p.name_);
+            J.attribute("engine", c.engine_);
+            if (c.level_>=0) J.attribute("level", c.level_);
+            J.attributeBegin("phases");
+            J.objectBegin();
+            std::string report;
+            for (int ph=0; ph<=PhaseCount; ph++) {
+                if (samples[ph].empty()) continue;
+                std::string name=ph<PhaseCount ? phase_names[ph] : "total";
+                details::summary s=details::summarize(samples[ph]);
+                J.attributeObject(name, [&]() {
+                    J.attribute("median", s.median_);
+                    J.attribute("mean", s.mean_);
+                    J.attribute("variance", s.variance_);
+                    J.attribute("min", s.min_);
+                });
+                if (ph==PhaseCount) std::cerr << ": " << s.median_ << "s";
+
+                auto b=base.find(name);
+                if (b==base.end() || b->second<noise_floor) continue;
+                auto pt=opts.phase_thresholds.find(name);
+                double threshold=pt==opts.phase_thresholds.end() ? opts.threshold : pt->second;
+                double change=(s.median_/b->second-1)*100;
+                if (change>threshold) {
+                    std::ostringstream msg;
+                    msg << "  regression: " << name << " " << b->second << "s -> " << s.median_
+                        << "s (" << std::showpos << change << std::noshowpos << "%, threshold " << threshold << "%)\n";
+                    report+=msg.str();
+                    regressions++;
+                }
+            }
+            J.objectEnd();
+            J.attributeEnd();
+            J.objectEnd();
+            std::cerr << "\n" << report;
+        }
+    }
+    J.arrayEnd();
+    J.attributeEnd();
+
+    if (opts.scaling_steps) {
+        // Each synthetic program doubles in size per step, from the size set by --large and --depth
+        std::ofstream(input_path, std::ios::binary).flush();
+        J.attributeBegin("scaling");
+        J.arrayBegin();
+        for (int family=0; family<2; family++) {
+            std::vector<program> sized;
+            std::vector<double> sizes;
+            for (int k=0; k<opts.scaling_steps; k++) {
+                size_t n=(family==0 ? opts.large_size : opts.depth) << k;
+                sized.push_back(family==0 ? details::large_program(n) : details::nested_program(n));
+                sizes.push_back(double(n));
+            }
+            for (const auto &c : configs) {
+                std::cerr << sized[0].name_ << ", " << details::config_name(c) << ": scaling" << std::flush;
+                // Medians per phase and size, negative where a trial failed
+                std::vector<std::vector<double> > medians(PhaseCount+1, std::vector<double>(sized.size(), -1));
+                for (size_t k=0; k<sized.size(); k++) {
+                    std::vector<std::vector<double> > samples;
+                    if (!details::sample(sized[k], c, input_path, opts, samples)) {
+                        failures++;
+                        break;
+                    }
+                    for (int ph=0; ph<=PhaseCount; ph++) {
+                        if (!samples[ph].empty()) medians[ph][k]=details::summarize(samples[ph]).median_;
+                    }
+                }
+
+                J.objectBegin();
+                J.attribute("program", sized[0].name_);
+                J.attribute("engine", c.engine_);
+                if (c.level_>=0) J.attribute("level", c.level_);
+                J.attributeArray("sizes", [&]() {
+                    for (double n : sizes) J.value(n);
+                });
+                J.attributeBegin("phases");
+                J.objectBegin();
+                std::string report;
+                for (int ph=0; ph<=PhaseCount; ph++) {
+                    if (medians[ph][0]<0) continue;
+                    std::string name=ph<PhaseCount ? phase_names[ph] : "total";
+                    std::vector<double> xs, ys;
+                    for (size_t k=0; k<sized.size(); k++) {
+                        if (medians[ph][k]<scaling_floor) continue;
+                        xs.push_back(sizes[k]);
+                        ys.push_back(medians[ph][k]);
+                    }
+                    double e=xs.size()>1 ? details::exponent(xs, ys) : 0;
+                    J.attributeObject(name, [&]() {
+                        J.attributeArray("median", [&]() {
+                            for (double m : medians[ph]) J.value(m);
+                        });
+                        if (xs.size()>1) J.attribute("exponent", e);
+                    });
+                    if (xs.size()<2) continue;
+                    std::ostringstream growth;
+                    growth.precision(2);
+                    growth << "n^" << std::fixed << e;
+                    std::cerr << " " << name << " " << growth.str();
+                    if (e>opts.max_exponent) {
+                        report+="  superlinear: " + name + " grows as " + growth.str() + "\n";
+                        steep++;
+                    }
+                }
+                J.objectEnd();
+                J.attributeEnd();
+                J.objectEnd();
+                std::cerr << "\n" << report;
+            }
+        }
+        J.arrayEnd();
+        J.attributeEnd();
+    }
+    J.objectEnd();
+    os << "\n";
+    os.flush();
+    unlink(input_path);
+
+    if (opts.output.empty()) {
+        std::cout << json_text;
+    } else {
+        std::ofstream out(opts.output.c_str(), std::ios::binary);
+        out << json_text;
+        if (!out) {
+            std::cerr << "Can not write " << opts.output << "\n";
+            return 1;
+        }
+    }
+    if (regressions) std::cerr << regressions << " regressions against " << opts.baseline << "\n";
+    if (steep) std::cerr << steep << " phases grow faster than n^" << opts.max_exponent << "\n";
+    if (failures) std::cerr << failures << " failed runs\n";
+    return regressions || failures || steep ? 1 : 0;
+}
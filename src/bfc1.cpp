@@ -6,25 +6,65 @@
 //  Copyright (c) 2012 Xu Chen. All rights reserved.
 //
 
+#include <cerrno>
+#include <cstring>
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include "bfopt.h"
+#include "bftape.h"
 #include "bfcompiler.h"
+#include "bfstats.h"
 
 // TODO: Use some real command line option parser
 int main(int argc, const char * argv[])
 {
     brainfuck::compiler comp;
-    if (argc>1) {
-        std::ifstream src(argv[1]);
-        if (argc>2) {
-            std::ofstream dest(argv[2]);
-            comp.bfc(src, dest);
+    brainfuck::opt::options opts;
+    brainfuck::tape::options tape_opts;
+    brainfuck::stats::format stats_format=brainfuck::stats::Off;
+    std::vector<const char *> files;
+    for (int i=1; i<argc; i++) {
+        std::string arg(argv[i]);
+        if (comp.parse_option(arg)) {
+            // Handled
+        } else if (brainfuck::stats::parse_option(arg, stats_format)) {
+            brainfuck::stats::enable();
+        } else if (brainfuck::opt::parse_option(arg, opts) || brainfuck::tape::parse_option(arg, tape_opts)) {
+            // Handled
+        } else if (arg.size()>1 && arg[0]=='-') {
+            std::cerr << "Unknown option " << arg << "\n";
+            return 1;
         } else {
-            comp.bfc(src, std::cout);
+            files.push_back(argv[i]);
+        }
+    }
+    
+    if (files.size()>0) {
+        std::ifstream src(files[0]);
+        if (!src) {
+            std::cerr << "Could not open " << files[0] << ": " << strerror(errno) << "\n";
+            return 1;
+        }
+        if (files.size()>1) {
+            std::ofstream dest(files[1], std::ios::binary);
+            if (!dest) {
+                std::cerr << "Could not open " << files[1] << ": " << strerror(errno) << "\n";
+                return 1;
+            }
+            comp.bfc(src, dest, opts, tape_opts);
+            dest.close();
+            if (!dest) {
+                std::cerr << "Could not write " << files[1] << ": " << strerror(errno) << "\n";
+                return 1;
+            }
+        } else {
+            comp.bfc(src, std::cout, opts, tape_opts);
         }
     } else {
-        comp.bfc(std::cin, std::cout);
+        comp.bfc(std::cin, std::cout, opts, tape_opts);
     }
+    if (stats_format!=brainfuck::stats::Off) brainfuck::stats::print(std::cerr, stats_format);
     return 0;
 }
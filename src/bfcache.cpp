@@ -0,0 +1,194 @@
+//
+//  bfcache.cpp
+//  brainfuck
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "bfcache.h"
+
+using namespace llvm;
+
+namespace brainfuck {
+    namespace cache {
+        namespace details {
+            // Bump when the runtime ABI or codegen changes in a way settings do not show
+            const char *format_version = "bf-cache-5";
+
+            const char *module_prefix = "bfcache:";
+
+            std::string default_dir() {
+                if (const char *dir = getenv("BF_CACHE_DIR")) return dir;
+                SmallString<256> path;
+                if (const char *xdg = getenv("XDG_CACHE_HOME")) {
+                    path = xdg;
+                } else if (const char *home = getenv("HOME")) {
+                    path = home;
+                    sys::path::append(path, ".cache");
+                } else {
+                    return std::string();
+                }
+                sys::path::append(path, "bf");
+                return std::string(path.str());
+            }
+
+            struct entry {
+                sys::TimePoint<> used;
+                uint64_t size;
+                std::string path;
+
+                bool operator<(const entry &rhs) const {
+                    return used < rhs.used;
+                }
+            };
+        }   // End of namespace details
+
+        bool parse_option(const std::string &arg, options &opts) {
+            if (arg == "--no-cache") {
+                opts.enabled = false;
+            } else if (arg.compare(0, 12, "--cache-dir=") == 0) {
+                opts.dir = arg.substr(12);
+            } else if (arg.compare(0, 13, "--cache-size=") == 0) {
+                opts.max_size = strtoull(arg.c_str() + 13, 0, 10) * 1024 * 1024;
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        object_cache::object_cache(const options &opts)
+        : opts_(opts)
+        , dir_(opts.dir.empty() ? details::default_dir() : opts.dir)
+        {
+            if (!dir_.empty() && sys::fs::create_directories(dir_)) {
+                // Caching silently turns off when there is nowhere to write
+                dir_.clear();
+            }
+        }
+
+        std::string object_cache::key(const std::string &src_hash, const std::string &settings) {
+            std::string host;
+            if (auto JTMB = orc::JITTargetMachineBuilder::detectHost()) {
+                host = JTMB->getTargetTriple().str() + ';' + JTMB->getCPU() + ';' + JTMB->getFeatures().getString();
+            } else {
+                consumeError(JTMB.takeError());
+            }
+
+            std::string material;
+            material += details::format_version;
+            material += '\n';
+            material += LLVM_VERSION_STRING;
+            material += '\n';
+            material += host;
+            material += '\n';
+            material += settings;
+            material += '\n';
+            material += src_hash;
+
+            ArrayRef<uint8_t> data(reinterpret_cast<const uint8_t *>(material.data()), material.size());
+            return toHex(SHA1::hash(data), true);
+        }
+
+        std::string object_cache::module_id(const std::string &key) {
+            return details::module_prefix + key;
+        }
+
+        std::unique_ptr<MemoryBuffer> object_cache::load(const std::string &key) {
+            if (dir_.empty()) return nullptr;
+            std::string file = path(key);
+            auto buffer = MemoryBuffer::getFile(file);
+            if (!buffer) return nullptr;
+            // Modification time doubles as the last use
+            utime(file.c_str(), 0);
+            return std::move(*buffer);
+        }
+
+        void object_cache::remove(const std::string &key) {
+            if (!dir_.empty()) sys::fs::remove(path(key));
+        }
+
+        void object_cache::notifyObjectCompiled(const Module *M, MemoryBufferRef Obj) {
+            std::string key;
+            if (!key_of(M, key)) return;
+
+            // Write under a temporary name, so concurrent runs never see half an object
+            std::string file = path(key);
+            std::string tmp = file + ".tmp" + std::to_string(getpid());
+            {
+                std::error_code EC;
+                raw_fd_ostream os(tmp, EC, sys::fs::OF_None);
+                if (EC) return;
+                os << Obj.getBuffer();
+                os.close();
+                if (os.has_error()) {
+                    os.clear_error();
+                    sys::fs::remove(tmp);
+                    return;
+                }
+            }
+            if (sys::fs::rename(tmp, file)) {
+                sys::fs::remove(tmp);
+                return;
+            }
+            evict();
+        }
+
+        std::unique_ptr<MemoryBuffer> object_cache::getObject(const Module *M) {
+            std::string key;
+            if (!key_of(M, key)) return nullptr;
+            return load(key);
+        }
+
+        std::string object_cache::path(const std::string &key) const {
+            SmallString<256> file(dir_);
+            sys::path::append(file, key + ".o");
+            return std::string(file.str());
+        }
+
+        bool object_cache::key_of(const Module *M, std::string &key) const {
+            if (dir_.empty()) return false;
+            const std::string &id = M->getModuleIdentifier();
+            size_t n = strlen(details::module_prefix);
+            if (id.compare(0, n, details::module_prefix) != 0) return false;
+            key = id.substr(n);
+            return true;
+        }
+
+        void object_cache::evict() {
+            std::vector<details::entry> entries;
+            uint64_t total = 0;
+            std::error_code EC;
+            for (sys::fs::directory_iterator i(dir_, EC), end; i != end && !EC; i.increment(EC)) {
+                if (sys::path::extension(i->path()) != ".o") continue;
+                sys::fs::file_status status;
+                if (sys::fs::status(i->path(), status)) continue;
+                details::entry e = { status.getLastModificationTime(), status.getSize(), i->path() };
+                entries.push_back(e);
+                total += e.size;
+            }
+            if (total <= opts_.max_size) return;
+
+            std::sort(entries.begin(), entries.end());
+            for (const auto &e : entries) {
+                if (total <= opts_.max_size) break;
+                if (!sys::fs::remove(e.path)) total -= e.size;
+            }
+        }
+    }   // End of namespace cache
+}   // End of namespace brainfuck
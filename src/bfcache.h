@@ -0,0 +1,69 @@
+//
+//  bfcache.h
+//  brainfuck
+//
+//  On-disk cache of objects compiled by the JIT. A warm run links the cached
+//  object and skips the idiom passes, codegen and the pass pipeline.
+//
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#ifndef brainfuck_bfcache_h
+#define brainfuck_bfcache_h
+
+namespace brainfuck {
+    namespace cache {
+        struct options {
+            inline options()
+            : enabled(true)
+            , max_size(64*1024*1024)
+            {}
+
+            bool enabled;
+            uint64_t max_size;      // Bytes kept on disk, least recently used objects go first
+            std::string dir;        // Empty for $BF_CACHE_DIR, $XDG_CACHE_HOME/bf or ~/.cache/bf
+        };
+
+        // Handle --no-cache, --cache-dir=DIR and --cache-size=MB, returns false if arg is
+        // not a cache option
+        bool parse_option(const std::string &arg, options &opts);
+
+        // Objects are stored as <key>.o, modules take part when their identifier is
+        // module_id(key)
+        struct object_cache : public llvm::ObjectCache {
+            object_cache(const options &opts);
+
+            // Key of compiling the source with digest src_hash using settings, which must
+            // spell out everything that changes the generated code, for this LLVM and host CPU
+            static std::string key(const std::string &src_hash, const std::string &settings);
+
+            static std::string module_id(const std::string &key);
+
+            // Cached object of key or null, a hit counts as a use for eviction
+            std::unique_ptr<llvm::MemoryBuffer> load(const std::string &key);
+
+            // Drop an object which turned out to be unusable
+            void remove(const std::string &key);
+
+            void notifyObjectCompiled(const llvm::Module *M, llvm::MemoryBufferRef Obj) override;
+            std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *M) override;
+
+        private:
+            std::string path(const std::string &key) const;
+            bool key_of(const llvm::Module *M, std::string &key) const;
+
+            // Remove least recently used objects until the cache fits max_size
+            void evict();
+
+            options opts_;
+            std::string dir_;
+        };  // End of object_cache
+    }   // End of namespace cache
+}   // End of namespace brainfuck
+
+#endif
@@ -10,7 +10,19 @@
 // by 星灿长风v(StarWindv) on 2025/11/29
 
 
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
 #include "bfcodegen.h"
+#include "bfeval.h"
+#include "bfprofile.h"
+#include "bfrt.h"
+#include "bfstats.h"
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/DerivedTypes.h>
@@ -18,9 +30,17 @@
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/IR/Constants.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Metadata.h>
 #include <llvm/IR/GlobalVariable.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/IR/PassInstrumentation.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
 
 using namespace llvm;
 namespace brainfuck {
@@ -31,212 +51,1136 @@ namespace brainfuck {
         }
         
         struct context {
-            context(Module &m, unsigned int cell_size, size_t storage_size)
+            /// Context of 'cell *bf_main(bf_io *io, cell *tape)' running the whole program on a
+            /// zeroed tape, and of 'int main()' calling it on the process tape and stdio
+            context(Module &m, const tape::options &tape)
             : module(m)
             , ctx(module.getContext())
             , builder(ctx)
-            , CellType(IntegerType::get(ctx, cell_size))
-            , StorageType(ArrayType::get(CellType, storage_size))
-            , SPType(IntegerType::get(ctx, sizeof(storage_size)*8))
+            , CellType(IntegerType::get(ctx, tape.cell_size))
+            , SPType(IntegerType::get(ctx, sizeof(size_t)*8))
+            , CellPtrType(PointerType::getUnqual(CellType))
+            , IOPtrType(PointerType::getUnqual(IntegerType::getInt8Ty(ctx)))
+            , ptr(0)
+            , io(0)
             , get_char_(0)
             , put_char_(0)
+            , write_(0)
+            , scan_(0)
             , entry_(0)
+            , scratch_(0)
             {
-                // Initialize storage
-                storage = new GlobalVariable(m,
-                                             StorageType,
-                                             false,
-                                             GlobalValue::InternalLinkage,
-                                             ConstantAggregateZero::get(StorageType),
-                                             "s");
-                
-                // Initialize sp
-                sp = new GlobalVariable(m,
-                                        SPType,
-                                        false,
-                                        GlobalValue::InternalLinkage,
-                                        const_int(ctx, SPType, 0),
-                                        "sp");
-                
-                // Initialize external functions
+                declare_externals(true);
+                
+                // Initialize entry point, which keeps no state outside its arguments
                 {
-                    FunctionType *FT = FunctionType::get(IntegerType::getInt32Ty(ctx), false);
-                    get_char_ = Function::Create(FT, Function::ExternalLinkage, "getchar", &module);
+                    FunctionType *FT = FunctionType::get(CellPtrType, { IOPtrType, CellPtrType }, false);
+                    entry_ = Function::Create(FT, Function::ExternalLinkage, "bf_main", &m);
+                    BasicBlock *BB = BasicBlock::Create(ctx, "", entry_);
+                    builder.SetInsertPoint(BB);
+                    io = entry_->getArg(0);
+                    io->setName("io");
+                    ptr = entry_->getArg(1);
+                    ptr->setName("sp");
                 }
+                
+                // The tape is mapped by the runtime, settings are baked into the program
                 {
-                    std::vector<Type *> args(1, IntegerType::getInt32Ty(ctx));
-                    FunctionType *FT = FunctionType::get(Type::getVoidTy(ctx), args, false);
-                    put_char_ = Function::Create(FT, Function::ExternalLinkage, "putchar", &module);
+                    IntegerType *Int32Type = IntegerType::getInt32Ty(ctx);
+                    Function *main = Function::Create(FunctionType::get(Int32Type, false),
+                                                      Function::ExternalLinkage, "main", &m);
+                    IRBuilder<> main_builder(BasicBlock::Create(ctx, "", main));
+                    std::vector<Type *> args(3, SPType);
+                    args.push_back(Int32Type);
+                    FunctionType *FT = FunctionType::get(IOPtrType, args, false);
+                    FunctionCallee tape_init = module.getOrInsertFunction("bf_tape_init", FT);
+                    Value *origin = main_builder.CreateCall(tape_init, {
+                        const_int(ctx, SPType, tape.cell_size / 8),
+                        const_int(ctx, SPType, tape.size),
+                        const_int(ctx, SPType, tape.limit),
+                        const_int(ctx, Int32Type, tape.growth),
+                    }, "tape");
+                    main_builder.CreateCall(entry_, {
+                        ConstantPointerNull::get(IOPtrType),
+                        main_builder.CreateBitCast(origin, CellPtrType, "sp"),
+                    });
+                    main_builder.CreateRet(const_int(ctx, Int32Type, 0));
                 }
+            }
+            
+            /// Context of a function 'cell *name(cell *sp)' which works on a tape owned by the caller,
+            /// or 'cell *name(cell *sp, bf_io *io)' doing I/O on the caller's bf_io if with_io is set
+            context(Module &m, unsigned int cell_size, const std::string &name, bool with_io=false)
+            : module(m)
+            , ctx(module.getContext())
+            , builder(ctx)
+            , CellType(IntegerType::get(ctx, cell_size))
+            , SPType(IntegerType::get(ctx, sizeof(size_t)*8))
+            , CellPtrType(PointerType::getUnqual(CellType))
+            , IOPtrType(PointerType::getUnqual(IntegerType::getInt8Ty(ctx)))
+            , ptr(0)
+            , io(0)
+            , get_char_(0)
+            , put_char_(0)
+            , write_(0)
+            , scan_(0)
+            , entry_(0)
+            , scratch_(0)
+            {
+                declare_externals(with_io);
                 
-                // Initialize entry point, which is a function with name 'main'
-                {
-                    FunctionType *MainType = FunctionType::get(Type::getVoidTy(ctx), false);
-                    entry_ = Function::Create(MainType, Function::ExternalLinkage, "main", &m);
-                    BasicBlock *BB = BasicBlock::Create(ctx, "", entry_);
-                    builder.SetInsertPoint(BB);
+                // Callers generated first have declared it already
+                entry_ = m.getFunction(name);
+                if (!entry_) {
+                    std::vector<Type *> args(1, CellPtrType);
+                    if (with_io) args.push_back(IOPtrType);
+                    FunctionType *FT = FunctionType::get(CellPtrType, args, false);
+                    entry_ = Function::Create(FT, Function::ExternalLinkage, name, &m);
+                }
+                BasicBlock *BB = BasicBlock::Create(ctx, "", entry_);
+                builder.SetInsertPoint(BB);
+                ptr = entry_->getArg(0);
+                ptr->setName("sp");
+                if (with_io) {
+                    io = entry_->getArg(1);
+                    io->setName("io");
                 }
             }
             
             ~context() {
-                // Close up function 'main'
-                builder.CreateRetVoid();
+                // Close up the entry function
+                builder.CreateRet(ptr);
                 llvm::verifyFunction(*entry_);
             }
             
-            /// Return pointer to current cell
-            Value *current() {
-                std::vector<Value *> idx;
-                idx.push_back(const_int(ctx, IntegerType::getInt64Ty(ctx), 0));
-                idx.push_back(builder.CreateLoad(SPType, sp, "sp_load"));
-                return builder.CreateGEP(StorageType, storage, idx, "ptr");
+            /// Declare runtime functions from bfrt.h, the bf_io variants if with_io is set
+            void declare_externals(bool with_io) {
+                IntegerType *Int32Type = IntegerType::getInt32Ty(ctx);
+                std::vector<Type *> prefix;
+                if (with_io) prefix.push_back(IOPtrType);
+                const char *get_char_name = with_io ? "bf_io_getchar" : "bf_getchar";
+                const char *put_char_name = with_io ? "bf_io_putchar" : "bf_putchar";
+                const char *write_name = with_io ? "bf_io_write" : "bf_write";
+                
+                get_char_ = module.getFunction(get_char_name);
+                if (!get_char_) {
+                    FunctionType *FT = FunctionType::get(Int32Type, prefix, false);
+                    get_char_ = Function::Create(FT, Function::ExternalLinkage, get_char_name, &module);
+                }
+                put_char_ = module.getFunction(put_char_name);
+                if (!put_char_) {
+                    std::vector<Type *> args(prefix);
+                    args.push_back(Int32Type);
+                    FunctionType *FT = FunctionType::get(Type::getVoidTy(ctx), args, false);
+                    put_char_ = Function::Create(FT, Function::ExternalLinkage, put_char_name, &module);
+                }
+                write_ = module.getFunction(write_name);
+                if (!write_) {
+                    std::vector<Type *> args(prefix);
+                    args.push_back(PointerType::getUnqual(IntegerType::getInt8Ty(ctx)));
+                    args.push_back(SPType);
+                    FunctionType *FT = FunctionType::get(Type::getVoidTy(ctx), args, false);
+                    write_ = Function::Create(FT, Function::ExternalLinkage, write_name, &module);
+                }
+            }
+            
+            /// Return pointer to the cell at offset from current
+            Value *current(ptrdiff_t offset=0) {
+                if (offset == 0) return ptr;
+                return builder.CreateGEP(CellType, ptr, const_int(ctx, SPType, offset, true), "ptr");
+            }
+            
+            /// Move the data pointer, which lives in a SSA register
+            void move(ptrdiff_t offset) {
+                ptr = builder.CreateGEP(CellType, ptr, const_int(ctx, SPType, offset, true), "sp");
             }
             
             Instruction *get_char() {
-                Value *result = builder.CreateCall(get_char_);
-                // Truncate to cell size
-                return cast<Instruction>(builder.CreateTrunc(result, CellType, "getchar_trunc"));
+                Value *result = io ? builder.CreateCall(get_char_, { io }) : builder.CreateCall(get_char_);
+                // Fit to cell size, EOF stays -1 in wider cells
+                return cast<Instruction>(builder.CreateSExtOrTrunc(result, CellType, "getchar_trunc"));
             }
 
             Instruction *put_char(Value *arg) {
                 // Extend to 32 bits for putchar
-                Value *extended = builder.CreateZExt(arg, IntegerType::getInt32Ty(ctx), "putchar_ext");
+                Value *extended = builder.CreateZExtOrTrunc(arg, IntegerType::getInt32Ty(ctx), "putchar_ext");
+                if (io) return builder.CreateCall(put_char_, { io, extended });
                 return builder.CreateCall(put_char_, extended);
             }
             
+            /// Append bytes to the output buffer
+            Instruction *write(Value *buf, size_t n) {
+                if (io) return builder.CreateCall(write_, { io, buf, const_int(ctx, SPType, n) });
+                return builder.CreateCall(write_, { buf, const_int(ctx, SPType, n) });
+            }
+            
+            /// Move the data pointer to the next zero cell stride apart with the runtime kernels, byte cells only
+            void scan(ptrdiff_t stride) {
+                if (!scan_) {
+                    scan_ = module.getFunction("bf_scan");
+                    if (!scan_) {
+                        std::vector<Type *> args;
+                        args.push_back(CellPtrType);
+                        args.push_back(SPType);
+                        FunctionType *FT = FunctionType::get(CellPtrType, args, false);
+                        scan_ = Function::Create(FT, Function::ExternalLinkage, "bf_scan", &module);
+                        scan_->setOnlyReadsMemory();
+                    }
+                }
+                
+                // Short scans are common, check the first cells inline before calling the kernel
+                Function *TheFunction = builder.GetInsertBlock()->getParent();
+                BasicBlock *CallBB = BasicBlock::Create(ctx, "scan_call", TheFunction);
+                BasicBlock *DoneBB = BasicBlock::Create(ctx, "scan_done", TheFunction);
+                std::vector<std::pair<Value *, BasicBlock *> > found;
+                Value *zero = ConstantInt::get(CellType, 0);
+                for (int i = 0; i < BF_SCAN_INLINE_STEPS; i++) {
+                    if (i > 0) move(stride);
+                    BasicBlock *NextBB = i + 1 < BF_SCAN_INLINE_STEPS
+                                       ? BasicBlock::Create(ctx, "scan_step", TheFunction, CallBB)
+                                       : CallBB;
+                    Value *cur_val = builder.CreateLoad(CellType, ptr, "current_load");
+                    builder.CreateCondBr(builder.CreateICmpEQ(cur_val, zero), DoneBB, NextBB);
+                    found.push_back(std::make_pair(ptr, builder.GetInsertBlock()));
+                    builder.SetInsertPoint(NextBB);
+                }
+                move(stride);
+                Value *result = builder.CreateCall(scan_, { ptr, const_int(ctx, SPType, stride, true) }, "sp");
+                found.push_back(std::make_pair(result, builder.GetInsertBlock()));
+                builder.CreateBr(DoneBB);
+                
+                builder.SetInsertPoint(DoneBB);
+                PHINode *sp_phi = builder.CreatePHI(CellPtrType, found.size(), "sp");
+                for (const auto &f : found) {
+                    sp_phi->addIncoming(f.first, f.second);
+                }
+                ptr = sp_phi;
+            }
+            
+            /// Stack buffer used to gather output bytes, allocated in the entry block
+            Value *scratch() {
+                if (!scratch_) {
+                    IRBuilder<> entry_builder(&entry_->getEntryBlock(), entry_->getEntryBlock().begin());
+                    scratch_ = entry_builder.CreateAlloca(ArrayType::get(IntegerType::getInt8Ty(ctx), scratch_size),
+                                                          nullptr, "out_buf");
+                }
+                return scratch_;
+            }
+            
+            static const size_t scratch_size = 256;
+            
             Module &module;
             LLVMContext &ctx;
             IRBuilder<> builder;
             
             // Types
             IntegerType *CellType;
-            ArrayType *StorageType;
             IntegerType *SPType;
+            PointerType *CellPtrType;
+            PointerType *IOPtrType;     // struct bf_io *, opaque to the program
+            
+            // Current data pointer
+            Value *ptr;
             
-            // Global Variables
-            GlobalVariable *storage;
-            GlobalVariable *sp;
+            // I/O of the run, null for stdio
+            Value *io;
             
             // Predefined Functions
             Function *get_char_;
             Function *put_char_;
+            Function *write_;
+            Function *scan_;
             
             // Entry Point
             Function *entry_;
+            
+            // Output gathering buffer
+            AllocaInst *scratch_;
         };  // End of context
         
-        struct codegen_visitor : public boost::static_visitor<void> {
-            codegen_visitor(context &ctx) : ctx_(ctx) {}
+        struct codegen_visitor {
+            codegen_visitor(context &ctx, bool zero_tape=false, size_t zero_cells=0)
+            : ctx_(ctx)
+            , cell_mask_(ctx.CellType->getBitWidth() >= 64 ? ~uint64_t(0) : (uint64_t(1) << ctx.CellType->getBitWidth()) - 1)
+            , zero_tape_(zero_tape)
+            , first_(0)
+            , zero_cells_(zero_cells)
+            , disp_(0)
+            , counts_(0)
+            , use_(0)
+            , regions_(0)
+            , self_(SIZE_MAX)
+            {}
             
-            template<typename T>
-            void operator()(const T &n) const {
-                codegen(n);
+            /// Count entries and iterations of the loops of n in a side array, the
+            /// runtime writes them to a report at exit
+            void instrument(const ir::Program &n, const profile::loop_table &loops, const std::string &path) {
+                // Number, line, column and body ops of each loop left in the program
+                std::vector<uint64_t> table;
+                std::vector<int64_t> open;
+                slots_.assign(loops.size(), -1);
+                for (const auto &op : n) {
+                    if (op.code_ == ir::LoopEnd) {
+                        open.pop_back();
+                        continue;
+                    }
+                    // A nested loop counts as one op of the enclosing body
+                    if (!open.empty() && open.back() >= 0) table[4 * open.back() + 3]++;
+                    if (op.code_ != ir::LoopBegin && op.code_ != ir::Scan) continue;
+                    int64_t slot = -1;
+                    if (op.src_ >= 0 && size_t(op.src_) < loops.size()) {
+                        slot = int64_t(table.size() / 4);
+                        slots_[op.src_] = slot;
+                        const parser::location &where = loops[op.src_];
+                        table.insert(table.end(), { uint64_t(op.src_), where.line_, where.column_,
+                                                    uint64_t(op.code_ == ir::Scan ? 1 : 0) });
+                    }
+                    if (op.code_ == ir::LoopBegin) open.push_back(slot);
+                }
+                
+                IntegerType *Int64Type = IntegerType::getInt64Ty(ctx_.ctx);
+                size_t count = table.size() / 4;
+                CountsType_ = ArrayType::get(Int64Type, 2 * count);
+                counts_ = new GlobalVariable(ctx_.module, CountsType_, false, GlobalValue::InternalLinkage,
+                                             ConstantAggregateZero::get(CountsType_), "bf_profile_counts");
+                Constant *loops_init = ConstantDataArray::get(ctx_.ctx, table);
+                GlobalVariable *loops_table = new GlobalVariable(ctx_.module, loops_init->getType(), true,
+                                                                 GlobalValue::InternalLinkage, loops_init,
+                                                                 "bf_profile_loops");
+                
+                PointerType *Int64PtrType = PointerType::getUnqual(Int64Type);
+                PointerType *BytePtrType = PointerType::getUnqual(IntegerType::getInt8Ty(ctx_.ctx));
+                FunctionType *FT = FunctionType::get(Type::getVoidTy(ctx_.ctx),
+                                                     { Int64PtrType, Int64PtrType, ctx_.SPType, BytePtrType }, false);
+                FunctionCallee reg = ctx_.module.getOrInsertFunction("bf_profile_register", FT);
+                Value *path_ptr = path.empty() ? static_cast<Value *>(ConstantPointerNull::get(BytePtrType))
+                                               : ctx_.builder.CreateGlobalStringPtr(path, "profile_path");
+                ctx_.builder.CreateCall(reg, {
+                    ctx_.builder.CreateConstInBoundsGEP2_64(loops_init->getType(), loops_table, 0, 0),
+                    ctx_.builder.CreateConstInBoundsGEP2_64(CountsType_, counts_, 0, 0),
+                    const_int(ctx_.ctx, ctx_.SPType, count),
+                    path_ptr,
+                });
             }
             
-            void codegen(const ast::MoveLeft &n) const {
-                // sp -= n.count_
-                Value *sp_val = ctx_.builder.CreateLoad(ctx_.SPType, ctx_.sp, "sp_load");
-                Value *result = ctx_.builder.CreateSub(sp_val, 
-                                                     ConstantInt::get(ctx_.SPType, n.count_));
-                ctx_.builder.CreateStore(result, ctx_.sp);
+            /// Start from the state a run at compile time left: write its output, fill the tape
+            /// if ops are left to run and move to its data pointer
+            void start_from(const eval::snapshot &s, bool rest) {
+                if (!s.output.empty()) {
+                    Value *str = ctx_.builder.CreateGlobalStringPtr(s.output, "evaluated_output");
+                    ctx_.write(str, s.output.size());
+                }
+                if (rest) {
+                    size_t nonzero = 0;
+                    for (uint64_t v : s.cells) {
+                        if (v) nonzero++;
+                    }
+                    if (nonzero <= max_cell_stores) {
+                        for (size_t k = 0; k < s.cells.size(); k++) {
+                            if (s.cells[k]) codegen_set(ir::Op(ir::Set, int64_t(s.cells[k]), int32_t(k)));
+                        }
+                    } else {
+                        // Copied from a constant image of the cells
+                        std::vector<Constant *> cells;
+                        for (uint64_t v : s.cells) {
+                            cells.push_back(ConstantInt::get(ctx_.CellType, v));
+                        }
+                        ArrayType *ImageType = ArrayType::get(ctx_.CellType, cells.size());
+                        GlobalVariable *image = new GlobalVariable(ctx_.module, ImageType, true, GlobalValue::PrivateLinkage,
+                                                                   ConstantArray::get(ImageType, cells), "evaluated_tape");
+                        unsigned int bytes = ctx_.CellType->getBitWidth() / 8;
+                        ctx_.builder.CreateMemCpy(ctx_.ptr, MaybeAlign(bytes), image, MaybeAlign(bytes),
+                                                  cells.size() * bytes);
+                        learn_snapshot(s, 0);
+                    }
+                }
+                codegen_move(ir::Op(ir::Move, int64_t(s.pointer)));
             }
             
-            void codegen(const ast::MoveRight &n) const {
-                // sp += n.count_
-                Value *sp_val = ctx_.builder.CreateLoad(ctx_.SPType, ctx_.sp, "sp_load");
-                Value *result = ctx_.builder.CreateAdd(sp_val, 
-                                                     ConstantInt::get(ctx_.SPType, n.count_));
-                ctx_.builder.CreateStore(result, ctx_.sp);
+            /// Cells left by a run at compile time are known, with cell 0 at origin from the data pointer
+            void learn_snapshot(const eval::snapshot &s, ptrdiff_t origin) {
+                first_ = origin;
+                size_t learnt = 0;
+                for (size_t k = 0; k < s.cells.size(); k++) {
+                    if (!s.cells[k]) continue;
+                    if (++learnt > max_cell_stores) {
+                        // Too many to keep track of
+                        forget_all();
+                        return;
+                    }
+                    learn(origin + ptrdiff_t(k), s.cells[k]);
+                }
             }
             
-            void codegen(const ast::Add &n) const {
-                // storage[sp] += n.count_
-                Value *current_ptr = ctx_.current();
+            /// Lay out and unroll loops by the counts of an earlier run
+            void optimize_with(const profile::report &use) {
+                use_ = &use;
+            }
+            
+            /// Count of a loop in the profile in use, null if there is none
+            const profile::loop_count *profiled(const ir::Op &n) const {
+                return use_ ? use_->find(n.src_) : nullptr;
+            }
+            
+            /// Unrolling and vectorizing hints for a profiled loop as loop metadata, null to leave it to LLVM
+            MDNode *loop_hints(const profile::loop_count &c) {
+                LLVMContext &C = ctx_.ctx;
+                std::vector<Metadata *> hints(1, nullptr);  // Taken by the self reference
+                // Less than 0.1% of the ops in loops
+                bool cold = c.ops * 1000 < use_->total;
+                // Hot loops are left to the unroller, which takes the trip count from the
+                // branch weights. Loops with a constant trip count are still fully unrolled
+                // and folded away, only unrolling with a runtime trip count is turned off
+                if (cold || c.iterations < 2 * c.entries) {
+                    // Rarely run or short loops only grow the code
+                    hints.push_back(MDNode::get(C, MDString::get(C, "llvm.loop.unroll.runtime.disable")));
+                }
+                if (cold) {
+                    hints.push_back(MDNode::get(C, {
+                        MDString::get(C, "llvm.loop.vectorize.enable"),
+                        ConstantAsMetadata::get(ConstantInt::getFalse(C)),
+                    }));
+                }
+                if (hints.size() == 1) return nullptr;
+                MDNode *loop_id = MDNode::getDistinct(C, hints);
+                loop_id->replaceOperandWith(0, loop_id);
+                return loop_id;
+            }
+            
+            /// Branch weights of taken and not taken, scaled to fit 32 bits
+            MDNode *branch_weights(uint64_t taken, uint64_t not_taken) {
+                while (taken > UINT32_MAX - 1 || not_taken > UINT32_MAX - 1) {
+                    taken /= 2;
+                    not_taken /= 2;
+                }
+                // Zero weights would claim a branch is never taken when it was only never reached
+                return MDBuilder(ctx_.ctx).createBranchWeights(uint32_t(taken + 1), uint32_t(not_taken + 1));
+            }
+            
+            /// Move a loop which never ran in the profile to a cold function, only the
+            /// test whether it runs stays inline
+            void outline(const ir::Program &n, size_t begin) {
+                flush_output();
+                forget_all();
+                Function *F = brainfuck::codegen_loop(ctx_.module, n, begin, "cold_loop_" + std::to_string(begin),
+                                                      ctx_.CellType->getBitWidth(), ctx_.io != nullptr);
+                F->setLinkage(GlobalValue::InternalLinkage);
+                F->addFnAttr(Attribute::Cold);
+                F->addFnAttr(Attribute::NoInline);
+                
+                Function *TheFunction = ctx_.builder.GetInsertBlock()->getParent();
+                BasicBlock *CallBB = BasicBlock::Create(ctx_.ctx, "cold_call", TheFunction);
+                BasicBlock *DoneBB = BasicBlock::Create(ctx_.ctx, "cold_done", TheFunction);
+                BasicBlock *PreheaderBB = ctx_.builder.GetInsertBlock();
+                Value *cur_val = ctx_.builder.CreateLoad(ctx_.CellType, ctx_.current(), "current_load");
+                Value *cond = ctx_.builder.CreateICmpNE(cur_val, ConstantInt::get(ctx_.CellType, 0));
+                ctx_.builder.CreateCondBr(cond, CallBB, DoneBB, branch_weights(0, 1));
+                
+                ctx_.builder.SetInsertPoint(CallBB);
+                std::vector<Value *> args(1, ctx_.ptr);
+                if (ctx_.io) args.push_back(ctx_.io);
+                Value *result = ctx_.builder.CreateCall(F, args, "sp");
+                ctx_.builder.CreateBr(DoneBB);
+                
+                ctx_.builder.SetInsertPoint(DoneBB);
+                PHINode *sp_phi = ctx_.builder.CreatePHI(ctx_.CellPtrType, 2, "sp");
+                sp_phi->addIncoming(ctx_.ptr, PreheaderBB);
+                sp_phi->addIncoming(result, CallBB);
+                ctx_.ptr = sp_phi;
+                learn(0, 0);
+            }
+            
+            /// Call the functions of regions instead of generating their ops, except for the
+            /// region starting at n[self] which is the one being generated
+            void call_regions(const region_list &regions, size_t self=SIZE_MAX) {
+                regions_ = &regions;
+                self_ = self;
+            }
+            
+            /// Call the function of the region starting at n[begin], returns the end of the
+            /// region or 0 if none starts there
+            size_t call_region(const ir::Program &n, size_t begin) {
+                if (!regions_ || begin == self_) return 0;
+                auto r = std::lower_bound(regions_->begin(), regions_->end(), begin,
+                                          [](const region &a, size_t b) { return a.begin < b; });
+                if (r == regions_->end() || r->begin != begin) return 0;
+                
+                flush_output();
+                forget_all();
+                std::vector<Value *> args(1, ctx_.ptr);
+                if (ctx_.io) args.push_back(ctx_.io);
+                std::vector<Type *> types(1, ctx_.CellPtrType);
+                if (ctx_.io) types.push_back(ctx_.IOPtrType);
+                FunctionCallee F = ctx_.module.getOrInsertFunction(r->name, FunctionType::get(ctx_.CellPtrType, types, false));
+                bool loop = n[begin].code_ == ir::LoopBegin && n[begin].jump_ + 1 == r->end;
+                if (!loop) {
+                    ctx_.ptr = ctx_.builder.CreateCall(F, args, "sp");
+                    return r->end;
+                }
+                
+                // A loop which is not entered must not be compiled, test it inline
+                Function *TheFunction = ctx_.builder.GetInsertBlock()->getParent();
+                BasicBlock *CallBB = BasicBlock::Create(ctx_.ctx, "region_call", TheFunction);
+                BasicBlock *DoneBB = BasicBlock::Create(ctx_.ctx, "region_done", TheFunction);
+                BasicBlock *PreheaderBB = ctx_.builder.GetInsertBlock();
+                Value *cur_val = ctx_.builder.CreateLoad(ctx_.CellType, ctx_.current(), "current_load");
+                ctx_.builder.CreateCondBr(ctx_.builder.CreateICmpNE(cur_val, ConstantInt::get(ctx_.CellType, 0)),
+                                          CallBB, DoneBB);
+                
+                ctx_.builder.SetInsertPoint(CallBB);
+                Value *result = ctx_.builder.CreateCall(F, args, "sp");
+                ctx_.builder.CreateBr(DoneBB);
+                
+                ctx_.builder.SetInsertPoint(DoneBB);
+                PHINode *sp_phi = ctx_.builder.CreatePHI(ctx_.CellPtrType, 2, "sp");
+                sp_phi->addIncoming(ctx_.ptr, PreheaderBB);
+                sp_phi->addIncoming(result, CallBB);
+                ctx_.ptr = sp_phi;
+                learn(0, 0);
+                return r->end;
+            }
+            
+            /// Count and weigh loops like parent, for the functions of regions parent calls
+            void share(const codegen_visitor &parent) {
+                counts_ = parent.counts_;
+                CountsType_ = parent.CountsType_;
+                slots_ = parent.slots_;
+                use_ = parent.use_;
+            }
+            
+            /// Generate n[begin] up to n[end], calling the functions of regions on the way
+            void range(const ir::Program &n, size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    if (size_t region_end = call_region(n, i)) {
+                        i = region_end - 1;
+                        continue;
+                    }
+                    // Outlined loops would not be counted when profiling again
+                    if (n[i].code_ == ir::LoopBegin && !counts_) {
+                        const profile::loop_count *c = profiled(n[i]);
+                        if (c && c->entries == 0) {
+                            outline(n, i);
+                            i = n[i].jump_;
+                            continue;
+                        }
+                    }
+                    codegen(n[i]);
+                }
+                finish();
+            }
+            
+            /// Add to the entries (0) or iterations (1) of a loop when profiling
+            void count(int32_t loop, unsigned int field, Value *n = nullptr) {
+                if (!counts_ || loop < 0 || size_t(loop) >= slots_.size() || slots_[loop] < 0) return;
+                IntegerType *Int64Type = IntegerType::getInt64Ty(ctx_.ctx);
+                Value *counter = ctx_.builder.CreateConstInBoundsGEP2_64(CountsType_, counts_, 0,
+                                                                         2 * slots_[loop] + field);
+                Value *old = ctx_.builder.CreateLoad(Int64Type, counter, "profile_load");
+                ctx_.builder.CreateStore(ctx_.builder.CreateAdd(old, n ? n : ConstantInt::get(Int64Type, 1)), counter);
+            }
+            
+            void codegen(const ir::Op &n) {
+                // Only a run of consecutive output is gathered into one append
+                if (n.code_ != ir::Output) flush_output();
+                switch (n.code_) {
+                    case ir::Add:       codegen_add(n); break;
+                    case ir::Move:      codegen_move(n); break;
+                    case ir::Set:       codegen_set(n); break;
+                    case ir::MulAdd:    codegen_muladd(n); break;
+                    case ir::Input:     codegen_input(n); break;
+                    case ir::Output:    codegen_output(n); break;
+                    case ir::LoopBegin: codegen_loop_begin(n); break;
+                    case ir::LoopEnd:   codegen_loop_end(n); break;
+                    case ir::Scan:      codegen_scan(n); break;
+                    case ir::Fork:      ir::brainfork_only();
+                }
+            }
+            
+            void codegen_add(const ir::Op &n) {
+                // storage[sp+offset] += value
+                Value *current_ptr = ctx_.current(n.offset_);
                 Value *current_val = ctx_.builder.CreateLoad(ctx_.CellType, current_ptr, "current_load");
                 Value *result = ctx_.builder.CreateAdd(current_val, 
-                                                     ConstantInt::get(ctx_.CellType, n.count_));
+                                                     ConstantInt::get(ctx_.CellType, n.value_, true));
                 ctx_.builder.CreateStore(result, current_ptr);
+                
+                uint64_t v;
+                if (known(n.offset_, v)) learn(n.offset_, v + uint64_t(n.value_));
             }
             
-            void codegen(const ast::Minus &n) const {
-                // storage[sp] -= n.count_
-                Value *current_ptr = ctx_.current();
+            void codegen_move(const ir::Op &n) {
+                // sp += value
+                ctx_.move(n.value_);
+                disp_ += n.value_;
+            }
+            
+            void codegen_set(const ir::Op &n) {
+                // storage[sp+offset] = value
+                Value *current_ptr = ctx_.current(n.offset_);
+                ctx_.builder.CreateStore(ConstantInt::get(ctx_.CellType, n.value_, true), current_ptr);
+                learn(n.offset_, uint64_t(n.value_));
+            }
+            
+            void codegen_muladd(const ir::Op &n) {
+                // storage[sp+offset] += storage[sp+src] * value
+                Value *src_ptr = ctx_.current(n.src_);
+                Value *src_val = ctx_.builder.CreateLoad(ctx_.CellType, src_ptr, "src_load");
+                Value *product = ctx_.builder.CreateMul(src_val,
+                                                      ConstantInt::get(ctx_.CellType, n.value_, true));
+                Value *current_ptr = ctx_.current(n.offset_);
                 Value *current_val = ctx_.builder.CreateLoad(ctx_.CellType, current_ptr, "current_load");
-                Value *result = ctx_.builder.CreateSub(current_val, 
-                                                     ConstantInt::get(ctx_.CellType, n.count_));
+                Value *result = ctx_.builder.CreateAdd(current_val, product);
                 ctx_.builder.CreateStore(result, current_ptr);
+                
+                uint64_t s, d;
+                if (known(n.src_, s) && known(n.offset_, d)) {
+                    learn(n.offset_, d + s * uint64_t(n.value_));
+                } else if (!known(n.src_, s) || s != 0) {
+                    forget(n.offset_);
+                }
             }
             
-            void codegen(const ast::Input &n) const {
-                // storage[sp] = get_char()
-                Value *current_ptr = ctx_.current();
+            void codegen_input(const ir::Op &n) {
+                // storage[sp+offset] = get_char()
+                flush_output();
+                forget(n.offset_);
+                Value *current_ptr = ctx_.current(n.offset_);
                 Value *input_char = ctx_.get_char();
                 ctx_.builder.CreateStore(input_char, current_ptr);
             }
             
-            void codegen(const ast::Output &n) const {
-                // put_char(storage[sp])
-                Value *current_ptr = ctx_.current();
-                Value *current_val = ctx_.builder.CreateLoad(ctx_.CellType, current_ptr, "current_load");
-                ctx_.put_char(current_val);
+            void codegen_output(const ir::Op &n) {
+                // put_char(storage[sp+offset]), gathered with the output ops right after it into one append
+                pending_byte b = { 0, 0, n.offset_ };
+                uint64_t v;
+                if (known(n.offset_, v)) {
+                    b.c = char(v);
+                } else {
+                    // A cell the run has not loaded may leave the tape, what came before is written first
+                    bool loaded = false;
+                    for (const auto &p : pending_) {
+                        if (p.value && p.offset == n.offset_) loaded = true;
+                    }
+                    if (!loaded) flush_output();
+                    Value *current_ptr = ctx_.current(n.offset_);
+                    b.value = ctx_.builder.CreateLoad(ctx_.CellType, current_ptr, "current_load");
+                }
+                pending_.push_back(b);
+                if (pending_.size() >= context::scratch_size) flush_output();
+            }
+            
+            /// Emit pending output as a single putchar or write
+            void flush_output() {
+                if (pending_.empty()) return;
+                
+                bool constant = true;
+                for (const auto &b : pending_) {
+                    if (b.value) constant = false;
+                }
+                
+                IntegerType *Int8Type = IntegerType::getInt8Ty(ctx_.ctx);
+                if (pending_.size() == 1) {
+                    Value *c = pending_[0].value ? pending_[0].value
+                                                 : ConstantInt::get(Int8Type, (unsigned char)pending_[0].c);
+                    ctx_.put_char(c);
+                } else if (constant) {
+                    std::string data;
+                    for (const auto &b : pending_) {
+                        data.push_back(b.c);
+                    }
+                    Value *str = ctx_.builder.CreateGlobalStringPtr(data, "out");
+                    ctx_.write(str, data.size());
+                } else {
+                    ArrayType *BufType = ArrayType::get(Int8Type, context::scratch_size);
+                    Value *buf = ctx_.scratch();
+                    for (size_t i = 0; i < pending_.size(); i++) {
+                        Value *c = pending_[i].value
+                                 ? ctx_.builder.CreateZExtOrTrunc(pending_[i].value, Int8Type)
+                                 : ConstantInt::get(Int8Type, (unsigned char)pending_[i].c);
+                        ctx_.builder.CreateStore(c, ctx_.builder.CreateConstInBoundsGEP2_64(BufType, buf, 0, i));
+                    }
+                    ctx_.write(ctx_.builder.CreateConstInBoundsGEP2_64(BufType, buf, 0, 0), pending_.size());
+                }
+                pending_.clear();
+            }
+            
+            /// Value of cell at offset from the data pointer if known at compile time
+            bool known(ptrdiff_t offset, uint64_t &v) const {
+                auto i = known_.find(disp_ + offset);
+                if (i != known_.end()) {
+                    if (!i->second) return false;
+                    v = *i->second;
+                    return true;
+                }
+                // Cells off the tape are not zero, touching them is a tape error
+                v = 0;
+                return zero_tape_ && disp_ + offset >= first_ && size_t(disp_ + offset - first_) < zero_cells_;
+            }
+            
+            void learn(ptrdiff_t offset, uint64_t v) {
+                known_[disp_ + offset] = v & cell_mask_;
+            }
+            
+            void forget(ptrdiff_t offset) {
+                if (zero_tape_) {
+                    known_[disp_ + offset] = std::nullopt;
+                } else {
+                    known_.erase(disp_ + offset);
+                }
             }
             
-            void codegen(const ast::Primitive &n) const {
-                boost::apply_visitor(*this, n);
+            /// Control flow merges, nothing is known any more
+            void forget_all() {
+                known_.clear();
+                zero_tape_ = false;
+                disp_ = 0;
             }
             
-            void codegen(const ast::Loop &n) const {
-                // while(storage[sp] != 0) { ... }
+            void codegen_loop_begin(const ir::Op &n) {
+                // while(storage[sp] != 0) {
+                flush_output();
+                forget_all();
                 Function *TheFunction = ctx_.builder.GetInsertBlock()->getParent();
                 BasicBlock *WhileBB = BasicBlock::Create(ctx_.ctx, "while_cond", TheFunction);
                 BasicBlock *WBeginBB = BasicBlock::Create(ctx_.ctx, "while_body", TheFunction);
                 BasicBlock *WEndBB = BasicBlock::Create(ctx_.ctx, "while_end", TheFunction);
                 
                 // Enter the while loop
+                count(n.src_, 0);
+                BasicBlock *PreheaderBB = ctx_.builder.GetInsertBlock();
                 ctx_.builder.CreateBr(WhileBB);
                 ctx_.builder.SetInsertPoint(WhileBB);
                 
+                // Data pointer at loop head, the back edge is added at the end of the body
+                PHINode *sp_phi = ctx_.builder.CreatePHI(ctx_.CellPtrType, 2, "sp");
+                sp_phi->addIncoming(ctx_.ptr, PreheaderBB);
+                ctx_.ptr = sp_phi;
+                
                 // While condition
                 Value *current_ptr = ctx_.current();
                 Value *cur_val = ctx_.builder.CreateLoad(ctx_.CellType, current_ptr, "current_load");
                 Value *zero = ConstantInt::get(ctx_.CellType, 0);
                 Value *cond = ctx_.builder.CreateICmpNE(cur_val, zero);
-                ctx_.builder.CreateCondBr(cond, WBeginBB, WEndBB);
+                BranchInst *br = ctx_.builder.CreateCondBr(cond, WBeginBB, WEndBB);
+                MDNode *hints = nullptr;
+                if (const profile::loop_count *c = profiled(n)) {
+                    // Each entry leaves once, so the ratio gives LLVM the trip count
+                    br->setMetadata(LLVMContext::MD_prof, branch_weights(c->iterations, c->entries));
+                    hints = loop_hints(*c);
+                }
                 
                 // While body
                 ctx_.builder.SetInsertPoint(WBeginBB);
-                for (const auto &cmd : *(n.commands_)) {
-                    codegen(cmd);
-                }
+                count(n.src_, 1);
+                loops_.push_back(loop_frame(WhileBB, WEndBB, sp_phi, hints));
+            }
+            
+            void codegen_loop_end(const ir::Op &n) {
+                // }
+                flush_output();
+                loop_frame loop = loops_.back();
+                loops_.pop_back();
                 
                 // Jump back to condition
-                ctx_.builder.CreateBr(WhileBB);
+                loop.sp_phi->addIncoming(ctx_.ptr, ctx_.builder.GetInsertBlock());
+                BranchInst *back = ctx_.builder.CreateBr(loop.cond);
+                if (loop.hints) back->setMetadata(LLVMContext::MD_loop, loop.hints);
 
-                // After while
-                ctx_.builder.SetInsertPoint(WEndBB);
+                // After while, the loop exits from the condition block
+                ctx_.builder.SetInsertPoint(loop.end);
+                ctx_.ptr = loop.sp_phi;
+                
+                // The loop only exits when the current cell is 0
+                forget_all();
+                learn(0, 0);
             }
             
-            void codegen(const ast::Command &n) const {
-                boost::apply_visitor(*this, n);
+            void codegen_scan(const ir::Op &n) {
+                // while(storage[sp] != 0) sp += value
+                if (ctx_.CellType->getBitWidth() == 8
+                    && n.value_ <= BF_SCAN_MAX_VECTOR_STRIDE && n.value_ >= -BF_SCAN_MAX_VECTOR_STRIDE)
+                {
+                    Value *start = ctx_.ptr;
+                    ctx_.scan(n.value_);
+                    if (counts_) {
+                        // Byte cells, the distance covered is the number of steps times stride
+                        IntegerType *Int64Type = IntegerType::getInt64Ty(ctx_.ctx);
+                        Value *distance = ctx_.builder.CreateSub(ctx_.builder.CreatePtrToInt(ctx_.ptr, Int64Type),
+                                                                 ctx_.builder.CreatePtrToInt(start, Int64Type));
+                        count(n.src_, 0);
+                        count(n.src_, 1, ctx_.builder.CreateExactSDiv(distance, ConstantInt::get(Int64Type, n.value_, true)));
+                    }
+                    forget_all();
+                    learn(0, 0);
+                } else {
+                    codegen_loop_begin(n);
+                    codegen_move(ir::Op(ir::Move, n.value_));
+                    codegen_loop_end(n);
+                }
             }
             
-            void codegen(const ast::Commands &n) const {
-                for (const auto &cmd : n) {
-                    codegen(cmd);
-                }
+            void operator()(const ir::Program &n) {
+                range(n, 0, n.size());
             }
             
-            void operator()(const ast::Program &n) const {
-                codegen(n);
+            void finish() {
+                flush_output();
             }
             
+            struct loop_frame {
+                loop_frame(BasicBlock *c, BasicBlock *e, PHINode *p, MDNode *h) : cond(c), end(e), sp_phi(p), hints(h) {}
+                BasicBlock *cond;
+                BasicBlock *end;
+                PHINode *sp_phi;
+                MDNode *hints;      // Loop metadata of the back edge, or null
+            };
+            
+            // Cells of a snapshot stored one by one, and known to codegen, up to this many
+            static const size_t max_cell_stores = 4096;
+            
+            struct pending_byte {
+                Value *value;   // Loaded cell, or null if the byte is c
+                char c;
+                ptrdiff_t offset;
+            };
+            
             context &ctx_;
+            
+            // Enclosing loops
+            std::vector<loop_frame> loops_;
+            
+            // Cells known at compile time, keyed by offset from the data pointer at the
+            // start of the current straight-line code, nullopt marks a clobbered cell
+            uint64_t cell_mask_;
+            std::map<ptrdiff_t, std::optional<uint64_t> > known_;
+            bool zero_tape_;    // Cells not in known_ still hold their initial 0
+            ptrdiff_t first_;   // Key of the first cell of the tape
+            size_t zero_cells_; // Cells from the first one that are on the tape however far it grows
+            ptrdiff_t disp_;
+            
+            // Output not emitted yet
+            std::vector<pending_byte> pending_;
+            
+            // Profile counters, null unless instrumented, and the record of each loop number
+            GlobalVariable *counts_;
+            ArrayType *CountsType_;
+            std::vector<int64_t> slots_;
+            
+            // Profile of an earlier run, or null
+            const profile::report *use_;
+            
+            // Parts of the program compiled on their own, or null
+            const region_list *regions_;
+            size_t self_;
         };  // End of codegen_visitor
+        
+        // Bounds of a function codegen generates in one piece. Some backend passes are quadratic in
+        // the size of a function or in the depth of its loops, larger code is cut into regions
+        const size_t max_function_ops = 1 << 10;
+        const size_t max_function_depth = 64;
+        
+        // Cut n[begin] up to n[end], the code of one function, into regions named prefix and their
+        // first op, so that no function has more than about max_ops ops or loops nested more than
+        // max_depth deep. With whole set every op goes to a region. Loops are sized up when they
+        // close, in one pass with an explicit stack, so any nesting is cut in linear time
+        region_list cut(const ir::Program &n, size_t begin, size_t end, bool whole, size_t max_ops,
+                        size_t max_depth, const std::string &prefix) {
+            // Body of an open loop, or the whole range at the bottom
+            struct frame {
+                size_t start;   // First op of the run not cut off yet
+                size_t ops;     // Ops of that run, loops staying in it included
+                size_t depth;   // Deepest nesting of loops staying in it
+                size_t calls;   // Regions cut off the body so far
+            };
+            region_list regions;
+            std::vector<frame> open(1, frame{ begin, 0, 0, 0 });
+            auto add = [&](size_t first, size_t last) {
+                regions.push_back({ first, last, prefix + std::to_string(first) });
+            };
+            for (size_t i = begin; i < end; i++) {
+                if (n[i].code_ == ir::LoopBegin) {
+                    open.push_back(frame{ i + 1, 0, 0, 0 });
+                    continue;
+                }
+                size_t first = i, ops = 1, depth = 0;
+                bool own = false;
+                if (n[i].code_ == ir::LoopEnd) {
+                    first = n[i].jump_;
+                    ops = open.back().ops + open.back().calls + 2;
+                    depth = open.back().depth + 1;
+                    open.pop_back();
+                    own = ops > max_ops || depth >= max_depth;
+                }
+                
+                frame &f = open.back();
+                bool bottom = open.size() == 1;
+                if (own) {
+                    // A function of its own, only its call stays
+                    add(first, i + 1);
+                    if (whole && bottom) {
+                        // Between top level regions, not in one
+                        if (f.start < first) add(f.start, first);
+                        f.start = i + 1;
+                        f.ops = 0;
+                        f.depth = 0;
+                    } else if (f.start == first) {
+                        // Runs start after it, no two regions start at the same op
+                        f.start = i + 1;
+                        f.calls++;
+                    } else {
+                        f.ops++;
+                    }
+                } else {
+                    if (f.ops + ops > max_ops && f.start < first) {
+                        add(f.start, first);
+                        f.start = first;
+                        f.ops = 0;
+                        f.depth = 0;
+                        f.calls++;
+                    }
+                    f.ops += ops;
+                    f.depth = std::max(f.depth, depth);
+                }
+            }
+            if (whole && open[0].start < end) add(open[0].start, end);
+            std::sort(regions.begin(), regions.end(), [](const region &a, const region &b) {
+                return a.begin < b.begin;
+            });
+            return regions;
+        }
+        
+        // Cells from cell 0 which read 0 until written on a tape of opts, growing to them if it
+        // has to. A fixed tape may map a few more, but nothing promises that
+        size_t zero_cells(const tape::options &opts) {
+            return opts.growth == BF_TAPE_FIXED || opts.limit < opts.size ? opts.size : opts.limit;
+        }
+
+        // Function of regions[i], with its I/O through a bf_io if with_io is set. parent, if any,
+        // is the generator of the function the regions were cut from
+        Function *define_region(Module &m, const ir::Program &n, const region_list &regions, size_t i,
+                                const tape::options &tape, bool with_io, const eval::snapshot *start,
+                                const codegen_visitor *parent) {
+            const region &r = regions[i];
+            context ctx(m, tape.cell_size, r.name, with_io);
+            // The first region starts on the zeroed tape, or on the cells of start, any other may follow anything
+            codegen_visitor generator(ctx, r.begin == 0, zero_cells(tape));
+            if (parent) generator.share(*parent);
+            if (start && r.begin == 0) generator.learn_snapshot(*start, -ptrdiff_t(start->pointer));
+            generator.call_regions(regions, r.begin);
+            generator.range(n, r.begin, r.end);
+            return ctx.entry_;
+        }
+        
+        // Functions of all regions in m, internal and never inlined back into their callers
+        void define_regions(Module &m, const ir::Program &n, const region_list &regions, const tape::options &tape,
+                            bool with_io, const eval::snapshot *start, const codegen_visitor *parent) {
+            for (size_t i = 0; i < regions.size(); i++) {
+                Function *F = define_region(m, n, regions, i, tape, with_io, start, parent);
+                F->setLinkage(GlobalValue::InternalLinkage);
+                F->addFnAttr(Attribute::NoInline);
+            }
+        }
+        
+        // Instruction and basic block counters for --stats
+        void count_module(const std::string &prefix, const Module &m) {
+            if (!stats::enabled()) return;
+            uint64_t blocks = 0, instructions = 0;
+            for (const Function &f : m) {
+                for (const BasicBlock &bb : f) {
+                    blocks++;
+                    instructions += bb.size();
+                }
+            }
+            stats::add(prefix + " instructions", instructions);
+            stats::add(prefix + " blocks", blocks);
+        }
+        
+        // Times each pass the pipeline runs, pass managers and adaptors only nest them
+        struct pass_timer {
+            void attach(PassInstrumentationCallbacks &PIC) {
+                PIC.registerBeforeNonSkippedPassCallback([this](StringRef name, Any) {
+                    start(name);
+                });
+                PIC.registerAfterPassCallback([this](StringRef, Any, const PreservedAnalyses &) {
+                    finish();
+                });
+                PIC.registerAfterPassInvalidatedCallback([this](StringRef, const PreservedAnalyses &) {
+                    finish();
+                });
+            }
+            
+            void start(StringRef name) {
+                bool nesting = name.contains("PassManager") || name.contains("PassAdaptor")
+                            || name.contains("AnalysisManagerProxy") || name.contains("RepeatedPass")
+                            || name.contains("InlinerWrapperPass");
+                running_.push_back(std::make_pair(nesting ? std::string() : name.str(),
+                                                  std::chrono::steady_clock::now()));
+            }
+            
+            void finish() {
+                if (running_.empty()) return;
+                if (!running_.back().first.empty()) {
+                    std::chrono::duration<double> d = std::chrono::steady_clock::now() - running_.back().second;
+                    stats::pass(running_.back().first, d.count());
+                }
+                running_.pop_back();
+            }
+            
+            std::vector<std::pair<std::string, std::chrono::steady_clock::time_point> > running_;
+        };  // End of pass_timer
     }   // End of namespace details
         
-    void codegen(Module &m, const ast::Program &n, unsigned int cell_size, size_t storage_size) {
-        details::context ctx(m, cell_size, storage_size);
-        details::codegen_visitor generator(ctx);
+    void codegen(Module &m, const ir::Program &n, const tape::options &tape, const profile::loop_table *profile,
+                 const std::string &profile_path, const profile::report *use, const eval::snapshot *start) {
+        details::context ctx(m, tape);
+        details::codegen_visitor generator(ctx, true, details::zero_cells(tape));
+        if (profile) generator.instrument(n, *profile, profile_path);
+        if (use) generator.optimize_with(*use);
+        if (start) generator.start_from(*start, !n.empty());
+        region_list regions = details::cut(n, 0, n.size(), false, details::max_function_ops,
+                                           details::max_function_depth, "region_");
+        generator.call_regions(regions);
         generator(n);
+        details::define_regions(m, n, regions, tape, true, start, &generator);
+    }
+    
+    region_list split(const ir::Program &n, size_t max_ops, size_t max_depth) {
+        // bf_main only calls regions, every top level op is in one
+        return details::cut(n, 0, n.size(), true, max_ops, max_depth, "region_");
+    }
+    
+    void codegen_split(Module &m, const ir::Program &n, const region_list &regions, const tape::options &tape,
+                       const eval::snapshot *start) {
+        details::context ctx(m, tape);
+        details::codegen_visitor generator(ctx);
+        if (start) generator.start_from(*start, !n.empty());
+        generator.call_regions(regions);
+        generator.range(n, 0, n.size());
+    }
+    
+    Function *codegen_region(Module &m, const ir::Program &n, const region_list &regions, size_t i,
+                             const tape::options &tape, const eval::snapshot *start) {
+        return details::define_region(m, n, regions, i, tape, true, start, nullptr);
+    }
+    
+    Function *codegen_loop(Module &m, const ir::Program &n, size_t begin, const std::string &name, unsigned int cell_size,
+                           bool with_io) {
+        size_t end = n[begin].jump_;
+        region_list regions = details::cut(n, begin + 1, end, false, details::max_function_ops,
+                                           details::max_function_depth, name + "_region_");
+        Function *F;
+        {
+            details::context ctx(m, cell_size, name, with_io);
+            details::codegen_visitor generator(ctx);
+            generator.call_regions(regions);
+            generator.range(n, begin, end + 1);
+            F = ctx.entry_;
+        }
+        // Loops do not start on a fresh tape, so no more than the cell size matters
+        tape::options tape;
+        tape.cell_size = cell_size;
+        details::define_regions(m, n, regions, tape, with_io, nullptr, nullptr);
+        return F;
+    }
+    
+    void multiversion(Module &m, const std::vector<std::string> &cpus) {
+        Function *entry = m.getFunction("bf_main");
+        if (!entry || cpus.empty()) return;
+        std::vector<Function *> defined;
+        for (Function &F : m) {
+            if (!F.isDeclaration() && F.getName() != "main") defined.push_back(&F);
+        }
+        
+        // A copy of the program per level, calling only its own functions
+        std::vector<std::pair<int, Function *> > versions;
+        for (const std::string &cpu : cpus) {
+            ValueToValueMapTy VMap;
+            for (Function *F : defined) {
+                VMap[F] = Function::Create(F->getFunctionType(), Function::InternalLinkage,
+                                           F->getName() + "." + cpu, &m);
+            }
+            for (Function *F : defined) {
+                Function *C = cast<Function>(VMap[F]);
+                Function::arg_iterator arg = C->arg_begin();
+                for (Argument &A : F->args()) {
+                    arg->setName(A.getName());
+                    VMap[&A] = &*arg++;
+                }
+                SmallVector<ReturnInst *, 8> returns;
+                CloneFunctionInto(C, F, VMap, CloneFunctionChangeType::LocalChangesOnly, returns);
+                C->setLinkage(Function::InternalLinkage);
+                // The level alone, features of the target machine's CPU would leak into it
+                C->addFnAttr("target-cpu", cpu);
+                C->addFnAttr("target-features", "");
+            }
+            versions.push_back(std::make_pair(cpu.back() - '0', cast<Function>(VMap[entry])));
+        }
+        std::sort(versions.begin(), versions.end(), [](const std::pair<int, Function *> &a,
+                                                       const std::pair<int, Function *> &b) {
+            return a.first > b.first;
+        });
+        
+        // bf_main picks a version on each call, main and hosts calling it get the dispatch
+        LLVMContext &ctx = m.getContext();
+        IntegerType *Int32Type = IntegerType::getInt32Ty(ctx);
+        Function *dispatch = Function::Create(entry->getFunctionType(), Function::ExternalLinkage, "", &m);
+        entry->replaceAllUsesWith(dispatch);
+        dispatch->takeName(entry);
+        entry->setName("bf_main.default");
+        entry->setLinkage(Function::InternalLinkage);
+        std::vector<Value *> args;
+        for (Argument &A : dispatch->args()) {
+            A.setName(entry->getArg(A.getArgNo())->getName());
+            args.push_back(&A);
+        }
+        
+        IRBuilder<> builder(BasicBlock::Create(ctx, "", dispatch));
+        FunctionCallee cpu_level = m.getOrInsertFunction("bf_cpu_level", FunctionType::get(Int32Type, false));
+        Value *level = builder.CreateCall(cpu_level, {}, "level");
+        for (const std::pair<int, Function *> &v : versions) {
+            BasicBlock *CallBB = BasicBlock::Create(ctx, v.second->getName(), dispatch);
+            BasicBlock *NextBB = BasicBlock::Create(ctx, "", dispatch);
+            builder.CreateCondBr(builder.CreateICmpSGE(level, details::const_int(ctx, Int32Type, v.first)), CallBB, NextBB);
+            builder.SetInsertPoint(CallBB);
+            builder.CreateRet(builder.CreateCall(v.second, args));
+            builder.SetInsertPoint(NextBB);
+        }
+        builder.CreateRet(builder.CreateCall(entry, args));
+        llvm::verifyFunction(*dispatch);
+    }
+    
+    void optimize(Module &m, int optimization_level, TargetMachine *tm) {
+        details::count_module("llvm input", m);
+        if (optimization_level <= 0) return;
+        stats::timer t("passes");
+        
+        LoopAnalysisManager LAM;
+        FunctionAnalysisManager FAM;
+        CGSCCAnalysisManager CGAM;
+        ModuleAnalysisManager MAM;
+        
+        PassInstrumentationCallbacks PIC;
+        details::pass_timer timer;
+        if (stats::enabled()) timer.attach(PIC);
+        PassBuilder PB(tm, PipelineTuningOptions(), {}, &PIC);
+        
+        PB.registerModuleAnalyses(MAM);
+        PB.registerCGSCCAnalyses(CGAM);
+        PB.registerFunctionAnalyses(FAM);
+        PB.registerLoopAnalyses(LAM);
+        PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+        
+        ModulePassManager MPM;
+        if (optimization_level == 1) {
+            MPM = PB.buildPerModuleDefaultPipeline(OptimizationLevel::O1);
+        } else if (optimization_level == 2) {
+            MPM = PB.buildPerModuleDefaultPipeline(OptimizationLevel::O2);
+        } else {
+            MPM = PB.buildPerModuleDefaultPipeline(OptimizationLevel::O3);
+        }
+        
+        MPM.run(m, MAM);
+        t.stop();
+        details::count_module("llvm optimized", m);
     }
 }   // End of namespace brainfuck
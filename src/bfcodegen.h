@@ -10,14 +10,80 @@
 // by 星灿长风v(StarWindv) on 2025/11/29
 
 
+#include <string>
+#include <vector>
+#include <llvm/IR/Function.h>
 #include <llvm/IR/Module.h>
-#include "bfast.h"
+#include "bfeval.h"
+#include "bfir.h"
+#include "bfprofile.h"
+#include "bftape.h"
 
 #ifndef brainfuck_bfcodegen_h
 #define brainfuck_bfcodegen_h
 
+namespace llvm {
+    class TargetMachine;
+}   // End of namespace llvm
+
 namespace brainfuck {
-    void codegen(llvm::Module &m, const ast::Program &n, unsigned int cell_size=8, size_t storage_size=30000);
+    // Generate 'cell *bf_main(bf_io *io, cell *tape)' running the whole program on a zeroed
+    // tape, see bfrt.h, and 'int main()' which maps the process tape and calls it with a null
+    // io for stdin and stdout. Code of more ops, or loops nested deeper, than the backend
+    // copes with in linear time goes to functions of their own. bf_main counts the loops
+    // listed in profile and writes a report of them to profile_path at exit if profile is
+    // not null. Loops are weighted, unrolled and outlined by the counts in use if it is not
+    // null. If start is not null, n is what eval::run left of the program, and bf_main
+    // first writes the output of start and puts its cells on the tape
+    void codegen(llvm::Module &m, const ir::Program &n, const tape::options &tape=tape::options(),
+                 const profile::loop_table *profile=nullptr, const std::string &profile_path="",
+                 const profile::report *use=nullptr, const eval::snapshot *start=nullptr);
+    
+    // A part of a program compiled as a function of its own, 'cell *name(cell *sp, bf_io *io)',
+    // or 'cell *name(cell *sp)' in a function without I/O
+    struct region {
+        size_t begin;       // First op
+        size_t end;         // One past the last op
+        std::string name;
+    };
+    typedef std::vector<region> region_list;
+    
+    // Cut n into top level regions of about max_ops ops each, plus a region for every loop
+    // of more ops than that, nested loops included, whose body is cut the same way, and for
+    // every loop nested more than max_depth loops deep in its region. Regions are ordered by
+    // their first op
+    region_list split(const ir::Program &n, size_t max_ops, size_t max_depth=64);
+    
+    // Generate bf_main and main like codegen, with bf_main only calling the functions of
+    // the top level regions, which are declared in m but not defined
+    void codegen_split(llvm::Module &m, const ir::Program &n, const region_list &regions,
+                       const tape::options &tape=tape::options(),
+                       const eval::snapshot *start=nullptr);
+    
+    // Generate the function of regions[i], which calls the functions of the regions nested
+    // in it. tape and start are the ones given to codegen_split
+    llvm::Function *codegen_region(llvm::Module &m, const ir::Program &n,
+                                   const region_list &regions, size_t i,
+                                   const tape::options &tape=tape::options(),
+                                   const eval::snapshot *start=nullptr);
+    
+    // Generate 'cell *name(cell *sp)' which runs the loop starting at n[begin] on the
+    // caller's tape and returns the data pointer after the loop. With with_io it is
+    // 'cell *name(cell *sp, bf_io *io)' and does I/O like bf_main. Large or deeply nested
+    // loops get functions of their own like in codegen
+    llvm::Function *codegen_loop(llvm::Module &m, const ir::Program &n, size_t begin,
+                                 const std::string &name, unsigned int cell_size=8,
+                                 bool with_io=false);
+    
+    // Clone every function of m but main once for each x86-64 level in cpus ("x86-64-v2",
+    // "x86-64-v3" or "x86-64-v4"), each clone compiled for that level, and make bf_main
+    // call the clone of the best level the CPU running it has, see bf_cpu_level. Other
+    // CPUs run the original functions, compiled for the target machine's CPU
+    void multiversion(llvm::Module &m, const std::vector<std::string> &cpus);
+    
+    // Run LLVM default pipeline of the optimization level, 0 does nothing, tm lets
+    // passes use target information
+    void optimize(llvm::Module &m, int optimization_level, llvm::TargetMachine *tm=nullptr);
 }   // End of namespace brainfuck
 
 #endif
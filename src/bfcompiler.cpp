@@ -10,33 +10,192 @@
 // by 星灿长风v(StarWindv) on 2025/11/29
 
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
-#include <llvm/Support/raw_os_ostream.h>
-#include "bfparser.h"
-#include "bfast.h"
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#if LLVM_VERSION_MAJOR >= 17
+#include <llvm/TargetParser/Host.h>
+#include <llvm/TargetParser/SubtargetFeature.h>
+#else
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/Support/Host.h>
+#endif
+#include "bfir.h"
+#include "bfopt.h"
+#include "bffrontend.h"
 #include "bfcodegen.h"
 #include "bfcompiler.h"
+#include "bfeval.h"
+#include "bfstats.h"
+
+using namespace llvm;
 
 namespace brainfuck {
-    void compiler::bfc(std::istream &src, std::ostream &ir) {
-        std::string s((std::istreambuf_iterator<char>(src)),
-                      std::istreambuf_iterator<char>());
-        ast::Program prog;
-        bool ret = parser::parse(s.begin(), s.end(), prog);
-        if (!ret) {
-            std::cerr << "Syntax error\n";
-            exit(1);
+    namespace details {
+        TargetMachine *create_target_machine(const std::string &cpu_name, const std::string &attrs,
+                                             int optimization_level) {
+            InitializeNativeTarget();
+            InitializeNativeTargetAsmPrinter();
+            InitializeNativeTargetAsmParser();
+            
+            std::string triple = sys::getDefaultTargetTriple();
+            std::string error;
+            const Target *target = TargetRegistry::lookupTarget(triple, error);
+            if (!target) {
+                fprintf(stderr, "Could not find target %s: %s\n", triple.c_str(), error.c_str());
+                exit(1);
+            }
+            
+            std::string cpu = cpu_name.empty() ? "generic" : cpu_name;
+            SubtargetFeatures features;
+            if (cpu == "native") {
+                cpu = sys::getHostCPUName().str();
+                StringMap<bool> host_features;
+                if (sys::getHostCPUFeatures(host_features)) {
+                    for (const auto &f : host_features) {
+                        features.AddFeature(f.getKey(), f.getValue());
+                    }
+                }
+            }
+            // Later features override earlier ones, so -mattr goes on top of the host's
+            SmallVector<StringRef, 8> attr_list;
+            StringRef(attrs).split(attr_list, ',', -1, false);
+            for (StringRef attr : attr_list) {
+                features.AddFeature(attr);
+            }
+            
+#if LLVM_VERSION_MAJOR >= 18
+            CodeGenOptLevel level = optimization_level <= 0 ? CodeGenOptLevel::None
+                                  : optimization_level == 1 ? CodeGenOptLevel::Less
+                                  : optimization_level == 2 ? CodeGenOptLevel::Default
+                                  : CodeGenOptLevel::Aggressive;
+#else
+            CodeGenOpt::Level level = optimization_level <= 0 ? CodeGenOpt::None
+                                    : optimization_level == 1 ? CodeGenOpt::Less
+                                    : optimization_level == 2 ? CodeGenOpt::Default
+                                    : CodeGenOpt::Aggressive;
+#endif
+            // Position independent, so the default PIE link works
+            TargetMachine *tm = target->createTargetMachine(triple, cpu, features.getString(), TargetOptions(),
+                                                            Reloc::PIC_, {}, level);
+            if (!tm) {
+                fprintf(stderr, "Could not create target machine for %s\n", cpu.c_str());
+                exit(1);
+            }
+            return tm;
         }
+    }   // End of namespace details
+    
+    bool compiler::parse_option(const std::string &arg) {
+        if (arg.compare(0, 7, "--emit=")==0) {
+            std::string type = arg.substr(7);
+            if (type=="ir") {
+                emit = EmitIR;
+            } else if (type=="bc") {
+                emit = EmitBitcode;
+            } else if (type=="asm") {
+                emit = EmitAssembly;
+            } else if (type=="obj") {
+                emit = EmitObject;
+            } else {
+                fprintf(stderr, "Unknown output type %s\n", type.c_str());
+                exit(1);
+            }
+        } else if (arg.compare(0, 2, "-O")==0) {
+            optimization_level = atoi(arg.c_str()+2);
+        } else if (arg.compare(0, 6, "-mcpu=")==0) {
+            cpu = arg.substr(6);
+        } else if (arg.compare(0, 7, "-mattr=")==0) {
+            features = arg.substr(7);
+        } else if (arg=="--multiversion" || arg.compare(0, 15, "--multiversion=")==0) {
+            std::string list = arg.size()>14 ? arg.substr(15) : "x86-64-v3,x86-64-v4";
+            multiversion.clear();
+            SmallVector<StringRef, 4> cpus;
+            StringRef(list).split(cpus, ',', -1, false);
+            for (StringRef name : cpus) {
+                if (name!="x86-64-v2" && name!="x86-64-v3" && name!="x86-64-v4") {
+                    fprintf(stderr, "Unknown multiversion target %s, only x86-64-v2, x86-64-v3 and x86-64-v4 are\n",
+                            name.str().c_str());
+                    exit(1);
+                }
+                multiversion.push_back(name.str());
+            }
+        } else if (profile::parse_option(arg, profile)) {
+            // Handled
+        } else {
+            return false;
+        }
+        return true;
+    }
+    
+    void compiler::bfc(std::istream &src, std::ostream &out, const opt::options &opts,
+                       const tape::options &tape_opts) {
+        profile::loop_table loops;
+        bool positions = profile.enabled || !profile.use.empty();
+        ir::Program code = frontend::load(src, opts, positions ? &loops : nullptr);
+        profile::report use;
+        if (!profile.use.empty()) use = profile::read(profile.use, loops);
+        // Counts of a profiled run include every loop, none is run ahead of time
+        eval::snapshot start = eval::run(code, profile.enabled ? 0 : opts.eval_fuel, tape_opts);
         
         llvm::LLVMContext context;
         std::unique_ptr<llvm::Module> module = std::make_unique<llvm::Module>("brainfuck", context);
-        brainfuck::codegen(*module, prog);
+        std::unique_ptr<TargetMachine> tm(details::create_target_machine(cpu, features, optimization_level));
+        module->setTargetTriple(tm->getTargetTriple().str());
+        module->setDataLayout(tm->createDataLayout());
+        if (!multiversion.empty() && tm->getTargetTriple().getArch()!=Triple::x86_64) {
+            fprintf(stderr, "--multiversion needs an x86-64 target, not %s\n", tm->getTargetTriple().str().c_str());
+            exit(1);
+        }
         
-        llvm::raw_os_ostream os(ir);
-        module->print(os, nullptr);
+        stats::timer cg("codegen");
+        brainfuck::codegen(*module, code, tape_opts, profile.enabled ? &loops : nullptr, profile.path,
+                           profile.use.empty() ? nullptr : &use, &start);
+        brainfuck::multiversion(*module, multiversion);
+        cg.stop();
+        brainfuck::optimize(*module, optimization_level, tm.get());
+        
+        stats::timer t("emit");
+        SmallVector<char, 0> buffer;
+        raw_svector_ostream os(buffer);
+        switch (emit) {
+            case EmitIR:
+                module->print(os, nullptr);
+                break;
+            case EmitBitcode:
+                WriteBitcodeToFile(*module, os);
+                break;
+            case EmitAssembly:
+            case EmitObject: {
+                legacy::PassManager PM;
+#if LLVM_VERSION_MAJOR >= 18
+                CodeGenFileType type = emit == EmitObject ? CodeGenFileType::ObjectFile : CodeGenFileType::AssemblyFile;
+#else
+                CodeGenFileType type = emit == EmitObject ? CGFT_ObjectFile : CGFT_AssemblyFile;
+#endif
+                if (tm->addPassesToEmitFile(PM, os, nullptr, type)) {
+                    fprintf(stderr, "Target can not emit this file type\n");
+                    exit(1);
+                }
+                PM.run(*module);
+                break;
+            }
+        }
+        out.write(buffer.data(), buffer.size());
+        stats::add("output bytes", buffer.size());
     }
 }   // End of namespace brainfuck
@@ -9,14 +9,42 @@
 #include <string>
 #include <istream>
 #include <ostream>
+#include <vector>
+#include "bfopt.h"
+#include "bfprofile.h"
+#include "bftape.h"
 
 #ifndef brainfuck_bfcompiler_h
 #define brainfuck_bfcompiler_h
 
 namespace brainfuck {
     struct compiler {
-        // Compile source into IR
-        void bfc(std::istream &src, std::ostream &ir);
+        enum emit_type {
+            EmitIR,         // Textual LLVM IR
+            EmitBitcode,
+            EmitAssembly,
+            EmitObject,
+        };
+        
+        inline compiler()
+        : emit(EmitIR)
+        , optimization_level(3)
+        {}
+        
+        // Handle --emit=ir|bc|asm|obj, -O<n>, -mcpu=<cpu>, -mattr=<features>, --multiversion[=<cpus>]
+        // and the profile options, returns false if arg is not a compiler option
+        bool parse_option(const std::string &arg);
+        
+        // Compile source into IR, bitcode, assembly or an object for the host
+        void bfc(std::istream &src, std::ostream &out, const opt::options &opts=opt::options(),
+                 const tape::options &tape_opts=tape::options());
+        
+        emit_type emit;
+        int optimization_level;
+        std::string cpu;            // "native" for the host CPU, empty for generic
+        std::string features;       // Comma separated +feature or -feature, on top of those of cpu
+        std::vector<std::string> multiversion;  // x86-64 levels to clone the program for, see brainfuck::multiversion
+        profile::options profile;   // Write a loop profile, or optimize with one
     };
 }   // End of namespace brainfuck
 
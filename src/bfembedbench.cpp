@@ -0,0 +1,279 @@
+//
+//  bfembedbench.cpp
+//  brainfuck
+//
+//  Per call cost of running a filter program through libbrainfuck, against
+//  forking a child per call with its input and output on pipes, and against
+//  starting bf for each call. All three must produce the same output.
+//
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include "bflib.h"
+#include "bfopt.h"
+#include "bfrt.h"
+#include "bftape.h"
+
+namespace {
+    double now() {
+        std::chrono::duration<double> d = std::chrono::steady_clock::now().time_since_epoch();
+        return d.count();
+    }
+
+    bool read_file(const char *path, std::string &data) {
+        std::ifstream is(path, std::ios::binary);
+        if (!is) return false;
+        data.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    bool write_all(int fd, const char *p, size_t n) {
+        while (n > 0) {
+            ssize_t done = write(fd, p, n);
+            if (done < 0 && errno == EINTR) continue;
+            if (done <= 0) return false;
+            p += done;
+            n -= size_t(done);
+        }
+        return true;
+    }
+
+    void read_all(int fd, std::string &data) {
+        char buf[64 * 1024];
+        for (;;) {
+            ssize_t got = read(fd, buf, sizeof(buf));
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return;
+            data.append(buf, size_t(got));
+        }
+    }
+
+    // Run a child with input on its stdin, returns its output. child runs in the forked process
+    std::string pipe_through(const std::string &input, const std::function<void()> &child) {
+        int in[2], out[2];
+        if (pipe(in) != 0 || pipe(out) != 0) {
+            perror("pipe");
+            exit(1);
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            exit(1);
+        }
+        if (pid == 0) {
+            if (dup2(in[0], 0) < 0 || dup2(out[1], 1) < 0) _exit(127);
+            close(in[0]);
+            close(in[1]);
+            close(out[0]);
+            close(out[1]);
+            child();
+            _exit(0);
+        }
+        close(in[0]);
+        close(out[1]);
+
+        // Input goes in as the child takes it, so neither side waits on a full pipe
+        std::string output;
+        size_t written = 0;
+        if (input.empty()) close(in[1]);
+        for (;;) {
+            struct pollfd fds[2] = { { out[0], POLLIN, 0 }, { in[1], POLLOUT, 0 } };
+            int n = written < input.size() ? 2 : 1;
+            if (poll(fds, n, -1) < 0) {
+                if (errno == EINTR) continue;
+                perror("poll");
+                exit(1);
+            }
+            if (n == 2 && fds[1].revents) {
+                ssize_t done = write(in[1], input.data() + written, std::min(input.size() - written, size_t(4096)));
+                if (done < 0 && errno != EINTR && errno != EAGAIN) {
+                    // The child does not want the rest
+                    written = input.size();
+                } else if (done > 0) {
+                    written += size_t(done);
+                }
+                if (written == input.size()) close(in[1]);
+            }
+            if (fds[0].revents) {
+                char buf[64 * 1024];
+                ssize_t got = read(out[0], buf, sizeof(buf));
+                if (got < 0 && errno == EINTR) continue;
+                if (got <= 0) break;
+                output.append(buf, size_t(got));
+            }
+        }
+        if (written < input.size()) close(in[1]);
+        close(out[0]);
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "bf-embed-bench: child failed with status %d\n", status);
+            exit(1);
+        }
+        return output;
+    }
+
+    // Time calls of f, which returns the output of one call, and check it against expected
+    void bench(const char *name, size_t calls, const std::string &expected, double baseline,
+               const std::function<std::string()> &f, double &median) {
+        std::vector<double> times;
+        times.reserve(calls);
+        double start = now();
+        for (size_t i = 0; i < calls; i++) {
+            double t = now();
+            std::string output = f();
+            times.push_back(now() - t);
+            if (output != expected) {
+                fprintf(stderr, "bf-embed-bench: %s produced %zu bytes of output different from the library's %zu\n",
+                        name, output.size(), expected.size());
+                exit(1);
+            }
+        }
+        double elapsed = now() - start;
+        std::sort(times.begin(), times.end());
+        median = times[times.size() / 2];
+        printf("%-10s %8zu calls %12.2f us/call median %12.2f us min %12.1f calls/s",
+               name, calls, median * 1e6, times[0] * 1e6, calls / elapsed);
+        if (baseline > 0) printf(" %10.1fx", median / baseline);
+        printf("\n");
+    }
+}
+
+// Usage: bf-embed-bench [options] prog.b [input], see --help
+int main(int argc, const char * argv[])
+{
+    brainfuck::lib::options opts;
+    size_t calls = 10000, process_calls = 200;
+    std::string bf;
+    const char *program = 0, *input_path = 0;
+    std::vector<std::string> passed;   // Options bf gets as well
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 2, "-O") == 0) {
+            opts.optimization_level = atoi(arg.c_str() + 2);
+        } else if (arg.compare(0, 9, "--engine=") == 0) {
+            opts.engine = arg.substr(9);
+        } else if (arg.compare(0, 8, "--calls=") == 0) {
+            calls = std::max(1ul, strtoul(arg.c_str() + 8, 0, 10));
+        } else if (arg.compare(0, 16, "--process-calls=") == 0) {
+            process_calls = strtoul(arg.c_str() + 16, 0, 10);
+        } else if (arg.compare(0, 5, "--bf=") == 0) {
+            bf = arg.substr(5);
+        } else if (brainfuck::opt::parse_option(arg, opts.opt) || brainfuck::tape::parse_option(arg, opts.tape)) {
+            passed.push_back(arg);
+        } else if (arg == "--help" || (arg.size() > 1 && arg[0] == '-')) {
+            fprintf(stderr, "Usage: bf-embed-bench [-O] [--engine=jit|native] [--calls=N] [--process-calls=N] [--bf=PATH]\n"
+                            "                      [idiom and tape options] prog.b [input]\n");
+            return arg == "--help" ? 0 : 1;
+        } else if (!program) {
+            program = argv[i];
+        } else {
+            input_path = argv[i];
+        }
+    }
+    std::string src, input;
+    if (!program || !read_file(program, src)) {
+        fprintf(stderr, "bf-embed-bench: no program to run, see --help\n");
+        return 1;
+    }
+    if (input_path && !read_file(input_path, input)) {
+        fprintf(stderr, "bf-embed-bench: can not read %s\n", input_path);
+        return 1;
+    }
+    if (bf.empty()) {
+        // bf is built next to this benchmark
+        std::string self(argv[0]);
+        size_t slash = self.rfind('/');
+        bf = slash == std::string::npos ? "bf" : self.substr(0, slash + 1) + "bf";
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    double start = now();
+    std::string error;
+    std::unique_ptr<brainfuck::lib::Program> prog = brainfuck::lib::Program::compile(src, opts, error);
+    if (!prog) {
+        fprintf(stderr, "%s: %s", program, error.c_str());
+        return 1;
+    }
+    printf("%s: %zu bytes of input, compiled once in %.3fms\n", program, input.size(), (now() - start) * 1e3);
+
+    // Output of the library, which the other ways of running must match
+    std::vector<char> out(1024 * 1024);
+    brainfuck::lib::result r;
+    for (;;) {
+        r = prog->run(input.data(), input.size(), out.data(), out.size());
+        if (r.code != brainfuck::lib::output_full || out.size() >= BF_OUTPUT_LIMIT) break;
+        out.resize(out.size() * 2);
+    }
+    if (r.code != brainfuck::lib::ok) {
+        fprintf(stderr, "%s: %s", program, r.message.c_str());
+        return 1;
+    }
+    std::string expected(out.data(), r.output);
+
+    double library = 0, sink = 0, forked = 0, exec = 0;
+    bench("library", calls, expected, 0, [&]() {
+        brainfuck::lib::result r = prog->run(input.data(), input.size(), out.data(), out.size());
+        return std::string(out.data(), r.output);
+    }, library);
+    bench("sink", calls, expected, library, [&]() {
+        std::string output;
+        prog->run(input.data(), input.size(), [&output](const char *data, size_t n) {
+            output.append(data, n);
+            return true;
+        });
+        return output;
+    }, sink);
+    if (process_calls == 0) return 0;
+
+    // What embedding without the library takes: a child per call, with the program compiled in the parent
+    bench("fork", process_calls, expected, library, [&]() {
+        return pipe_through(input, [&]() {
+            std::string in;
+            read_all(0, in);
+            brainfuck::lib::result r = prog->run(in.data(), in.size(), [](const char *data, size_t n) {
+                return write_all(1, data, n);
+            });
+            if (r.code != brainfuck::lib::ok) _exit(1);
+        });
+    }, forked);
+
+    // And with a process starting from scratch, compiling the program every time
+    if (access(bf.c_str(), X_OK) != 0) {
+        printf("%-10s skipped, %s not found, see --bf\n", "exec", bf.c_str());
+        return 0;
+    }
+    passed.push_back("-O" + std::to_string(opts.optimization_level));
+    if (!opts.engine.empty()) passed.push_back("--engine=" + opts.engine);
+#ifdef BF_WITH_LLVM
+    // A cached object would skip the compile, which is part of what a process per call costs
+    if (opts.engine.empty() || opts.engine == "jit") passed.push_back("--no-cache");
+#endif
+    std::vector<const char *> args(1, bf.c_str());
+    for (const std::string &arg : passed) {
+        args.push_back(arg.c_str());
+    }
+    args.push_back(program);
+    args.push_back(nullptr);
+    bench("exec", process_calls, expected, library, [&]() {
+        return pipe_through(input, [&]() {
+            execv(bf.c_str(), const_cast<char *const *>(args.data()));
+            _exit(127);
+        });
+    }, exec);
+    return 0;
+}
@@ -0,0 +1,159 @@
+//
+//  bfeval.cpp
+//  brainfuck
+//
+
+#include <utility>
+#include <vector>
+#include "bfeval.h"
+#include "bfir.h"
+#include "bfstats.h"
+
+namespace brainfuck {
+    namespace eval {
+        namespace details {
+            // Cells the evaluator keeps at most, programs going further run at run time
+            const size_t max_cells = 1 << 20;
+
+            struct machine {
+                machine(size_t cells, unsigned int cell_size, uint64_t fuel)
+                : tape_(cells, 0)
+                , mask_(cell_size >= 64 ? ~uint64_t(0) : (uint64_t(1) << cell_size) - 1)
+                , p_(0)
+                , fuel_(fuel)
+                , ops_(0)
+                , committed_p_(0)
+                , committed_output_(0)
+                , committed_ops_(0)
+                {}
+
+                // Run prog[begin] up to prog[end], false if it has to stop before the end
+                bool run(const ir::Program &prog, size_t begin, size_t end) {
+                    for (size_t i = begin; i <= end; i++) {
+                        if (ops_ == fuel_) return false;
+                        ops_++;
+                        const ir::Op &op = prog[i];
+                        switch (op.code_) {
+                            case ir::Add:
+                                if (!at(op.offset_)) return false;
+                                store(p_ + op.offset_, tape_[p_ + op.offset_] + uint64_t(op.value_));
+                                break;
+                            case ir::Move:
+                                p_ += op.value_;
+                                break;
+                            case ir::Set:
+                                if (!at(op.offset_)) return false;
+                                store(p_ + op.offset_, uint64_t(op.value_));
+                                break;
+                            case ir::MulAdd:
+                                if (!at(op.offset_) || !at(op.src_)) return false;
+                                store(p_ + op.offset_, tape_[p_ + op.offset_] + tape_[p_ + op.src_] * uint64_t(op.value_));
+                                break;
+                            case ir::Input:
+                            case ir::Fork:
+                                return false;
+                            case ir::Output:
+                                if (!at(op.offset_)) return false;
+                                output_.push_back(char(tape_[p_ + op.offset_]));
+                                break;
+                            case ir::LoopBegin:
+                                if (!at(0)) return false;
+                                if (tape_[p_] == 0) i = op.jump_;
+                                break;
+                            case ir::LoopEnd:
+                                if (!at(0)) return false;
+                                if (tape_[p_] != 0) i = op.jump_;
+                                break;
+                            case ir::Scan:
+                                if (!at(0)) return false;
+                                while (tape_[p_] != 0) {
+                                    if (ops_ == fuel_) return false;
+                                    ops_++;
+                                    p_ += op.value_;
+                                    if (!at(0)) return false;
+                                }
+                                break;
+                        }
+                    }
+                    return true;
+                }
+
+                // Whether the cell at offset from the data pointer is on the evaluated tape
+                bool at(int64_t offset) const {
+                    return p_ + offset >= 0 && p_ + offset < int64_t(tape_.size());
+                }
+
+                void store(int64_t cell, uint64_t value) {
+                    undo_.push_back(std::make_pair(size_t(cell), tape_[cell]));
+                    tape_[cell] = value & mask_;
+                }
+
+                // Top level ops run completely or not at all
+                void commit() {
+                    undo_.clear();
+                    committed_p_ = p_;
+                    committed_output_ = output_.size();
+                    committed_ops_ = ops_;
+                }
+
+                void rollback() {
+                    while (!undo_.empty()) {
+                        tape_[undo_.back().first] = undo_.back().second;
+                        undo_.pop_back();
+                    }
+                    p_ = committed_p_;
+                    output_.resize(committed_output_);
+                    ops_ = committed_ops_;
+                }
+
+                std::vector<uint64_t> tape_;
+                uint64_t mask_;
+                int64_t p_;
+                uint64_t fuel_;
+                uint64_t ops_;
+                std::string output_;
+                std::vector<std::pair<size_t, uint64_t> > undo_;   // Cells written since the last commit
+
+                // State after the last top level op
+                int64_t committed_p_;
+                size_t committed_output_;
+                uint64_t committed_ops_;
+            };  // End of machine
+        }   // End of namespace details
+
+        snapshot run(ir::Program &prog, uint64_t fuel, const tape::options &tape_opts) {
+            snapshot s;
+            if (fuel == 0 || prog.empty()) return s;
+            stats::timer t("evaluate");
+
+            size_t cells = tape_opts.size < details::max_cells ? tape_opts.size : details::max_cells;
+            details::machine m(cells, tape_opts.cell_size, fuel);
+            size_t pc = 0;
+            while (pc < prog.size()) {
+                size_t end = prog[pc].code_ == ir::LoopBegin ? prog[pc].jump_ : pc;
+                // A top level move may leave the tape for good, that is left to run time
+                if (!m.run(prog, pc, end) || !m.at(0)) {
+                    m.rollback();
+                    break;
+                }
+                m.commit();
+                pc = end + 1;
+            }
+
+            s.pointer = size_t(m.committed_p_);
+            s.ops = m.committed_ops_;
+            s.output.swap(m.output_);
+            size_t used = m.tape_.size();
+            while (used > 0 && m.tape_[used - 1] == 0) used--;
+            s.cells.assign(m.tape_.begin(), m.tape_.begin() + used);
+
+            if (pc > 0) {
+                prog.erase(prog.begin(), prog.begin() + pc);
+                ir::link(prog);
+            }
+            stats::add("evaluated ops", s.ops);
+            stats::add("evaluated output bytes", s.output.size());
+            return s;
+        }
+    }   // End of namespace eval
+}   // End of namespace brainfuck
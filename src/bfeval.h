@@ -0,0 +1,43 @@
+//
+//  bfeval.h
+//  brainfuck
+//
+//  Partial evaluation before codegen. Programs often compute their whole
+//  output, or a long prefix of it, before reading anything; that part is run
+//  at compile time and the generated code starts from the state it left.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "bfir.h"
+#include "bftape.h"
+
+#ifndef brainfuck_bfeval_h
+#define brainfuck_bfeval_h
+
+namespace brainfuck {
+    namespace eval {
+        // Tape, data pointer and output of a program run at compile time
+        struct snapshot {
+            inline snapshot()
+            : pointer(0)
+            , ops(0)
+            {}
+
+            size_t pointer;                 // Cell the data pointer is at
+            std::vector<uint64_t> cells;    // Cells from cell 0 on, the rest of the tape is zero
+            std::string output;
+            uint64_t ops;                   // Ops run
+        };
+
+        // Run prog from the start, stopping before the first input or fork, after fuel ops, or before
+        // touching a cell which would not be mapped at start. A stop inside a loop goes back to
+        // where its top level loop was entered, so the ops left in prog start at the top level.
+        // The ops run are removed from prog, their state is returned
+        snapshot run(ir::Program &prog, uint64_t fuel, const tape::options &tape_opts=tape::options());
+    }   // End of namespace eval
+}   // End of namespace brainfuck
+
+#endif
@@ -0,0 +1,425 @@
+//
+//  bffork.cpp
+//  brainfuck
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "bffork.h"
+#include "bffrontend.h"
+#include "bfinterp.h"
+#include "bfrt.h"
+#include "bfstats.h"
+
+namespace brainfuck {
+    namespace fork {
+        namespace details {
+            // Output of a task in the order of a serial run: what it wrote up to each fork,
+            // then all the output of the task the fork made
+            struct node {
+                struct piece {
+                    std::string bytes;
+                    std::unique_ptr<node> child;    // Null for output after the last fork so far
+                };
+
+                node()
+                : done(false)
+                {}
+
+                std::vector<piece> pieces;
+                bool done;          // The task ended, nothing is added any more
+                std::string error;  // Message of a task which left its tape
+            };
+
+            // Writes output to stdout once everything before it in serial order is complete
+            struct writer {
+                explicit writer(node *root)
+                : cursor_(1, std::make_pair(root, size_t(0)))
+                {}
+
+                void append(node *n, const char *buf, size_t len) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (n->pieces.empty() || n->pieces.back().child) n->pieces.emplace_back();
+                    n->pieces.back().bytes.append(buf, len);
+                    advance();
+                }
+
+                // A node for the output of a task forked by the task of n
+                node *fork(node *n) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    n->pieces.emplace_back();
+                    n->pieces.back().child = std::make_unique<node>();
+                    return n->pieces.back().child.get();
+                }
+
+                void finish(node *n) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    n->done = true;
+                    advance();
+                }
+
+                // The task of n stopped with message, the program stops with it once the
+                // output before it in serial order is written
+                void fail(node *n, const std::string &message) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    n->error = message;
+                    n->done = true;
+                    advance();
+                }
+
+            private:
+                // Write all that is complete, nodes written in full are freed
+                void advance() {
+                    while (!cursor_.empty()) {
+                        node *n = cursor_.back().first;
+                        size_t &i = cursor_.back().second;
+                        if (i < n->pieces.size()) {
+                            node::piece &p = n->pieces[i];
+                            if (!p.bytes.empty()) {
+                                bf_write(p.bytes.data(), p.bytes.size());
+                                std::string().swap(p.bytes);
+                            }
+                            // Output after the last fork may still grow
+                            if (!p.child && i + 1 == n->pieces.size() && !n->done) return;
+                            i++;
+                            if (p.child) cursor_.push_back(std::make_pair(p.child.get(), size_t(0)));
+                        } else if (n->done) {
+                            if (!n->error.empty()) {
+                                // Tasks after it in serial order never ran in a serial run
+                                bf_flush();
+                                fputs(n->error.c_str(), stderr);
+                                _exit(1);
+                            }
+                            cursor_.pop_back();
+                            // Children are written, the task is gone
+                            if (!cursor_.empty()) n->pieces.clear();
+                        } else {
+                            return;
+                        }
+                    }
+                }
+
+                std::mutex mutex_;
+                std::vector<std::pair<node *, size_t> > cursor_;   // Nodes being written and their next piece
+            };  // End of writer
+
+            // State of a task which is not running
+            struct task {
+                size_t pc;                  // Op to go on from
+                int64_t sp;                 // Data pointer in cells from cell 0
+                ptrdiff_t lo;               // Bytes from cell 0 to the first byte of cells
+                std::vector<char> cells;    // Mapped part of the tape at the fork
+                size_t in_pos;
+                node *out;
+            };
+
+            // Tasks waiting for a worker, the owner takes the newest and thieves the oldest
+            struct queue {
+                std::mutex mutex;
+                std::deque<std::unique_ptr<task> > tasks;
+            };
+
+            struct pool {
+                explicit pool(size_t workers)
+                : queued_(0)
+                , live_(0)
+                , steals_(0)
+                {
+                    for (size_t i = 0; i < workers; i++) {
+                        queues_.push_back(std::make_unique<queue>());
+                    }
+                }
+
+                void push(size_t worker, std::unique_ptr<task> t) {
+                    {
+                        std::lock_guard<std::mutex> lock(queues_[worker]->mutex);
+                        queues_[worker]->tasks.push_back(std::move(t));
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        queued_++;
+                        live_++;
+                    }
+                    idle_.notify_one();
+                }
+
+                // Next task of worker, null once every task has ended
+                std::unique_ptr<task> next(size_t worker) {
+                    for (;;) {
+                        std::unique_ptr<task> t;
+                        {
+                            queue &own = *queues_[worker];
+                            std::lock_guard<std::mutex> lock(own.mutex);
+                            if (!own.tasks.empty()) {
+                                t = std::move(own.tasks.back());
+                                own.tasks.pop_back();
+                            }
+                        }
+                        for (size_t i = 1; !t && i < queues_.size(); i++) {
+                            queue &victim = *queues_[(worker + i) % queues_.size()];
+                            std::lock_guard<std::mutex> lock(victim.mutex);
+                            if (!victim.tasks.empty()) {
+                                t = std::move(victim.tasks.front());
+                                victim.tasks.pop_front();
+                                steals_++;
+                            }
+                        }
+
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        if (t) {
+                            queued_--;
+                            return t;
+                        }
+                        // Running tasks may still fork
+                        idle_.wait(lock, [this]() { return queued_ > 0 || live_ == 0; });
+                        if (live_ == 0) return nullptr;
+                    }
+                }
+
+                void finished() {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (--live_ == 0) idle_.notify_all();
+                }
+
+                uint64_t steals() const { return steals_; }
+
+            private:
+                std::vector<std::unique_ptr<queue> > queues_;
+                std::mutex mutex_;
+                std::condition_variable idle_;
+                size_t queued_;     // Tasks in queues
+                size_t live_;       // Tasks which have not ended, running ones included
+                std::atomic<uint64_t> steals_;
+            };  // End of pool
+
+            // What one worker keeps between tasks
+            struct worker {
+                size_t index;
+                const ir::Program *prog;
+                pool *tasks;
+                writer *out;
+                bf_tape *tape;
+                bf_io io;
+                std::unique_ptr<char[]> buffer;
+                task *current;
+                uint64_t forks;
+            };
+
+            // Sink of the output of a task, which goes to its node
+            int spill(void *ctx, const char *buf, size_t n) {
+                worker *w = static_cast<worker *>(ctx);
+                w->out->append(w->current->out, buf, n);
+                return 0;
+            }
+
+            // Fork the running task, the copy goes on from pc with its data pointer one cell right of p
+            // and a 1 in the cell right of p[offset], which the running task keeps as it was
+            template<typename Cell>
+            void spawn(worker &w, Cell *origin, Cell *p, ptrdiff_t offset, size_t pc) {
+                // Set while the tape is copied, which maps the cell first if it has to be
+                Cell *right = p + offset + 1;
+                Cell kept = *right;
+                *right = 1;
+                void *lo, *hi;
+                bf_tape_mapped(w.tape, &lo, &hi);
+                std::unique_ptr<task> child = std::make_unique<task>();
+                child->pc = pc;
+                child->sp = (p - origin) + 1;
+                child->lo = static_cast<char *>(lo) - reinterpret_cast<char *>(origin);
+                child->cells.assign(static_cast<char *>(lo), static_cast<char *>(hi));
+                *right = kept;
+                child->in_pos = w.io.in_pos;
+                // Output so far comes before all of the child's
+                bf_io_flush(&w.io);
+                child->out = w.out->fork(w.current->out);
+                w.tasks->push(w.index, std::move(child));
+                w.forks++;
+            }
+
+            template<typename Cell>
+            void execute(void *arg, void *tape) {
+                worker &w = *static_cast<worker *>(arg);
+                task &t = *w.current;
+                const ir::Program &prog = *w.prog;
+                Cell *origin = static_cast<Cell *>(tape);
+                // Cells outside the initial mapping of this thread's tape fault in as they are copied
+                if (!t.cells.empty()) memcpy(reinterpret_cast<char *>(origin) + t.lo, t.cells.data(), t.cells.size());
+                std::vector<char>().swap(t.cells);
+
+                Cell *p = origin + t.sp;
+                for (size_t pc = t.pc; pc < prog.size(); pc++) {
+                    const ir::Op &op = prog[pc];
+                    switch (op.code_) {
+                        case ir::Add:
+                            p[op.offset_] += Cell(op.value_);
+                            break;
+                        case ir::Move:
+                            p += op.value_;
+                            break;
+                        case ir::Set:
+                            p[op.offset_] = Cell(op.value_);
+                            break;
+                        case ir::MulAdd:
+                            p[op.offset_] += Cell(uint64_t(p[op.src_]) * uint64_t(Cell(op.value_)));
+                            break;
+                        case ir::Input:
+                            p[op.offset_] = Cell(bf_io_getchar(&w.io));
+                            break;
+                        case ir::Output:
+                            bf_io_putchar(&w.io, p[op.offset_]);
+                            break;
+                        case ir::Scan:
+                            p = interp::scan(p, op.value_);
+                            break;
+                        case ir::LoopBegin:
+                            if (p[0] == 0) pc = op.jump_;
+                            break;
+                        case ir::LoopEnd:
+                            if (p[0] != 0) pc = op.jump_;
+                            break;
+                        case ir::Fork:
+                            p[op.offset_] = 0;
+                            // Later ops of the copy keep their offsets
+                            spawn(w, origin, p, op.offset_, pc + 1);
+                            break;
+                    }
+                }
+                bf_io_flush(&w.io);
+            }
+
+            template<typename Cell>
+            void work(worker &w, const std::string &input) {
+                typedef void (*run_func_type)(void *arg, void *tape);
+                run_func_type run = execute<Cell>;
+                while (std::unique_ptr<task> t = w.tasks->next(w.index)) {
+                    w.current = t.get();
+                    w.io.in = reinterpret_cast<const unsigned char *>(input.data());
+                    w.io.in_len = input.size();
+                    w.io.in_pos = t->in_pos;
+                    w.io.out_len = 0;
+                    if (bf_tape_run(w.tape, run, &w) != 0) {
+                        bf_io_flush(&w.io);
+                        w.out->fail(t->out, bf_tape_message(w.tape));
+                    } else {
+                        w.out->finish(t->out);
+                    }
+                    w.current = nullptr;
+                    w.tasks->finished();
+                }
+            }
+
+            bool has_input(const ir::Program &prog) {
+                for (const ir::Op &op : prog) {
+                    if (op.code_ == ir::Input) return true;
+                }
+                return false;
+            }
+        }   // End of namespace details
+
+        bool parse_option(const std::string &arg, options &opts) {
+            if (arg == "--brainfork") {
+                opts.enabled = true;
+            } else if (arg.compare(0, 15, "--fork-threads=") == 0) {
+                opts.threads = (unsigned int)strtoul(arg.c_str() + 15, 0, 10);
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        void run(const ir::Program &prog, const options &fork_opts, const tape::options &tape_opts) {
+            // Every task reads on from where its parent was, so all of the input is kept
+            std::string input;
+            if (details::has_input(prog)) {
+                char buf[64 * 1024];
+                size_t n;
+                while ((n = fread(buf, 1, sizeof(buf), stdin)) > 0) {
+                    input.append(buf, n);
+                }
+            }
+
+            size_t threads = fork_opts.threads ? fork_opts.threads : std::thread::hardware_concurrency();
+            if (threads == 0) threads = 1;
+
+            // Tapes are mapped up front, the fault handler is installed before any worker runs
+            details::pool pool(threads);
+            details::node root;
+            details::writer writer(&root);
+            std::vector<details::worker> workers(threads);
+            for (size_t i = 0; i < threads; i++) {
+                details::worker &w = workers[i];
+                w.index = i;
+                w.prog = &prog;
+                w.tasks = &pool;
+                w.out = &writer;
+                w.tape = bf_tape_create(tape_opts.cell_size / 8, tape_opts.size, tape_opts.limit, tape_opts.growth);
+                if (!w.tape) {
+                    perror("bf_tape_create");
+                    exit(1);
+                }
+                memset(&w.io, 0, sizeof(w.io));
+                w.buffer.reset(new char[BF_OUTPUT_BUFFER_SIZE]);
+                w.io.out = w.buffer.get();
+                w.io.out_cap = BF_OUTPUT_BUFFER_SIZE;
+                w.io.sink = details::spill;
+                w.io.sink_ctx = &w;
+                w.current = nullptr;
+                w.forks = 0;
+            }
+            std::unique_ptr<details::task> main = std::make_unique<details::task>();
+            main->pc = 0;
+            main->sp = 0;
+            main->lo = 0;
+            main->in_pos = 0;
+            main->out = &root;
+            pool.push(0, std::move(main));
+
+            stats::timer t("run");
+            std::vector<std::thread> running;
+            for (size_t i = 0; i < threads; i++) {
+                running.emplace_back([&, i]() {
+                    switch (tape_opts.cell_size) {
+                        case 16:    details::work<uint16_t>(workers[i], input); break;
+                        case 32:    details::work<uint32_t>(workers[i], input); break;
+                        case 64:    details::work<uint64_t>(workers[i], input); break;
+                        default:    details::work<uint8_t>(workers[i], input); break;
+                    }
+                });
+            }
+            uint64_t forks = 0;
+            for (size_t i = 0; i < threads; i++) {
+                running[i].join();
+                forks += workers[i].forks;
+                bf_tape_destroy(workers[i].tape);
+            }
+            bf_flush();
+            t.stop();
+            stats::add("forks", forks);
+            stats::add("fork steals", pool.steals());
+        }
+
+        void run(std::istream &is, const options &fork_opts, const opt::options &opts,
+                 const tape::options &tape_opts) {
+            frontend::loader l;
+            l.brainfork(true);
+            l.reserve(frontend::remaining(is));
+            std::vector<char> buf(frontend::chunk_size);
+            std::streamsize n;
+            while ((n = is.rdbuf()->sgetn(&buf[0], buf.size())) > 0) {
+                l.feed(&buf[0], size_t(n));
+            }
+            run(l.finish(opts), fork_opts, tape_opts);
+        }
+    }   // End of namespace fork
+}   // End of namespace brainfuck
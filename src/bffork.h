@@ -0,0 +1,50 @@
+//
+//  bffork.h
+//  brainfuck
+//
+//  The brainfork dialect, bf --brainfork. 'Y' forks the running task: the
+//  current cell becomes 0, then the task goes on and a copy of it, with a
+//  copy of its tape and its input position, starts at the next op with its
+//  data pointer one cell to the right, on a cell set to 1 in the copy only.
+//  Tasks run on a pool of worker threads, each with a tape of its own,
+//  which take new tasks from their own queue and steal the oldest task of
+//  another queue when theirs runs dry. Output comes out as if every task ran
+//  to its end at the fork that made it, before its parent went on, so it
+//  does not depend on the number of threads or on how tasks were scheduled.
+//
+
+#include <istream>
+#include <string>
+#include "bfir.h"
+#include "bfopt.h"
+#include "bftape.h"
+
+#ifndef brainfuck_bffork_h
+#define brainfuck_bffork_h
+
+namespace brainfuck {
+    namespace fork {
+        struct options {
+            inline options()
+            : enabled(false)
+            , threads(0)
+            {}
+
+            bool enabled;
+            unsigned int threads;   // Workers, 0 for one per core
+        };
+
+        // Handle --brainfork and --fork-threads=N, returns false if arg is not a fork option
+        bool parse_option(const std::string &arg, options &opts);
+
+        // Run prog, which may fork, reading all of stdin first if it has input ops. When a task
+        // leaves its tape, exits with the message on stderr after the output before it in serial order
+        void run(const ir::Program &prog, const options &fork_opts=options(),
+                 const tape::options &tape_opts=tape::options());
+
+        void run(std::istream &is, const options &fork_opts=options(), const opt::options &opts=opt::options(),
+                 const tape::options &tape_opts=tape::options());
+    }   // End of namespace fork
+}   // End of namespace brainfuck
+
+#endif
@@ -0,0 +1,103 @@
+//
+//  bffrontend.cpp
+//  brainfuck
+//
+
+#include <stdlib.h>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "bfparser.h"
+#include "bfir.h"
+#include "bfopt.h"
+#include "bffrontend.h"
+#include "bfstats.h"
+
+namespace brainfuck {
+    namespace frontend {
+        namespace details {
+            // Larger sources grow the program as they go
+            const size_t max_reserve = 64*1024*1024;
+        }   // End of namespace details
+
+        size_t remaining(std::istream &is) {
+            std::istream::pos_type pos=is.tellg();
+            if (pos==std::istream::pos_type(-1)) {
+                is.clear();
+                return 0;
+            }
+            is.seekg(0, std::ios::end);
+            std::istream::pos_type end=is.tellg();
+            is.seekg(pos);
+            if (!is || end==std::istream::pos_type(-1) || end<pos) {
+                is.clear();
+                is.seekg(pos);
+                return 0;
+            }
+            return size_t(end-pos);
+        }
+
+        loader::loader()
+        : parser_(prog_)
+        {}
+
+        void loader::reserve(size_t n) {
+            // Only address space, pages are touched as ops are added
+            prog_.reserve(std::min(n, details::max_reserve));
+        }
+
+        void loader::record(std::vector<parser::location> *loops) {
+            parser_.record(loops);
+        }
+
+        void loader::brainfork(bool enabled) {
+            parser_.brainfork(enabled);
+        }
+
+        void loader::feed(const char *p, size_t n) {
+            stats::timer t("parse");
+            stats::add("source bytes", n);
+            if (!parser_.feed(p, n)) {
+                std::cerr << "Syntax error at " << parser_.error() << "\n";
+                exit(1);
+            }
+        }
+
+        ir::Program loader::finish(const opt::options &opts) {
+            stats::timer t("parse");
+            if (!parser_.finish()) {
+                std::cerr << "Syntax error at " << parser_.error() << "\n";
+                exit(1);
+            }
+            t.stop();
+            stats::count("parsed", prog_);
+
+            stats::timer o("optimize");
+            opt::optimize(prog_, opts);
+            o.stop();
+            stats::count("optimized", prog_);
+            return std::move(prog_);
+        }
+
+        ir::Program load(std::istream &src, const opt::options &opts, std::vector<parser::location> *loops) {
+            loader l;
+            l.record(loops);
+            l.reserve(remaining(src));
+            std::vector<char> buf(chunk_size);
+            std::streamsize n;
+            while ((n = src.rdbuf()->sgetn(&buf[0], buf.size())) > 0) {
+                l.feed(&buf[0], size_t(n));
+            }
+            return l.finish(opts);
+        }
+
+        ir::Program load(const std::string &s, const opt::options &opts, std::vector<parser::location> *loops) {
+            loader l;
+            l.record(loops);
+            l.reserve(s.size());
+            l.feed(s.data(), s.size());
+            return l.finish(opts);
+        }
+    }   // End of namespace frontend
+}   // End of namespace brainfuck
@@ -0,0 +1,62 @@
+//
+//  bffrontend.h
+//  brainfuck
+//
+//  Front end shared by all engines, source to optimized IR.
+//
+
+#include <istream>
+#include <string>
+#include <vector>
+#include "bfir.h"
+#include "bfopt.h"
+#include "bfparser.h"
+
+#ifndef brainfuck_bffrontend_h
+#define brainfuck_bffrontend_h
+
+namespace brainfuck {
+    namespace frontend {
+        // Streams are read this many bytes at a time
+        const size_t chunk_size = 64*1024;
+
+        // Bytes left in a seekable stream, 0 for pipes and terminals
+        size_t remaining(std::istream &is);
+
+        // Source can be fed in chunks of any size, for callers which look at it on the way
+        struct loader {
+            loader();
+            loader(const loader &) = delete;
+            loader &operator=(const loader &) = delete;
+
+            // Make room for a source of n bytes, which never takes more than n ops
+            void reserve(size_t n);
+
+            // Collect the source position of each loop, see parser::record
+            void record(std::vector<parser::location> *loops);
+
+            // Parse the brainfork dialect, see parser::brainfork
+            void brainfork(bool enabled);
+
+            // Parse the next chunk, exits on syntax error
+            void feed(const char *p, size_t n);
+
+            // Run idiom passes over the whole program, exits on syntax error
+            ir::Program finish(const opt::options &opts=opt::options());
+
+        private:
+            ir::Program prog_;
+            parser::parser parser_;
+        };  // End of loader
+
+        // Parse source and run idiom passes, exits on syntax error. Positions of the
+        // loops go to loops if it is not null
+        ir::Program load(std::istream &is, const opt::options &opts=opt::options(),
+                         std::vector<parser::location> *loops=nullptr);
+
+        ir::Program load(const std::string &src, const opt::options &opts=opt::options(),
+                         std::vector<parser::location> *loops=nullptr);
+    }   // End of namespace frontend
+}   // End of namespace brainfuck
+
+#endif
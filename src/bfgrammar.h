@@ -0,0 +1,176 @@
+//
+//  bfgrammar.h
+//  brainfuck
+//
+//  Created by Xu Chen on 12-9-8.
+//  Copyright (c) 2012 Xu Chen. All rights reserved.
+//
+//  The original Boost.Spirit grammar, superseded by the parser in bfparser.h
+//  and kept to compare parse throughput against it.
+//
+
+//#define BOOST_SPIRIT_DEBUG
+#include <boost/spirit/include/qi.hpp>
+#include <boost/spirit/include/support_istream_iterator.hpp>
+#include "bfast.h"
+#include "bfir.h"
+
+#ifndef brainfuck_bfgrammar_h
+#define brainfuck_bfgrammar_h
+
+namespace brainfuck {
+    namespace grammar {
+        template<typename Iterator>
+        struct skipper : boost::spirit::qi::grammar<Iterator> {
+            skipper() : skipper::base_type(start) {
+                using boost::spirit::ascii::char_;
+                using boost::spirit::no_skip;
+                using boost::spirit::lexeme;
+                // All chars other than these 8 are ignored
+                start = char_ - char_("-<>+,.[]")
+                ;
+            }
+            boost::spirit::qi::rule<Iterator> start;
+        };
+        
+        template<typename Iterator>
+        struct parser : boost::spirit::qi::grammar<Iterator, ast::Program(), skipper<Iterator> > {
+            parser() : parser::base_type(program) {
+                using boost::spirit::ascii::char_;
+                
+                program = +command >> boost::spirit::eoi
+                ;
+                
+                loop = '[' >> *command >> ']'
+                ;
+                
+                command = loop
+                        | primitive
+                ;
+                
+                primitive = moveleft
+                          | moveright
+                          | add
+                          | minus
+                          | input
+                          | output
+                ;
+                
+                moveleft = +char_('<')
+                ;
+                
+                moveright = +char_('>')
+                ;
+                
+                add = +char_('+')
+                ;
+                
+                minus = +char_('-')
+                ;
+                
+                input = char_(',')
+                ;
+                
+                output = char_('.')
+                ;
+                
+                BOOST_SPIRIT_DEBUG_NODE(program);
+                BOOST_SPIRIT_DEBUG_NODE(command);
+                BOOST_SPIRIT_DEBUG_NODE(loop);
+                BOOST_SPIRIT_DEBUG_NODE(primitive);
+                BOOST_SPIRIT_DEBUG_NODE(moveleft);
+                BOOST_SPIRIT_DEBUG_NODE(moveright);
+                BOOST_SPIRIT_DEBUG_NODE(add);
+                BOOST_SPIRIT_DEBUG_NODE(minus);
+                BOOST_SPIRIT_DEBUG_NODE(input);
+                BOOST_SPIRIT_DEBUG_NODE(output);
+            }
+            
+            bool parse(Iterator first, Iterator last, ast::Program& prog) {
+                return boost::spirit::qi::phrase_parse(first, last, *this, skipper<Iterator>(), prog);
+            }
+            
+            boost::spirit::qi::rule<Iterator, ast::Program(), skipper<Iterator> > program;
+            boost::spirit::qi::rule<Iterator, ast::Command(), skipper<Iterator> > command;
+            boost::spirit::qi::rule<Iterator, ast::Loop(), skipper<Iterator> > loop;
+            boost::spirit::qi::rule<Iterator, ast::Primitive(), skipper<Iterator> > primitive;
+            boost::spirit::qi::rule<Iterator, ast::MoveLeft(), skipper<Iterator> > moveleft;
+            boost::spirit::qi::rule<Iterator, ast::MoveRight(), skipper<Iterator> > moveright;
+            boost::spirit::qi::rule<Iterator, ast::Add(), skipper<Iterator> > add;
+            boost::spirit::qi::rule<Iterator, ast::Minus(), skipper<Iterator> > minus;
+            boost::spirit::qi::rule<Iterator, ast::Input(), skipper<Iterator> > input;
+            boost::spirit::qi::rule<Iterator, ast::Output(), skipper<Iterator> > output;
+        };  // End of parser
+        
+        template<typename Iterator>
+        bool parse(Iterator first, Iterator last, ast::Program &prog) {
+            parser<Iterator> parser;
+            return parser.parse(first, last, prog);
+        }
+        namespace details {
+            struct lower_visitor : public boost::static_visitor<void> {
+                lower_visitor(ir::Program &prog) : prog_(prog) {}
+
+                template<typename T>
+                void operator()(const T &n) const {
+                    lower(n);
+                }
+
+                void lower(const ast::MoveLeft &n) const {
+                    prog_.push_back(ir::Op(ir::Move, -int64_t(n.count_)));
+                }
+
+                void lower(const ast::MoveRight &n) const {
+                    prog_.push_back(ir::Op(ir::Move, int64_t(n.count_)));
+                }
+
+                void lower(const ast::Add &n) const {
+                    prog_.push_back(ir::Op(ir::Add, int64_t(n.count_)));
+                }
+
+                void lower(const ast::Minus &n) const {
+                    prog_.push_back(ir::Op(ir::Add, -int64_t(n.count_)));
+                }
+
+                void lower(const ast::Input &n) const {
+                    prog_.push_back(ir::Op(ir::Input));
+                }
+
+                void lower(const ast::Output &n) const {
+                    prog_.push_back(ir::Op(ir::Output));
+                }
+
+                void lower(const ast::Primitive &n) const {
+                    boost::apply_visitor(*this, n);
+                }
+
+                void lower(const ast::Loop &n) const {
+                    prog_.push_back(ir::Op(ir::LoopBegin));
+                    for (const auto &cmd : *(n.commands_)) {
+                        lower(cmd);
+                    }
+                    prog_.push_back(ir::Op(ir::LoopEnd));
+                }
+
+                void lower(const ast::Command &n) const {
+                    boost::apply_visitor(*this, n);
+                }
+
+                ir::Program &prog_;
+            };  // End of lower_visitor
+        }   // End of namespace details
+
+        // Convert AST into IR, one op per AST node
+        inline ir::Program lower(const ast::Program &prog) {
+            ir::Program ret;
+            details::lower_visitor visitor(ret);
+            for (const auto &cmd : prog) {
+                visitor.lower(cmd);
+            }
+            ir::link(ret);
+            return ret;
+        }
+    }   // End of namespace grammar
+}   // End of namespace brainfuck
+
+#endif
@@ -0,0 +1,164 @@
+//
+//  bfinterp.cpp
+//  brainfuck
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits>
+#include <vector>
+#include "bfir.h"
+#include "bffrontend.h"
+#include "bfinterp.h"
+#include "bfrt.h"
+#include "bfstats.h"
+#include "bftape.h"
+
+namespace brainfuck {
+    namespace interp {
+        namespace details {
+            int32_t operand(int64_t n) {
+                if (n < std::numeric_limits<int32_t>::min() || n > std::numeric_limits<int32_t>::max()) {
+                    fprintf(stderr, "Operand %lld out of range\n", (long long)n);
+                    exit(1);
+                }
+                return int32_t(n);
+            }
+
+            // Cell arithmetic wraps, so values only need to be kept modulo 2^32
+            int32_t wrap(int64_t n) {
+                return int32_t(uint32_t(n));
+            }
+
+#if defined(__GNUC__)
+            // Direct threaded code, each instruction holds the address of its handler
+            struct Threaded {
+                const void *label_;
+                int32_t offset_;
+                int32_t src_;
+                int32_t value_;
+            };
+
+            template<typename Cell>
+            void execute(const Bytecode &code, const tape::options &tape_opts) {
+                static const void *const labels[] = {
+                    &&do_add, &&do_move, &&do_set, &&do_muladd,
+                    &&do_input, &&do_output, &&do_scan, &&do_jz, &&do_jnz, &&do_halt,
+                };
+
+                std::vector<Threaded> tc(code.size());
+                for (size_t i=0; i<code.size(); i++) {
+                    Threaded t = { labels[code[i].code_], code[i].offset_, code[i].src_, code[i].value_ };
+                    tc[i] = t;
+                }
+
+                Cell *p=static_cast<Cell *>(tape::allocate(tape_opts));
+                const Threaded *base=&tc[0];
+                const Threaded *ip=base;
+
+#define BF_DISPATCH() goto *ip->label_
+#define BF_NEXT() do { ++ip; BF_DISPATCH(); } while (0)
+                BF_DISPATCH();
+
+            do_add:
+                p[ip->offset_]+=Cell(ip->value_);
+                BF_NEXT();
+            do_move:
+                p+=ip->value_;
+                BF_NEXT();
+            do_set:
+                p[ip->offset_]=Cell(ip->value_);
+                BF_NEXT();
+            do_muladd:
+                p[ip->offset_]+=Cell(uint64_t(p[ip->src_])*uint64_t(Cell(ip->value_)));
+                BF_NEXT();
+            do_input:
+                p[ip->offset_]=Cell(bf_getchar());
+                BF_NEXT();
+            do_output:
+                bf_putchar(p[ip->offset_]);
+                BF_NEXT();
+            do_scan:
+                p=scan(p, ip->value_);
+                BF_NEXT();
+            do_jz:
+                if (p[0]==0) {
+                    ip=base+ip->value_;
+                    BF_DISPATCH();
+                }
+                BF_NEXT();
+            do_jnz:
+                if (p[0]!=0) {
+                    ip=base+ip->value_;
+                    BF_DISPATCH();
+                }
+                BF_NEXT();
+            do_halt:
+                return;
+#undef BF_NEXT
+#undef BF_DISPATCH
+            }
+#else
+            template<typename Cell>
+            void execute(const Bytecode &code, const tape::options &tape_opts) {
+                Cell *p=static_cast<Cell *>(tape::allocate(tape_opts));
+                const Insn *base=&code[0];
+                for (const Insn *ip=base; ; ++ip) {
+                    switch (ip->code_) {
+                        case Add:       p[ip->offset_]+=Cell(ip->value_); break;
+                        case Move:      p+=ip->value_; break;
+                        case Set:       p[ip->offset_]=Cell(ip->value_); break;
+                        case MulAdd:    p[ip->offset_]+=Cell(uint64_t(p[ip->src_])*uint64_t(Cell(ip->value_))); break;
+                        case Input:     p[ip->offset_]=Cell(bf_getchar()); break;
+                        case Output:    bf_putchar(p[ip->offset_]); break;
+                        case Scan:      p=scan(p, ip->value_); break;
+                        case Jz:        if (p[0]==0) ip=base+ip->value_-1; break;
+                        case Jnz:       if (p[0]!=0) ip=base+ip->value_-1; break;
+                        case Halt:      return;
+                    }
+                }
+            }
+#endif
+        }   // End of namespace details
+
+        Bytecode compile(const ir::Program &prog) {
+            stats::timer t("bytecode");
+            Bytecode code;
+            code.reserve(prog.size()+1);
+            for (const ir::Op &op : prog) {
+                Insn insn = { 0, details::operand(op.offset_), details::operand(op.src_), 0 };
+                switch (op.code_) {
+                    case ir::Add:       insn.code_=Add; insn.value_=details::wrap(op.value_); break;
+                    case ir::Move:      insn.code_=Move; insn.value_=details::operand(op.value_); break;
+                    case ir::Set:       insn.code_=Set; insn.value_=details::wrap(op.value_); break;
+                    case ir::MulAdd:    insn.code_=MulAdd; insn.value_=details::wrap(op.value_); break;
+                    case ir::Input:     insn.code_=Input; break;
+                    case ir::Output:    insn.code_=Output; break;
+                    case ir::Scan:      insn.code_=Scan; insn.value_=details::operand(op.value_); break;
+                    case ir::LoopBegin: insn.code_=Jz; insn.value_=details::operand(op.jump_+1); break;
+                    case ir::LoopEnd:   insn.code_=Jnz; insn.value_=details::operand(op.jump_+1); break;
+                    case ir::Fork:      ir::brainfork_only();
+                }
+                code.push_back(insn);
+            }
+            Insn halt = { Halt, 0, 0, 0 };
+            code.push_back(halt);
+            return code;
+        }
+
+        void run(const Bytecode &code, const tape::options &tape_opts) {
+            stats::timer t("run");
+            switch (tape_opts.cell_size) {
+                case 16:    details::execute<uint16_t>(code, tape_opts); break;
+                case 32:    details::execute<uint32_t>(code, tape_opts); break;
+                case 64:    details::execute<uint64_t>(code, tape_opts); break;
+                default:    details::execute<uint8_t>(code, tape_opts); break;
+            }
+        }
+
+        void run(std::istream &is, const opt::options &opts, const tape::options &tape_opts) {
+            run(compile(frontend::load(is, opts)), tape_opts);
+        }
+    }   // End of namespace interp
+}   // End of namespace brainfuck
@@ -0,0 +1,72 @@
+//
+//  bfinterp.h
+//  brainfuck
+//
+//  Bytecode interpreter, runs programs without LLVM.
+//
+
+#include <stdint.h>
+#include <cstddef>
+#include <istream>
+#include <vector>
+#include "bfir.h"
+#include "bfopt.h"
+#include "bfrt.h"
+#include "bftape.h"
+
+#ifndef brainfuck_bfinterp_h
+#define brainfuck_bfinterp_h
+
+namespace brainfuck {
+    namespace interp {
+        enum Opcode {
+            Add,        // cell[offset] += value
+            Move,       // sp += value
+            Set,        // cell[offset] = value
+            MulAdd,     // cell[offset] += cell[src] * value
+            Input,      // cell[offset] = getchar()
+            Output,     // putchar(cell[offset])
+            Scan,       // while(cell[0]) sp += value
+            Jz,         // if (cell[0] == 0) goto value
+            Jnz,        // if (cell[0] != 0) goto value
+            Halt,
+        };
+
+        struct Insn {
+            uint32_t code_;
+            int32_t offset_;
+            int32_t src_;
+            int32_t value_;     // Jump target of Jz/Jnz, already past the matching bracket
+        };
+
+        typedef std::vector<Insn> Bytecode;
+
+        // Move p by stride until it points to a zero cell
+        template<typename Cell>
+        inline Cell *scan(Cell *p, ptrdiff_t stride) {
+            while (*p) p+=stride;
+            return p;
+        }
+
+        // Byte cells use the vector kernels of the runtime
+        inline uint8_t *scan(uint8_t *p, ptrdiff_t stride) {
+            if (stride>BF_SCAN_MAX_VECTOR_STRIDE || stride<-BF_SCAN_MAX_VECTOR_STRIDE) {
+                return scan<uint8_t>(p, stride);
+            }
+            for (int i=0; i<BF_SCAN_INLINE_STEPS; i++) {
+                if (!*p) return p;
+                p+=stride;
+            }
+            return bf_scan(p, stride);
+        }
+
+        // Translate IR into bytecode, exits if an operand does not fit
+        Bytecode compile(const ir::Program &prog);
+
+        void run(const Bytecode &code, const tape::options &tape_opts=tape::options());
+
+        void run(std::istream &is, const opt::options &opts=opt::options(), const tape::options &tape_opts=tape::options());
+    }   // End of namespace interp
+}   // End of namespace brainfuck
+
+#endif
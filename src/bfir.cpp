@@ -0,0 +1,32 @@
+//
+//  bfir.cpp
+//  brainfuck
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "bfir.h"
+
+namespace brainfuck {
+    namespace ir {
+        void link(Program &prog) {
+            std::vector<size_t> stack;
+            for (size_t i=0; i<prog.size(); i++) {
+                if (prog[i].code_==LoopBegin) {
+                    stack.push_back(i);
+                } else if (prog[i].code_==LoopEnd) {
+                    size_t begin=stack.back();
+                    stack.pop_back();
+                    prog[begin].jump_=i;
+                    prog[i].jump_=begin;
+                }
+            }
+        }
+
+        void brainfork_only() {
+            fprintf(stderr, "Y forks only in the brainfork dialect, see --brainfork\n");
+            exit(1);
+        }
+    }   // End of namespace ir
+}   // End of namespace brainfuck
@@ -0,0 +1,89 @@
+//
+//  bfir.h
+//  brainfuck
+//
+//  Mid-level IR sitting between the parser and the engines.
+//
+//  A program is one contiguous array of fixed size operations relative to
+//  the current data pointer, loops are a pair of LoopBegin and LoopEnd ops
+//  linked to each other by index, so every pass walks it with a plain loop.
+//  Loops and scans carry the number of the '[' they came from in src, which
+//  lets profiles point back to the source.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <ostream>
+
+#ifndef brainfuck_bfir_h
+#define brainfuck_bfir_h
+
+namespace brainfuck {
+    namespace ir {
+        enum Opcode {
+            Add,        // cell[offset] += value
+            Move,       // sp += value
+            Set,        // cell[offset] = value
+            MulAdd,     // cell[offset] += cell[src] * value
+            Input,      // cell[offset] = getchar()
+            Output,     // putchar(cell[offset])
+            LoopBegin,  // while(cell[0]) {, jump to the matching LoopEnd
+            LoopEnd,    // }, jump to the matching LoopBegin
+            Scan,       // while(cell[0]) sp += value
+            Fork,       // Y of the brainfork dialect, cell[offset] = 0 and a copy of the task goes on
+                        // from the next op with sp += 1 and its cell[offset+1] = 1, see bffork.h
+        };
+
+        struct Op {
+            inline Op(Opcode code, int64_t value=0, int32_t offset=0, int32_t src=0)
+            : code_(code), offset_(offset), src_(src), jump_(0), value_(value)
+            {}
+
+            Opcode code_;
+            int32_t offset_;
+            int32_t src_;
+            uint32_t jump_;
+            int64_t value_;
+        };
+
+        typedef std::vector<Op> Program;
+
+        // Cell offsets of ops stay within this distance of the data pointer
+        const int64_t max_offset = INT32_MAX/2;
+
+        // Recompute jump_ of all LoopBegin/LoopEnd pairs
+        void link(Program &prog);
+
+        // Stop with a message, for an engine given a Fork op, which only bf --brainfork runs
+        [[noreturn]] void brainfork_only();
+
+        inline std::ostream &operator<<(std::ostream &os, const Op &op) {
+            switch (op.code_) {
+                case Add:       os << "Add[" << op.offset_ << ',' << op.value_ << ']'; break;
+                case Move:      os << "Move[" << op.value_ << ']'; break;
+                case Set:       os << "Set[" << op.offset_ << ',' << op.value_ << ']'; break;
+                case MulAdd:    os << "MulAdd[" << op.offset_ << ',' << op.src_ << ',' << op.value_ << ']'; break;
+                case Input:     os << "Input[" << op.offset_ << ']'; break;
+                case Output:    os << "Output[" << op.offset_ << ']'; break;
+                case LoopBegin: os << "LoopBegin[" << op.jump_ << ']'; break;
+                case LoopEnd:   os << "LoopEnd[" << op.jump_ << ']'; break;
+                case Scan:      os << "Scan[" << op.value_ << ']'; break;
+                case Fork:      os << "Fork[" << op.offset_ << ']'; break;
+            }
+            return os;
+        }
+
+        inline std::ostream &operator<<(std::ostream &os, const Program &n) {
+            os << "Program[";
+            for(Program::const_iterator i=n.begin(); i!=n.end(); ++i){
+                if(i!=n.begin()) os << ',';
+                os << *i;
+            }
+            os << ']';
+            return os;
+        }
+    }   // End of namespace ir
+}   // End of namespace brainfuck
+
+#endif
@@ -11,113 +11,593 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <dlfcn.h>
+#include <limits.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#endif
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Function.h>
-#include <llvm/IR/PassManager.h>
-#include <llvm/Passes/PassBuilder.h>
+#include <llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/Mangling.h>
+#include <llvm/ExecutionEngine/Orc/ObjectTransformLayer.h>
 #include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
 #include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/Support/ManagedStatic.h>
+#include <llvm/Support/Memory.h>
+#include <llvm/Support/SHA1.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetMachine.h>
 
-#include "bfast.h"
-#include "bfparser.h"
+#include "bfir.h"
+#include "bfopt.h"
+#include "bffrontend.h"
 #include "bfcodegen.h"
+#include "bfeval.h"
 #include "bfjit.h"
+#include "bfrt.h"
+#include "bfcache.h"
+#include "bfstats.h"
 
 using namespace llvm;
 using namespace llvm::orc;
 
 namespace brainfuck {
     namespace jit {
+        namespace details {
+            // Resolve the runtime and the host process in the main JITDylib of J
+            void prepare(LLJIT &J) {
+                // Resolve anything else from the host process
+                auto Gen = DynamicLibrarySearchGenerator::GetForCurrentProcess(
+                    J.getDataLayout().getGlobalPrefix());
+                if (!Gen) {
+                    fprintf(stderr, "Could not create symbol generator: %s\n",
+                            toString(Gen.takeError()).c_str());
+                    exit(1);
+                }
+                J.getMainJITDylib().addGenerator(std::move(*Gen));
+            
+                if (stats::enabled()) {
+                    J.getObjTransformLayer().setTransform(
+                        [](std::unique_ptr<MemoryBuffer> Obj) -> Expected<std::unique_ptr<MemoryBuffer> > {
+                            stats::add("object bytes", Obj->getBufferSize());
+                            return std::move(Obj);
+                        });
+                }
+            
+                // The I/O runtime is linked statically, its symbols are not exported
+                MangleAndInterner Mangle(J.getExecutionSession(), J.getDataLayout());
+                SymbolMap Runtime;
+    #if LLVM_VERSION_MAJOR >= 17
+    #define BF_RUNTIME_SYMBOL(name, f) \
+                Runtime[Mangle(name)] = ExecutorSymbolDef(ExecutorAddr::fromPtr(f), JITSymbolFlags::Exported)
+    #else
+    #define BF_RUNTIME_SYMBOL(name, f) \
+                Runtime[Mangle(name)] = JITEvaluatedSymbol(pointerToJITTargetAddress(f), JITSymbolFlags::Exported)
+    #endif
+                BF_RUNTIME_SYMBOL("bf_getchar", &bf_getchar);
+                BF_RUNTIME_SYMBOL("bf_putchar", &bf_putchar);
+                BF_RUNTIME_SYMBOL("bf_write", &bf_write);
+                BF_RUNTIME_SYMBOL("bf_flush", &bf_flush);
+                BF_RUNTIME_SYMBOL("bf_io_getchar", &bf_io_getchar);
+                BF_RUNTIME_SYMBOL("bf_io_putchar", &bf_io_putchar);
+                BF_RUNTIME_SYMBOL("bf_io_write", &bf_io_write);
+                BF_RUNTIME_SYMBOL("bf_tape_init", &bf_tape_init);
+                BF_RUNTIME_SYMBOL("bf_profile_register", &bf_profile_register);
+                // Bind scans to the kernel for this CPU, skipping the dispatch
+                BF_RUNTIME_SYMBOL("bf_scan", bf_select_scan());
+    #undef BF_RUNTIME_SYMBOL
+                if (auto Err = J.getMainJITDylib().define(absoluteSymbols(std::move(Runtime)))) {
+                    fprintf(stderr, "Could not define runtime symbols: %s\n",
+                            toString(std::move(Err)).c_str());
+                    exit(1);
+                }
+            }
+            
+            // Maps sections like SectionMemoryManager does on its own, but never unmaps them, so
+            // the code outlives its JIT
+            struct retaining_mapper : public SectionMemoryManager::MemoryMapper {
+                sys::MemoryBlock allocateMappedMemory(SectionMemoryManager::AllocationPurpose, size_t NumBytes,
+                                                      const sys::MemoryBlock *const NearBlock, unsigned Flags,
+                                                      std::error_code &EC) override {
+                    return sys::Memory::allocateMappedMemory(NumBytes, NearBlock, Flags, EC);
+                }
+                
+                std::error_code protectMappedMemory(const sys::MemoryBlock &Block, unsigned Flags) override {
+                    return sys::Memory::protectMappedMemory(Block, Flags);
+                }
+                
+                std::error_code releaseMappedMemory(sys::MemoryBlock &) override {
+                    return std::error_code();
+                }
+            };  // End of retaining_mapper
+            
+#ifdef __linux__
+            // Drop the resident pages of the executable mappings of the shared object holding
+            // addr, unless that is the executable itself. They are clean, so the kernel reads
+            // them back from the file if they are used again
+            void drop_text(const void *addr) {
+                Dl_info lib, self;
+                char lib_path[PATH_MAX], self_path[PATH_MAX];
+                if (!dladdr(addr, &lib) || !lib.dli_fname || !realpath(lib.dli_fname, lib_path)) return;
+                if (dladdr(reinterpret_cast<const void *>(&drop_text), &self) && self.dli_fname
+                    && realpath(self.dli_fname, self_path) && strcmp(lib_path, self_path) == 0) return;
+                
+                FILE *maps = fopen("/proc/self/maps", "r");
+                if (!maps) return;
+                char line[PATH_MAX + 128];
+                size_t dropped = 0;
+                while (fgets(line, sizeof(line), maps)) {
+                    unsigned long lo, hi;
+                    char perms[8];
+                    int path = 0;
+                    if (sscanf(line, "%lx-%lx %7s %*s %*s %*s %n", &lo, &hi, perms, &path) < 3 || path == 0) continue;
+                    line[strcspn(line, "\n")] = '\0';
+                    // Only code is certain to be unmodified, relocated data would be lost
+                    if (strcmp(perms, "r-xp") != 0 || strcmp(line + path, lib_path) != 0) continue;
+                    if (madvise(reinterpret_cast<void *>(lo), hi - lo, MADV_DONTNEED) == 0) dropped += hi - lo;
+                }
+                fclose(maps);
+                stats::add("compiler text bytes dropped", dropped);
+            }
+#endif
+            
+            std::unique_ptr<LLLazyJIT> create_lazy_jit(unsigned int threads) {
+                initialize();
+                auto JIT = LLLazyJITBuilder().setNumCompileThreads(threads).create();
+                if (!JIT) {
+                    fprintf(stderr, "Could not create LLLazyJIT: %s\n",
+                            toString(JIT.takeError()).c_str());
+                    exit(1);
+                }
+                // Regions come in modules of their own, there is nothing to partition
+                (*JIT)->setPartitionFunction(CompileOnDemandLayer::compileWholeModule);
+                prepare(**JIT);
+                return std::move(*JIT);
+            }
+            
+            // Compiles the top level regions in program order on the compile threads while the
+            // program runs. Only as many as there are threads are queued at a time, so a region
+            // the program reaches early does not wait behind all the others
+            struct prefetcher {
+                prefetcher(ExecutionSession &ES, JITDylib &impl, std::vector<SymbolStringPtr> names)
+                : ES_(ES)
+                , impl_(impl)
+                , names_(std::move(names))
+                , next_(0)
+                , running_(0)
+                , stopping_(false)
+                {}
+                
+                void start(size_t n) {
+                    for (size_t i = 0; i < n; i++) {
+                        next();
+                    }
+                }
+                
+                void next() {
+                    SymbolStringPtr name;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        if (stopping_ || next_ == names_.size()) return;
+                        name = names_[next_++];
+                        running_++;
+                    }
+                    // Looking up the body in the implementation dylib compiles it, the stub
+                    // in the main dylib would only be resolved
+                    ES_.lookup(LookupKind::Static, makeJITDylibSearchOrder(&impl_), SymbolLookupSet(name),
+                               SymbolState::Ready, [this](Expected<SymbolMap> result) {
+                                   // A region which fails to compile is reported when the program gets to it
+                                   consumeError(result.takeError());
+                                   {
+                                       std::lock_guard<std::mutex> lock(mutex_);
+                                       running_--;
+                                   }
+                                   done_.notify_all();
+                                   next();
+                               }, NoDependenciesToRegister);
+                }
+                
+                // Queue no more and wait for the regions being compiled, LLVM must not be torn
+                // down under the compile threads at exit
+                void stop() {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    stopping_ = true;
+                    done_.wait(lock, [this]() { return running_ == 0; });
+                }
+                
+                ExecutionSession &ES_;
+                JITDylib &impl_;
+                std::vector<SymbolStringPtr> names_;
+                size_t next_;
+                size_t running_;
+                bool stopping_;
+                std::mutex mutex_;
+                std::condition_variable done_;
+            };  // End of prefetcher
+            
+            // Prefetchers of every lazy JIT, kept like the JITs as compile threads may still
+            // be leaving their callbacks at exit
+            std::mutex prefetchers_mutex;
+            std::vector<prefetcher *> prefetchers;
+            
+            void stop_prefetching() {
+                std::lock_guard<std::mutex> lock(prefetchers_mutex);
+                for (prefetcher *p : prefetchers) {
+                    p->stop();
+                }
+            }
+        }   // End of namespace details
+        
         struct jit_engine {
-            jit_engine(int optimization_level=0);
-            main_func_type compile(const ast::Program &prog);
+            jit_engine(int optimization_level=0, const tape::options &tape_opts=tape::options(),
+                       const profile::options &profile_opts=profile::options());
+            // Compile prog and return the address of symbol, main or bf_main
+            void *compile(ir::Program prog, const char *symbol, cache::object_cache *cache=0,
+                          const std::string &key="");
+            
+            // Compile regions of prog on first use and return the address of symbol
+            void *compile_lazy(ir::Program prog, const char *symbol, const options &jit_opts);
+            
+            // Link a cached object, returns null if it can not be used
+            void *link(std::unique_ptr<MemoryBuffer> object, const char *symbol);
+            
+            // Everything besides the source that the generated code depends on
+            std::string settings(const opt::options &opts) const;
             
             int optimization_level_;
+            tape::options tape_opts_;
+            profile::options profile_opts_;
+            profile::loop_table loops_;     // Filled by the front end when profiling
+            profile::report use_;           // Read once loops_ is complete
+            uint64_t eval_fuel_;            // Ops evaluated before codegen, see eval::run
         };  // End of jit_engine
 
-        jit_engine::jit_engine(int optimization_level)
+        jit_engine::jit_engine(int optimization_level, const tape::options &tape_opts,
+                               const profile::options &profile_opts)
         : optimization_level_(optimization_level)
+        , tape_opts_(tape_opts)
+        , profile_opts_(profile_opts)
+        , eval_fuel_(0)
         {
-            llvm::InitializeNativeTarget();
-            llvm::InitializeNativeTargetAsmPrinter();
-            llvm::InitializeNativeTargetAsmParser();
+            initialize();
         }
         
-        main_func_type jit_engine::compile(const ast::Program &prog) {
+        void *jit_engine::compile(ir::Program prog, const char *symbol, cache::object_cache *cache,
+                                  const std::string &key) {
+            eval::snapshot start = eval::run(prog, eval_fuel_, tape_opts_);
             auto context = std::make_unique<LLVMContext>();
             auto module = std::make_unique<Module>("brainfuck", *context);
-            brainfuck::codegen(*module, prog);
+            if (cache) module->setModuleIdentifier(cache::object_cache::module_id(key));
+            stats::timer cg("codegen");
+            brainfuck::codegen(*module, prog, tape_opts_, profile_opts_.enabled ? &loops_ : nullptr, profile_opts_.path,
+                               profile_opts_.use.empty() ? nullptr : &use_, &start);
+            cg.stop();
             
             // Apply optimizations
-            if (optimization_level_ > 0) {
-                LoopAnalysisManager LAM;
-                FunctionAnalysisManager FAM;
-                CGSCCAnalysisManager CGAM;
-                ModuleAnalysisManager MAM;
-                
-                PassBuilder PB;
-                
-                PB.registerModuleAnalyses(MAM);
-                PB.registerCGSCCAnalyses(CGAM);
-                PB.registerFunctionAnalyses(FAM);
-                PB.registerLoopAnalyses(LAM);
-                PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
-                
-                ModulePassManager MPM;
-                if (optimization_level_ == 1) {
-              //      MPM = PB.buildO1DefaultPipeline(OptimizationLevel::O1);
-		      MPM = PB.buildPerModuleDefaultPipeline(OptimizationLevel::O1);
-                } else if (optimization_level_ >= 2) {
-              //      MPM = PB.buildO2DefaultPipeline(OptimizationLevel::O2);
-		      MPM = PB.buildPerModuleDefaultPipeline(OptimizationLevel::O2);
+            optimize_for_host(*module, optimization_level_);
+            
+            // Create JIT, machine code is generated when the symbol is looked up
+            stats::timer t("link");
+            std::unique_ptr<LLJIT> JIT = create_jit(cache, true);
+            
+            // Add module to JIT
+            ThreadSafeModule TSM(std::move(module), std::move(context));
+            if (auto Err = JIT->addIRModule(std::move(TSM))) {
+                fprintf(stderr, "Could not add IR module: %s\n", 
+                        toString(std::move(Err)).c_str());
+                exit(1);
+            }
+            
+            // Look up the entry function
+            void *fp = lookup(*JIT, symbol);
+            t.stop();
+            
+            // The code pages stay, LLVM is not needed to run them
+            JIT.reset();
+            release_compiler();
+            return fp;
+        }
+        
+        void *jit_engine::compile_lazy(ir::Program prog, const char *symbol, const options &jit_opts) {
+            eval::snapshot start = eval::run(prog, eval_fuel_, tape_opts_);
+            unsigned int threads = jit_opts.threads ? jit_opts.threads : std::thread::hardware_concurrency();
+            std::unique_ptr<LLLazyJIT> JIT = details::create_lazy_jit(threads);
+            
+            // The pass pipeline runs as each region is compiled
+            int optimization_level = optimization_level_;
+            JIT->getIRTransformLayer().setTransform(
+                [optimization_level](ThreadSafeModule TSM, MaterializationResponsibility &) -> Expected<ThreadSafeModule> {
+                    TSM.withModuleDo([optimization_level](Module &m) {
+                        optimize_for_host(m, optimization_level);
+                    });
+                    return std::move(TSM);
+                });
+            
+            // A module and a context for each region, compile threads share nothing
+            auto add = [&JIT](const std::function<void(Module &)> &generate) {
+                auto context = std::make_unique<LLVMContext>();
+                auto module = std::make_unique<Module>("brainfuck", *context);
+                module->setDataLayout(JIT->getDataLayout());
+                generate(*module);
+                if (auto Err = JIT->addLazyIRModule(ThreadSafeModule(std::move(module), std::move(context)))) {
+                    fprintf(stderr, "Could not add IR module: %s\n",
+                            toString(std::move(Err)).c_str());
+                    exit(1);
+                }
+            };
+            stats::timer cg("codegen");
+            region_list regions = split(prog, jit_opts.region_ops);
+            add([&](Module &m) {
+                codegen_split(m, prog, regions, tape_opts_, &start);
+            });
+            std::vector<SymbolStringPtr> top;
+            size_t top_end = 0;
+            for (size_t i = 0; i < regions.size(); i++) {
+                add([&](Module &m) {
+                    codegen_region(m, prog, regions, i, tape_opts_, &start);
+                });
+                if (regions[i].begin >= top_end) {
+                    top.push_back(JIT->mangleAndIntern(regions[i].name));
+                    top_end = regions[i].end;
+                }
+            }
+            cg.stop();
+            stats::add("regions", regions.size());
+            
+            stats::timer t("link");
+            void *fp = lookup(*JIT, symbol);
+            t.stop();
+            
+            // Bodies live in the implementation dylib the on-demand layer made next to main
+            JITDylib *impl = JIT->getExecutionSession().getJITDylibByName(JIT->getMainJITDylib().getName() + ".impl");
+            if (impl && threads > 0) {
+                static std::once_flag registered;
+                std::call_once(registered, []() {
+                    atexit(details::stop_prefetching);
+                });
+                details::prefetcher *p = new details::prefetcher(JIT->getExecutionSession(), *impl, std::move(top));
+                {
+                    std::lock_guard<std::mutex> lock(details::prefetchers_mutex);
+                    details::prefetchers.push_back(p);
+                }
+                p->start(threads);
+            }
+            
+            // The JIT owns the code pages and runs the compile threads, keep it for the rest of the process
+            JIT.release();
+            return fp;
+        }
+        
+        void *jit_engine::link(std::unique_ptr<MemoryBuffer> object, const char *symbol) {
+            stats::timer t("link");
+            stats::add("cache hits", 1);
+            std::unique_ptr<LLJIT> JIT = create_jit(nullptr, true);
+            if (auto Err = JIT->addObjectFile(std::move(object))) {
+                consumeError(std::move(Err));
+                return 0;
+            }
+            auto Sym = JIT->lookup(symbol);
+            if (!Sym) {
+                consumeError(Sym.takeError());
+                return 0;
+            }
+#if LLVM_VERSION_MAJOR >= 15
+            void *fp = reinterpret_cast<void*>(Sym->getValue());
+#else
+            void *fp = reinterpret_cast<void*>(Sym->getAddress());
+#endif
+            t.stop();
+            JIT.reset();
+            release_compiler();
+            return fp;
+        }
+        
+        std::string jit_engine::settings(const opt::options &opts) const {
+            std::ostringstream os;
+            os << "O" << optimization_level_
+               << " idioms=" << opts.merge_deltas << opts.fold_offsets << opts.clear_loops
+               << opts.multiply_loops << opts.scan_loops
+               << " cell=" << tape_opts_.cell_size
+               << " tape=" << tape_opts_.size << ',' << tape_opts_.limit << ',' << tape_opts_.growth
+               << " eval=" << eval_fuel_;
+            if (profile_opts_.enabled) os << " profile=" << profile_opts_.path;
+            if (!profile_opts_.use.empty()) {
+                // The counts matter, not where they came from
+                os << " use-profile=";
+                for (size_t i = 0; i < use_.loops.size(); i++) {
+                    const profile::loop_count &c = use_.loops[i];
+                    if (c.known) os << i << ':' << c.entries << ':' << c.iterations << ',';
                 }
-                
-                MPM.run(*module, MAM);
             }
+            return os.str();
+        }
+        
+        bool parse_option(const std::string &arg, options &opts) {
+            if (arg == "--lazy") {
+                opts.lazy = true;
+            } else if (arg.compare(0, 7, "--lazy=") == 0) {
+                opts.lazy = true;
+                opts.region_ops = strtoul(arg.c_str() + 7, 0, 10);
+                if (opts.region_ops == 0) {
+                    fprintf(stderr, "Bad region size %s\n", arg.c_str() + 7);
+                    exit(1);
+                }
+            } else if (arg.compare(0, 18, "--compile-threads=") == 0) {
+                opts.threads = (unsigned int)strtoul(arg.c_str() + 18, 0, 10);
+            } else {
+                return false;
+            }
+            return true;
+        }
+        
+        void initialize() {
+            static std::once_flag flag;
+            std::call_once(flag, []() {
+                llvm::InitializeNativeTarget();
+                llvm::InitializeNativeTargetAsmPrinter();
+                llvm::InitializeNativeTargetAsmParser();
+            });
+        }
+        
+        std::unique_ptr<LLJIT> create_jit(ObjectCache *cache, bool retain_code) {
+            initialize();
             
-            // Create JIT
-            auto JIT = LLJITBuilder().create();
+            LLJITBuilder Builder;
+            if (retain_code) {
+                Builder.setObjectLinkingLayerCreator([](ExecutionSession &ES, const Triple &)
+                    -> Expected<std::unique_ptr<ObjectLayer> > {
+                    static details::retaining_mapper *mapper = new details::retaining_mapper();
+                    // Newer LLVM passes the object to the memory manager factory
+                    return std::make_unique<RTDyldObjectLinkingLayer>(ES, [](auto &&...) {
+                        return std::make_unique<SectionMemoryManager>(mapper);
+                    });
+                });
+            }
+            if (cache) {
+                Builder.setCompileFunctionCreator([cache](JITTargetMachineBuilder JTMB)
+                    -> Expected<std::unique_ptr<IRCompileLayer::IRCompiler> > {
+                    return std::make_unique<ConcurrentIRCompiler>(std::move(JTMB), cache);
+                });
+            }
+            auto JIT = Builder.create();
             if (!JIT) {
                 fprintf(stderr, "Could not create LLJIT: %s\n", 
                         toString(JIT.takeError()).c_str());
                 exit(1);
             }
             
-            // Add module to JIT
-            ThreadSafeModule TSM(std::move(module), std::move(context));
-            if (auto Err = (*JIT)->addIRModule(std::move(TSM))) {
-                fprintf(stderr, "Could not add IR module: %s\n", 
-                        toString(std::move(Err)).c_str());
+            details::prepare(**JIT);
+            return std::move(*JIT);
+        }
+        
+        std::unique_ptr<TargetMachine> host_target_machine() {
+            initialize();
+            
+            // The CPU and features LLJIT detects for itself
+            auto JTMB = JITTargetMachineBuilder::detectHost();
+            if (!JTMB) {
+                fprintf(stderr, "Could not detect host: %s\n", toString(JTMB.takeError()).c_str());
                 exit(1);
             }
-            
-            // Look up main function
-            auto MainSym = (*JIT)->lookup("main");
-            if (!MainSym) {
-                fprintf(stderr, "Could not find main function: %s\n", 
-                        toString(MainSym.takeError()).c_str());
+            auto TM = JTMB->createTargetMachine();
+            if (!TM) {
+                fprintf(stderr, "Could not create target machine: %s\n", toString(TM.takeError()).c_str());
                 exit(1);
             }
-            
-           //  void *fp = MainSym->getAddress();
-                void *fp = reinterpret_cast<void*>(MainSym->getValue());
-            return reinterpret_cast<main_func_type>(fp);
+            return std::move(*TM);
+        }
+        
+        void optimize_for_host(Module &m, int optimization_level) {
+            if (optimization_level <= 0) {
+                optimize(m, optimization_level);
+                return;
+            }
+            // Target machines cache subtargets without a lock, each pipeline gets its own
+            std::unique_ptr<TargetMachine> tm = host_target_machine();
+            m.setTargetTriple(tm->getTargetTriple().str());
+            m.setDataLayout(tm->createDataLayout());
+            optimize(m, optimization_level, tm.get());
+        }
+        
+        void release_compiler() {
+            stats::timer t("release");
+#ifdef __linux__
+            malloc_trim(0);
+            details::drop_text(reinterpret_cast<const void *>(&llvm_shutdown));
+#endif
         }
         
-        main_func_type compile(std::istream &src) {
-            jit_engine engine;
-            ast::Program prog;
-            std::string s((std::istreambuf_iterator<char>(src)),
-                          std::istreambuf_iterator<char>());
-            bool ret = parser::parse(s.begin(), s.end(), prog);
-            if (!ret) {
-                std::cerr << "Syntax error\n";
+        void *lookup(LLJIT &jit, const std::string &name) {
+            auto Sym = jit.lookup(name);
+            if (!Sym) {
+                fprintf(stderr, "Could not find %s function: %s\n", name.c_str(),
+                        toString(Sym.takeError()).c_str());
                 exit(1);
             }
-            return engine.compile(prog);
+#if LLVM_VERSION_MAJOR >= 15
+            return reinterpret_cast<void*>(Sym->getValue());
+#else
+            return reinterpret_cast<void*>(Sym->getAddress());
+#endif
+        }
+        
+        // Compile src and return the address of symbol
+        void *compile(const char *symbol, std::istream &src, int optimization_level, const opt::options &opts,
+                      const tape::options &tape_opts, const cache::options &cache_opts,
+                      const profile::options &profile_opts, const options &jit_opts) {
+            jit_engine engine(optimization_level, tape_opts, profile_opts);
+            // Counts of a profiled run include every loop, none is run ahead of time
+            if (!profile_opts.enabled) engine.eval_fuel_ = opts.eval_fuel;
+            if (jit_opts.lazy) {
+                // Objects of a lazy JIT come one region at a time, none is cached
+                return engine.compile_lazy(frontend::load(src, opts), symbol, jit_opts);
+            }
+            bool positions = profile_opts.enabled || !profile_opts.use.empty();
+            profile::loop_table *loops = positions ? &engine.loops_ : nullptr;
+            if (!cache_opts.enabled) {
+                ir::Program prog = frontend::load(src, opts, loops);
+                if (!profile_opts.use.empty()) engine.use_ = profile::read(profile_opts.use, engine.loops_);
+                return engine.compile(prog, symbol);
+            }
+            
+            // Hash the source while parsing it, rather than holding on to all of it
+            frontend::loader loader;
+            loader.record(loops);
+            loader.reserve(frontend::remaining(src));
+            SHA1 hash;
+            std::vector<char> buf(frontend::chunk_size);
+            std::streamsize n;
+            while ((n = src.rdbuf()->sgetn(&buf[0], buf.size())) > 0) {
+                hash.update(StringRef(&buf[0], size_t(n)));
+                loader.feed(&buf[0], size_t(n));
+            }
+            
+            // All loops are numbered once the source is read, before the idiom passes
+            if (!profile_opts.use.empty()) engine.use_ = profile::read(profile_opts.use, engine.loops_);
+            
+            // A warm run only links the cached object
+            cache::object_cache cache(cache_opts);
+            std::string key = cache::object_cache::key(toHex(hash.final(), true), engine.settings(opts));
+            if (std::unique_ptr<MemoryBuffer> object = cache.load(key)) {
+                if (void *fp = engine.link(std::move(object), symbol)) return fp;
+                cache.remove(key);
+            }
+            return engine.compile(loader.finish(opts), symbol, &cache, key);
+        }
+        
+        main_func_type compile(std::istream &src, int optimization_level, const opt::options &opts,
+                               const tape::options &tape_opts, const cache::options &cache_opts,
+                               const profile::options &profile_opts, const options &jit_opts) {
+            return reinterpret_cast<main_func_type>(compile("main", src, optimization_level, opts, tape_opts,
+                                                            cache_opts, profile_opts, jit_opts));
+        }
+        
+        entry_func_type compile_entry(std::istream &src, int optimization_level, const opt::options &opts,
+                                      const tape::options &tape_opts, const cache::options &cache_opts,
+                                      const profile::options &profile_opts, const options &jit_opts) {
+            return reinterpret_cast<entry_func_type>(compile("bf_main", src, optimization_level, opts, tape_opts,
+                                                             cache_opts, profile_opts, jit_opts));
         }
     }   // End of namespace jit
 }   // End of namespace brainfuck
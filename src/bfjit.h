@@ -6,16 +6,88 @@
 //  Copyright (c) 2012 Xu Chen. All rights reserved.
 //
 
+#include <cstddef>
 #include <istream>
+#include <memory>
+#include <string>
+#include "bfir.h"
+#include "bfopt.h"
+#include "bfprofile.h"
+#include "bftape.h"
+#include "bfcache.h"
+#include "bfrt.h"
 
 #ifndef brainfuck_bfjit_h
 #define brainfuck_bfjit_h
 
+namespace llvm {
+    class Module;
+    class ObjectCache;
+    class TargetMachine;
+    namespace orc {
+        class LLJIT;
+    }   // End of namespace orc
+}   // End of namespace llvm
+
 namespace brainfuck {
     namespace jit {
-        typedef void (*main_func_type)();
+        struct options {
+            inline options()
+            : lazy(false)
+            , region_ops(2000)
+            , threads(0)
+            {}
+
+            bool lazy;              // Compile regions of the program on first use, see brainfuck::split
+            size_t region_ops;      // Ops per region
+            unsigned int threads;   // Compile threads of the lazy JIT, 0 for one per core
+        };
+
+        // Handle --lazy, --lazy=OPS and --compile-threads=N, returns false if arg is not a JIT option
+        bool parse_option(const std::string &arg, options &opts);
+
+        typedef int (*main_func_type)();
+        
+        // bf_main of a compiled program, see bfrt.h
+        typedef void *(*entry_func_type)(bf_io *io, void *tape);
+        
+        main_func_type compile(std::istream &is, int optimization_level=0, const opt::options &opts=opt::options(),
+                               const tape::options &tape_opts=tape::options(),
+                               const cache::options &cache_opts=cache::options(),
+                               const profile::options &profile_opts=profile::options(),
+                               const options &jit_opts=options());
+        
+        // Compile for many runs at once, each with its own I/O and a zeroed tape of tape_opts.
+        // profile_opts may only use a profile, a program counting loops is not reentrant
+        entry_func_type compile_entry(std::istream &is, int optimization_level=0, const opt::options &opts=opt::options(),
+                                      const tape::options &tape_opts=tape::options(),
+                                      const cache::options &cache_opts=cache::options(),
+                                      const profile::options &profile_opts=profile::options(),
+                                      const options &jit_opts=options());
+        
+        // Initialize native target, can be called more than once
+        void initialize();
+        
+        // Create a LLJIT resolving external functions from the host process, compiled
+        // objects are handed to cache if there is one. With retain_code the code and data
+        // of compiled objects stay mapped when the JIT is destroyed, for a JIT that is only
+        // needed until the program is looked up
+        std::unique_ptr<llvm::orc::LLJIT> create_jit(llvm::ObjectCache *cache=nullptr, bool retain_code=false);
+        
+        // Target machine of the host CPU and all its features, as the JIT compiles for
+        std::unique_ptr<llvm::TargetMachine> host_target_machine();
+        
+        // Run brainfuck::optimize on m with the target information of the host CPU, so the
+        // vectorizer and the cost models see its vector width and instructions
+        void optimize_for_host(llvm::Module &m, int optimization_level);
+        
+        // Give back what compiling left behind once the JIT is gone: free heap goes back to
+        // the kernel, and pages of LLVM's own code are dropped, to be read from the library
+        // again should it run. Only the program's code and the runtime stay resident
+        void release_compiler();
         
-        main_func_type compile(std::istream &is);
+        // Address of a materialized function, exits on failure
+        void *lookup(llvm::orc::LLJIT &jit, const std::string &name);
     }   // End of namespace jit
 }   // End of namespace brainfuck
 
@@ -0,0 +1,315 @@
+//
+//  bflib.cpp
+//  brainfuck
+//
+
+#include <errno.h>
+#include <string.h>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef BF_WITH_LLVM
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include "bfcodegen.h"
+#include "bfeval.h"
+#include "bfjit.h"
+#endif
+#include "bfir.h"
+#include "bflib.h"
+#include "bfnative.h"
+#include "bfopt.h"
+#include "bfparser.h"
+#include "bfrt.h"
+
+#ifdef BF_WITH_LLVM
+using namespace llvm;
+using namespace llvm::orc;
+#endif
+
+namespace brainfuck {
+    namespace lib {
+        namespace details {
+            // bf_main of a JIT compiled program, or native code compiled with_io
+            typedef void *(*entry_func_type)(bf_io *io, void *tape);
+
+            // A tape of this thread, with the buffer of the runs handing output to a sink
+            struct cached_tape {
+                tape::options opts;
+                bf_tape *tape;
+                std::unique_ptr<char[]> out;
+                bool busy;      // A run is using it, a sink running a program again gets another
+            };
+
+            struct tape_cache {
+                ~tape_cache() {
+                    for (cached_tape &c : tapes) {
+                        bf_tape_destroy(c.tape);
+                    }
+                }
+
+                std::vector<cached_tape> tapes;
+            };
+
+            thread_local tape_cache tapes;
+
+            bool same(const tape::options &a, const tape::options &b) {
+                return a.cell_size == b.cell_size && a.size == b.size && a.limit == b.limit && a.growth == b.growth;
+            }
+
+            // A tape of opts for one run on this thread, bf_tape_run clears it
+            struct lease {
+                explicit lease(const tape::options &opts)
+                : index_(0)
+                , tape_(nullptr)
+                {
+                    for (index_ = 0; index_ < tapes.tapes.size(); index_++) {
+                        cached_tape &c = tapes.tapes[index_];
+                        if (!c.busy && same(c.opts, opts)) break;
+                    }
+                    if (index_ == tapes.tapes.size()) {
+                        bf_tape *t = bf_tape_create(opts.cell_size / 8, opts.size, opts.limit, opts.growth);
+                        if (!t) return;
+                        cached_tape c;
+                        c.opts = opts;
+                        c.tape = t;
+                        c.out.reset(new char[BF_OUTPUT_BUFFER_SIZE]);
+                        c.busy = false;
+                        tapes.tapes.push_back(std::move(c));
+                    }
+                    tapes.tapes[index_].busy = true;
+                    tape_ = tapes.tapes[index_].tape;
+                }
+
+                ~lease() {
+                    if (tape_) tapes.tapes[index_].busy = false;
+                }
+
+                bf_tape *tape() const { return tape_; }
+                char *out() const { return tapes.tapes[index_].out.get(); }
+
+            private:
+                size_t index_;
+                bf_tape *tape_;
+            };  // End of lease
+
+            struct call {
+                entry_func_type entry;
+                bf_io *io;
+            };
+
+            void enter(void *arg, void *origin) {
+                call *c = static_cast<call *>(arg);
+                c->entry(c->io, origin);
+            }
+
+            // Sink of runs into the caller's buffer, which is only handed over once it is full
+            int full(void *ctx, const char *, size_t) {
+                *static_cast<bool *>(ctx) = true;
+                return 1;
+            }
+
+            // Sink of runs with a callback, whose exceptions must not unwind through the program
+            struct forward {
+                const Program::sink_type *sink;
+                size_t total;
+                bool stopped;
+                std::exception_ptr error;
+            };
+
+            int pass(void *ctx, const char *buf, size_t n) {
+                forward *f = static_cast<forward *>(ctx);
+                try {
+                    if (!(*f->sink)(buf, n)) {
+                        f->stopped = true;
+                        return 1;
+                    }
+                } catch (...) {
+                    f->error = std::current_exception();
+                    f->stopped = true;
+                    return 1;
+                }
+                f->total += n;
+                return 0;
+            }
+
+            // Run entry with io on a tape of opts, stopped tells a sink stopping it from a tape error.
+            // A buffered io gets the buffer of the tape, what is left in it goes to the sink at the end
+            result run(entry_func_type entry, const tape::options &opts, bf_io &io, bool buffered,
+                       const run_options &run_opts, const bool &stopped, status stop) {
+                result r;
+                lease l(opts);
+                if (!l.tape()) {
+                    r.code = tape_error;
+                    r.message = std::string("bf: could not map a tape: ") + strerror(errno) + "\n";
+                    return r;
+                }
+                if (buffered) {
+                    io.out = l.out();
+                    io.out_cap = BF_OUTPUT_BUFFER_SIZE;
+                }
+                bf_tape_set_timeout(l.tape(), run_opts.timeout);
+                call c = { entry, &io };
+                int ret = bf_tape_run(l.tape(), enter, &c);
+                r.input = io.in_pos;
+                if (ret == -2) {
+                    r.code = timed_out;
+                    r.message = bf_tape_message(l.tape());
+                } else if (ret != 0) {
+                    r.code = stopped ? stop : tape_error;
+                    r.message = bf_tape_message(l.tape());
+                } else if (buffered && bf_io_flush(&io) != 0) {
+                    r.code = stop;
+                    r.message = "bf: output stopped by the sink\n";
+                }
+                if (buffered) io.out = nullptr;
+                return r;
+            }
+
+#ifdef BF_WITH_LLVM
+            // Programs share one JIT, each under a resource tracker of its own. It is never
+            // destroyed, programs may outlive static destructors
+            std::mutex jit_mutex;
+            LLJIT *shared_jit = nullptr;
+            uint64_t compiled = 0;
+
+            LLJIT &jit() {
+                if (!shared_jit) shared_jit = jit::create_jit().release();
+                return *shared_jit;
+            }
+#endif
+        }   // End of namespace details
+
+        struct Program::impl {
+            impl()
+            : entry(nullptr)
+            {}
+
+            ~impl() {
+#ifdef BF_WITH_LLVM
+                if (tracker) {
+                    std::lock_guard<std::mutex> lock(details::jit_mutex);
+                    if (auto Err = tracker->remove()) consumeError(std::move(Err));
+                }
+#endif
+            }
+
+            options opts;
+            details::entry_func_type entry;
+            std::unique_ptr<native::Code> code;
+#ifdef BF_WITH_LLVM
+            ResourceTrackerSP tracker;
+#endif
+        };
+
+        Program::Program(std::unique_ptr<impl> p)
+        : impl_(std::move(p))
+        {}
+
+        Program::~Program() {}
+
+        std::unique_ptr<Program> Program::compile(const std::string &source, const options &opts, std::string &error) {
+            std::unique_ptr<impl> p = std::make_unique<impl>();
+            p->opts = opts;
+            if (p->opts.engine.empty()) {
+#ifdef BF_WITH_LLVM
+                p->opts.engine = "jit";
+#else
+                p->opts.engine = "native";
+#endif
+            }
+
+            // The front end exits on syntax errors, the caller gets them instead
+            ir::Program prog;
+            prog.reserve(source.size());
+            parser::parser parse(prog);
+            if (!parse.feed(source.data(), source.size()) || !parse.finish()) {
+                error = "Syntax error at " + parse.error() + "\n";
+                return nullptr;
+            }
+            opt::optimize(prog, opts.opt);
+
+            if (p->opts.engine == "native") {
+                if (!native::supported()) {
+                    error = "The native engine only runs on x86-64\n";
+                    return nullptr;
+                }
+                p->code = std::make_unique<native::Code>(native::compile(prog, opts.tape.cell_size, true));
+                p->entry = p->code->io_entry();
+                return std::unique_ptr<Program>(new Program(std::move(p)));
+            }
+#ifdef BF_WITH_LLVM
+            if (p->opts.engine == "jit") {
+                eval::snapshot start = eval::run(prog, opts.opt.eval_fuel, opts.tape);
+                std::string name;
+                auto context = std::make_unique<LLVMContext>();
+                auto module = std::make_unique<Module>("brainfuck", *context);
+                {
+                    std::lock_guard<std::mutex> lock(details::jit_mutex);
+                    module->setDataLayout(details::jit().getDataLayout());
+                    name = "bf_main_" + std::to_string(details::compiled++);
+                }
+                brainfuck::codegen(*module, prog, opts.tape, nullptr, "", nullptr, &start);
+                // main maps the process tape, and bf_main of every program would clash in the shared JIT
+                module->getFunction("main")->eraseFromParent();
+                module->getFunction("bf_main")->setName(name);
+                jit::optimize_for_host(*module, opts.optimization_level);
+
+                // The JIT compiles on the thread looking the program up, with one target machine
+                std::lock_guard<std::mutex> lock(details::jit_mutex);
+                LLJIT &J = details::jit();
+                p->tracker = J.getMainJITDylib().createResourceTracker();
+                if (auto Err = J.addIRModule(p->tracker, ThreadSafeModule(std::move(module), std::move(context)))) {
+                    error = "Could not add IR module: " + toString(std::move(Err)) + "\n";
+                    return nullptr;
+                }
+                p->entry = reinterpret_cast<details::entry_func_type>(jit::lookup(J, name));
+                return std::unique_ptr<Program>(new Program(std::move(p)));
+            }
+#endif
+            error = "Unknown engine " + p->opts.engine + "\n";
+            return nullptr;
+        }
+
+        result Program::run(const char *input, size_t input_size, char *out, size_t out_size,
+                            const run_options &opts) const {
+            bool full = false;
+            bf_io io;
+            memset(&io, 0, sizeof(io));
+            io.in = reinterpret_cast<const unsigned char *>(input);
+            io.in_len = input_size;
+            io.out = out;
+            io.out_cap = out_size;
+            io.sink = details::full;
+            io.sink_ctx = &full;
+            result r = details::run(impl_->entry, impl_->opts.tape, io, false, opts, full, output_full);
+            r.output = io.out_len;
+            if (r.code == output_full) {
+                r.message = "bf: output does not fit in " + std::to_string(out_size) + " bytes\n";
+            }
+            return r;
+        }
+
+        result Program::run(const char *input, size_t input_size, const sink_type &sink,
+                            const run_options &opts) const {
+            details::forward f = { &sink, 0, false, nullptr };
+            bf_io io;
+            memset(&io, 0, sizeof(io));
+            io.in = reinterpret_cast<const unsigned char *>(input);
+            io.in_len = input_size;
+            io.sink = details::pass;
+            io.sink_ctx = &f;
+            result r = details::run(impl_->entry, impl_->opts.tape, io, true, opts, f.stopped, stopped);
+            if (f.error) std::rethrow_exception(f.error);
+            r.output = f.total;
+            return r;
+        }
+    }   // End of namespace lib
+}   // End of namespace brainfuck
@@ -0,0 +1,103 @@
+//
+//  bflib.h
+//  brainfuck
+//
+//  Embedding API of libbrainfuck. A Program is compiled once and run any
+//  number of times, from any number of threads at once. Each run reads its
+//  input from the caller's buffer and writes its output straight into the
+//  caller's buffer, or in chunks to a callback, on a tape of its own which is
+//  kept per thread and cleared between runs. Tape errors, time limits and
+//  full buffers stop the run, never the process.
+//
+//      std::string error;
+//      auto prog = brainfuck::lib::Program::compile(source, brainfuck::lib::options(), error);
+//      char out[4096];
+//      brainfuck::lib::result r = prog->run(in.data(), in.size(), out, sizeof(out));
+//
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include "bfopt.h"
+#include "bftape.h"
+
+#ifndef brainfuck_bflib_h
+#define brainfuck_bflib_h
+
+namespace brainfuck {
+    namespace lib {
+        struct options {
+            inline options()
+            : optimization_level(2)
+            {}
+
+            std::string engine;         // "jit", "native" which compiles faster on x86-64, or empty for
+                                        // the JIT if the library was built with LLVM and native otherwise
+            int optimization_level;     // -O of the JIT
+            opt::options opt;           // Idiom passes and evaluation at compile time
+            tape::options tape;         // Cell size and tape of every run
+        };
+
+        struct run_options {
+            inline run_options()
+            : timeout(0)
+            {}
+
+            double timeout;             // Seconds of wall time a run may take, 0 for no limit
+        };
+
+        enum status {
+            ok,             // The program ran to its end
+            tape_error,     // It left the tape or ran out of memory
+            timed_out,      // It ran longer than run_options::timeout
+            output_full,    // It wrote more than fits the output buffer, which holds what fit
+            stopped,        // The sink returned false
+        };
+
+        struct result {
+            inline result()
+            : code(ok)
+            , input(0)
+            , output(0)
+            {}
+
+            status code;
+            size_t input;               // Bytes of input read
+            size_t output;              // Bytes of output written to the buffer or the sink
+            std::string message;        // Why the run stopped, empty if it ran to its end
+        };
+
+        class Program {
+        public:
+            // Takes output the program wrote, returns false to stop the run
+            typedef std::function<bool(const char *data, size_t n)> sink_type;
+
+            // Compile source, null with the reason in error for a syntax error or an engine
+            // this build does not have
+            static std::unique_ptr<Program> compile(const std::string &source, const options &opts, std::string &error);
+
+            Program(const Program &) = delete;
+            Program &operator=(const Program &) = delete;
+            ~Program();
+
+            // Run on input, writing the output to out, which holds out_size bytes
+            result run(const char *input, size_t input_size, char *out, size_t out_size,
+                       const run_options &opts=run_options()) const;
+
+            // Run on input, handing the output to sink in chunks of up to 64KB, and all
+            // that is left once the program ends
+            result run(const char *input, size_t input_size, const sink_type &sink,
+                       const run_options &opts=run_options()) const;
+
+        private:
+            struct impl;
+
+            explicit Program(std::unique_ptr<impl> p);
+
+            std::unique_ptr<impl> impl_;
+        };  // End of Program
+    }   // End of namespace lib
+}   // End of namespace brainfuck
+
+#endif
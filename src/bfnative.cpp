@@ -0,0 +1,516 @@
+//
+//  bfnative.cpp
+//  brainfuck
+//
+//  Every op is a fixed template of one to three instructions. The data
+//  pointer lives in rbx, bf_putchar, bf_getchar and the scan kernel in r12,
+//  r13 and r14, so neither the templates nor the calls touch memory other
+//  than the tape. Code with I/O through a bf_io keeps it in r15 and calls
+//  the bf_io variants instead. Loops test their cell at both ends. The assembler only
+//  remembers a few facts between ops: whether the flags were set from cell 0,
+//  which makes the next test redundant, whether cell 0 is known to be zero,
+//  as after a loop, and which cell rcx holds for a run of multiply adds.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <initializer_list>
+#include <limits>
+#include <vector>
+#include "bffrontend.h"
+#include "bfir.h"
+#include "bfnative.h"
+#include "bfrt.h"
+#include "bfstats.h"
+#include "bftape.h"
+
+namespace brainfuck {
+    namespace native {
+        namespace details {
+            // Registers by encoding, only the low eight are used as operands
+            enum reg {
+                rax = 0,
+                rcx = 1,
+                rbx = 3,
+                rsi = 6,
+                rdi = 7,
+            };
+
+            bool fits8(int64_t n) {
+                return n >= std::numeric_limits<int8_t>::min() && n <= std::numeric_limits<int8_t>::max();
+            }
+
+            bool fits32(int64_t n) {
+                return n >= std::numeric_limits<int32_t>::min() && n <= std::numeric_limits<int32_t>::max();
+            }
+
+            // Value as a signed number of a cell of the given bytes, the cell arithmetic wraps anyway
+            int64_t narrow(int64_t n, unsigned int bytes) {
+                switch (bytes) {
+                    case 1:     return int8_t(n);
+                    case 2:     return int16_t(n);
+                    case 4:     return int32_t(n);
+                    default:    return n;
+                }
+            }
+
+            struct assembler {
+                assembler(unsigned int cell_size, bool with_io)
+                : bytes_(cell_size / 8)
+                , with_io_(with_io)
+                , flags_(false)
+                , zero_(true)
+                , rcx_(false)
+                , rcx_disp_(0)
+                {}
+
+                void byte(uint8_t b) {
+                    text_.push_back(b);
+                }
+
+                void bytes(std::initializer_list<uint8_t> bs) {
+                    text_.insert(text_.end(), bs);
+                }
+
+                void imm(uint64_t n, unsigned int size) {
+                    for (unsigned int i = 0; i < size; i++) byte(uint8_t(n >> (8 * i)));
+                }
+
+                // Bytes of the cell at offset from the data pointer, exits if they do not fit a displacement
+                int32_t disp(int64_t offset) const {
+                    int64_t d = offset * int64_t(bytes_);
+                    if (!fits32(d)) {
+                        fprintf(stderr, "Operand %lld out of range\n", (long long)offset);
+                        exit(1);
+                    }
+                    return int32_t(d);
+                }
+
+                // Operand size prefix for the cell width, 8 and 32 bit operations need none
+                void prefix() {
+                    if (bytes_ == 2) byte(0x66);
+                    else if (bytes_ == 8) byte(0x48);
+                }
+
+                // ModRM and displacement of [rbx+d], reg is a register or an opcode extension
+                void mem(unsigned int reg, int32_t d) {
+                    if (d == 0) {
+                        byte(uint8_t(reg << 3 | rbx));
+                    } else if (fits8(d)) {
+                        byte(uint8_t(0x40 | reg << 3 | rbx));
+                        imm(uint64_t(d), 1);
+                    } else {
+                        byte(uint8_t(0x80 | reg << 3 | rbx));
+                        imm(uint64_t(d), 4);
+                    }
+                }
+
+                // mov rax/rcx, n
+                void mov_imm64(reg r, int64_t n) {
+                    bytes({ 0x48, uint8_t(0xb8 + r) });
+                    imm(uint64_t(n), 8);
+                }
+
+                // add cell, n, also sets the flags from the cell
+                void add(int32_t d, int64_t n) {
+                    n = narrow(n, bytes_);
+                    if (bytes_ == 1) {
+                        byte(0x80);
+                        mem(0, d);
+                        imm(uint64_t(n), 1);
+                    } else if (fits8(n)) {
+                        prefix();
+                        byte(0x83);
+                        mem(0, d);
+                        imm(uint64_t(n), 1);
+                    } else if (fits32(n)) {
+                        prefix();
+                        byte(0x81);
+                        mem(0, d);
+                        imm(uint64_t(n), bytes_ == 2 ? 2 : 4);
+                    } else {
+                        mov_imm64(rax, n);
+                        add_reg(d, rax);
+                    }
+                }
+
+                // cmp cell, 0
+                void test(int32_t d) {
+                    if (bytes_ == 1) {
+                        byte(0x80);
+                    } else {
+                        prefix();
+                        byte(0x83);
+                    }
+                    mem(7, d);
+                    byte(0);
+                }
+
+                // mov cell, n
+                void set(int32_t d, int64_t n) {
+                    n = narrow(n, bytes_);
+                    if (bytes_ == 8 && !fits32(n)) {
+                        mov_imm64(rax, n);
+                        store(d, rax);
+                        return;
+                    }
+                    prefix();
+                    byte(bytes_ == 1 ? 0xc6 : 0xc7);
+                    mem(0, d);
+                    imm(uint64_t(n), bytes_ == 8 ? 4 : bytes_);
+                }
+
+                // Zero extend the cell into a register, all of it for 64 bit cells
+                void load(reg r, int32_t d) {
+                    switch (bytes_) {
+                        case 1:     bytes({ 0x0f, 0xb6 }); break;
+                        case 2:     bytes({ 0x0f, 0xb7 }); break;
+                        case 4:     byte(0x8b); break;
+                        default:    bytes({ 0x48, 0x8b }); break;
+                    }
+                    mem(r, d);
+                }
+
+                // add cell, r
+                void add_reg(int32_t d, reg r) {
+                    prefix();
+                    byte(bytes_ == 1 ? 0x00 : 0x01);
+                    mem(r, d);
+                }
+
+                // mov cell, r
+                void store(int32_t d, reg r) {
+                    prefix();
+                    byte(bytes_ == 1 ? 0x88 : 0x89);
+                    mem(r, d);
+                }
+
+                // add cell, rcx * n, only the bits of a cell matter
+                void mul_add(int32_t d, int64_t n) {
+                    n = narrow(n, bytes_);
+                    if (n == 1 || n == -1) {
+                        // add or sub cell, rcx
+                        prefix();
+                        byte(uint8_t((n == 1 ? 0x00 : 0x28) | (bytes_ == 1 ? 0 : 1)));
+                        mem(rcx, d);
+                        return;
+                    }
+                    if (bytes_ == 8 && !fits32(n)) {
+                        mov_imm64(rax, n);
+                        bytes({ 0x48, 0x0f, 0xaf, 0xc1 });                  // imul rax, rcx
+                    } else {
+                        if (bytes_ == 8) byte(0x48);
+                        byte(fits8(n) ? 0x6b : 0x69);                       // imul eax, ecx, n
+                        byte(0xc1);
+                        imm(uint64_t(n), fits8(n) ? 1 : 4);
+                    }
+                    add_reg(d, rax);
+                }
+
+                // add rbx, cells
+                void move(int64_t cells) {
+                    if (cells > INT64_MAX / 8 || cells < INT64_MIN / 8) {
+                        fprintf(stderr, "Operand %lld out of range\n", (long long)cells);
+                        exit(1);
+                    }
+                    int64_t n = cells * int64_t(bytes_);
+                    if (fits8(n)) {
+                        bytes({ 0x48, 0x83, 0xc3 });
+                        imm(uint64_t(n), 1);
+                    } else if (fits32(n)) {
+                        bytes({ 0x48, 0x81, 0xc3 });
+                        imm(uint64_t(n), 4);
+                    } else {
+                        mov_imm64(rax, n);
+                        bytes({ 0x48, 0x01, 0xc3 });
+                    }
+                }
+
+                // jz/jnz with a 32 bit displacement, returns where to patch it
+                size_t jump32(uint8_t cc) {
+                    bytes({ 0x0f, uint8_t(0x80 | cc) });
+                    imm(0, 4);
+                    return text_.size();
+                }
+
+                // Point a jump32 ending at from to here
+                void patch32(size_t from) {
+                    int64_t d = int64_t(text_.size()) - int64_t(from);
+                    if (!fits32(d)) {
+                        fprintf(stderr, "Program too large for native code\n");
+                        exit(1);
+                    }
+                    for (int i = 0; i < 4; i++) text_[from - 4 + i] = uint8_t(uint32_t(d) >> (8 * i));
+                }
+
+                // jz/jnz to an earlier position
+                void jump_back(uint8_t cc, size_t to) {
+                    int64_t d = int64_t(to) - int64_t(text_.size() + 2);
+                    if (fits8(d)) {
+                        byte(uint8_t(0x70 | cc));
+                        imm(uint64_t(d), 1);
+                        return;
+                    }
+                    d = int64_t(to) - int64_t(text_.size() + 6);
+                    if (!fits32(d)) {
+                        fprintf(stderr, "Program too large for native code\n");
+                        exit(1);
+                    }
+                    bytes({ 0x0f, uint8_t(0x80 | cc) });
+                    imm(uint64_t(d), 4);
+                }
+
+                // jz/jnz to a later position within 127 bytes, returns where to patch it
+                size_t jump8(uint8_t cc) {
+                    bytes({ uint8_t(0x70 | cc), 0 });
+                    return text_.size();
+                }
+
+                void patch8(size_t from) {
+                    text_[from - 1] = uint8_t(text_.size() - from);
+                }
+
+                void prologue() {
+                    bytes({ 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56 });    // push rbx, r12, r13, r14
+                    if (with_io_) {
+                        bytes({ 0x41, 0x57 });                              // push r15, which keeps rsp aligned
+                        bytes({ 0x49, 0x89, 0xff });                        // mov r15, rdi
+                        bytes({ 0x48, 0x89, 0xf3 });                        // mov rbx, rsi
+                    } else {
+                        bytes({ 0x48, 0x83, 0xec, 0x08 });                  // sub rsp, 8, calls need 16 byte alignment
+                        bytes({ 0x48, 0x89, 0xfb });                        // mov rbx, rdi
+                    }
+                    bytes({ 0x49, 0xbc });                                  // mov r12, bf_putchar
+                    imm(uint64_t(with_io_ ? reinterpret_cast<uintptr_t>(&bf_io_putchar)
+                                          : reinterpret_cast<uintptr_t>(&bf_putchar)), 8);
+                    bytes({ 0x49, 0xbd });                                  // mov r13, bf_getchar
+                    imm(uint64_t(with_io_ ? reinterpret_cast<uintptr_t>(&bf_io_getchar)
+                                          : reinterpret_cast<uintptr_t>(&bf_getchar)), 8);
+                    bytes({ 0x49, 0xbe });                                  // mov r14, the scan kernel
+                    imm(uint64_t(reinterpret_cast<uintptr_t>(bf_select_scan())), 8);
+                }
+
+                void epilogue() {
+                    if (with_io_) {
+                        bytes({ 0x48, 0x89, 0xd8 });                        // mov rax, rbx
+                        bytes({ 0x41, 0x5f });                              // pop r15
+                    } else {
+                        bytes({ 0x48, 0x83, 0xc4, 0x08 });                  // add rsp, 8
+                    }
+                    bytes({ 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b });    // pop r14, r13, r12, rbx
+                    byte(0xc3);
+                }
+
+                void op(const ir::Op &o) {
+                    // The flags reflect cell 0 only right after an add to it
+                    bool flags = flags_;
+                    flags_ = false;
+                    switch (o.code_) {
+                        case ir::Add:
+                            add(disp(o.offset_), o.value_);
+                            wrote(o.offset_);
+                            flags_ = o.offset_ == 0;
+                            break;
+                        case ir::Move:
+                            move(o.value_);
+                            zero_ = false;
+                            rcx_ = false;
+                            break;
+                        case ir::Set:
+                            set(disp(o.offset_), o.value_);
+                            wrote(o.offset_);
+                            if (o.offset_ == 0) zero_ = narrow(o.value_, bytes_) == 0;
+                            break;
+                        case ir::MulAdd:
+                            if (narrow(o.value_, bytes_) == 0) break;
+                            if (!rcx_ || rcx_disp_ != disp(o.src_)) {
+                                load(rcx, disp(o.src_));
+                                rcx_ = true;
+                                rcx_disp_ = disp(o.src_);
+                            }
+                            mul_add(disp(o.offset_), o.value_);
+                            wrote(o.offset_);
+                            flags_ = o.offset_ == 0;
+                            break;
+                        case ir::Input:
+                            if (with_io_) bytes({ 0x4c, 0x89, 0xff });      // mov rdi, r15
+                            bytes({ 0x41, 0xff, 0xd5 });                    // call r13
+                            if (bytes_ == 8) bytes({ 0x48, 0x63, 0xc0 });   // movsxd rax, eax, EOF fills the cell
+                            store(disp(o.offset_), rax);
+                            wrote(o.offset_);
+                            rcx_ = false;
+                            break;
+                        case ir::Output:
+                            if (with_io_) {
+                                load(rsi, disp(o.offset_));
+                                bytes({ 0x4c, 0x89, 0xff });                // mov rdi, r15
+                            } else {
+                                load(rdi, disp(o.offset_));
+                            }
+                            bytes({ 0x41, 0xff, 0xd4 });                    // call r12
+                            rcx_ = false;
+                            break;
+                        case ir::LoopBegin:
+                            if (zero_) {
+                                // Never entered
+                                byte(0xe9);
+                                imm(0, 4);
+                                loops_.push_back(text_.size());
+                            } else {
+                                if (!flags) test(0);
+                                loops_.push_back(jump32(0x4));
+                            }
+                            loops_.push_back(text_.size());
+                            zero_ = false;
+                            rcx_ = false;
+                            break;
+                        case ir::LoopEnd: {
+                            if (!zero_) {
+                                if (!flags) test(0);
+                                jump_back(0x5, loops_.back());
+                            }
+                            loops_.pop_back();
+                            patch32(loops_.back());
+                            loops_.pop_back();
+                            zero_ = true;
+                            rcx_ = false;
+                            break;
+                        }
+                        case ir::Scan:
+                            if (!zero_) scan(o.value_, flags);
+                            zero_ = true;
+                            rcx_ = false;
+                            break;
+                        case ir::Fork:
+                            ir::brainfork_only();
+                    }
+                }
+
+                // Pad with long nops up to a 16 byte boundary, where loop bodies start
+                void align() {
+                    static const uint8_t nops[][9] = {
+                        { 0x90 },
+                        { 0x66, 0x90 },
+                        { 0x0f, 0x1f, 0x00 },
+                        { 0x0f, 0x1f, 0x40, 0x00 },
+                        { 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+                        { 0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+                        { 0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00 },
+                        { 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+                        { 0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+                    };
+                    size_t pad = (16 - text_.size() % 16) % 16;
+                    while (pad > 0) {
+                        size_t n = pad < 9 ? pad : 9;
+                        text_.insert(text_.end(), nops[n - 1], nops[n - 1] + n);
+                        pad -= n;
+                    }
+                }
+
+                // Forget what is known about a cell that was written
+                void wrote(int32_t offset) {
+                    if (offset == 0) zero_ = false;
+                    if (rcx_disp_ == disp(offset)) rcx_ = false;
+                }
+
+                // Step by stride until cell 0 is zero, byte cells go to the vector kernel after a few steps
+                void scan(int64_t stride, bool flags) {
+                    std::vector<size_t> done;
+                    if (!flags) test(0);
+                    done.push_back(jump8(0x4));
+                    if (bytes_ == 1 && stride <= BF_SCAN_MAX_VECTOR_STRIDE && stride >= -BF_SCAN_MAX_VECTOR_STRIDE) {
+                        for (int i = 1; i < BF_SCAN_INLINE_STEPS; i++) {
+                            move(stride);
+                            test(0);
+                            done.push_back(jump8(0x4));
+                        }
+                        move(stride);
+                        bytes({ 0x48, 0x89, 0xdf });                        // mov rdi, rbx
+                        bytes({ 0x48, 0xc7, 0xc6 });                        // mov rsi, stride
+                        imm(uint64_t(stride), 4);
+                        bytes({ 0x41, 0xff, 0xd6 });                        // call r14
+                        bytes({ 0x48, 0x89, 0xc3 });                        // mov rbx, rax
+                    } else {
+                        size_t loop = text_.size();
+                        move(stride);
+                        test(0);
+                        jump_back(0x5, loop);
+                    }
+                    for (size_t from : done) patch8(from);
+                }
+
+                unsigned int bytes_;                // Bytes per cell
+                bool with_io_;                      // I/O through the bf_io in r15
+                bool flags_;                        // ZF is set from cell 0
+                bool zero_;                         // Cell 0 is zero
+                bool rcx_;                          // rcx holds the cell at rcx_disp_
+                int32_t rcx_disp_;
+                std::vector<size_t> loops_;         // Jump to patch and body start of each open loop
+                std::vector<uint8_t> text_;
+            };  // End of assembler
+        }   // End of namespace details
+
+        Code::Code(const std::vector<uint8_t> &text)
+        : base_(nullptr)
+        , size_(text.size())
+        {
+            base_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (base_ == MAP_FAILED) {
+                perror("mmap");
+                exit(1);
+            }
+            memcpy(base_, text.data(), size_);
+            if (mprotect(base_, size_, PROT_READ | PROT_EXEC) != 0) {
+                perror("mprotect");
+                exit(1);
+            }
+        }
+
+        Code::Code(Code &&other)
+        : base_(other.base_)
+        , size_(other.size_)
+        {
+            other.base_ = nullptr;
+            other.size_ = 0;
+        }
+
+        Code::~Code() {
+            if (base_) munmap(base_, size_);
+        }
+
+        bool supported() {
+#if defined(__x86_64__)
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        Code compile(const ir::Program &prog, unsigned int cell_size, bool with_io) {
+            if (!supported()) {
+                fprintf(stderr, "The native engine only runs on x86-64\n");
+                exit(1);
+            }
+            stats::timer t("codegen");
+            details::assembler a(cell_size, with_io);
+            a.text_.reserve(prog.size() * 8 + 64);
+            a.prologue();
+            for (const ir::Op &op : prog) a.op(op);
+            a.epilogue();
+            stats::add("native code bytes", a.text_.size());
+            return Code(a.text_);
+        }
+
+        void run(const Code &code, const tape::options &tape_opts) {
+            stats::timer t("run");
+            code.entry()(tape::allocate(tape_opts));
+        }
+
+        void run(std::istream &is, const opt::options &opts, const tape::options &tape_opts) {
+            run(compile(frontend::load(is, opts), tape_opts.cell_size), tape_opts);
+        }
+    }   // End of namespace native
+}   // End of namespace brainfuck
@@ -0,0 +1,61 @@
+//
+//  bfnative.h
+//  brainfuck
+//
+//  Template backend, emits x86-64 machine code for each op directly into an
+//  executable mapping. It starts almost as fast as the interpreter, needs no
+//  LLVM and runs programs at about the speed of the -O0 JIT.
+//
+
+#include <stdint.h>
+#include <cstddef>
+#include <istream>
+#include <vector>
+#include "bfir.h"
+#include "bfopt.h"
+#include "bfrt.h"
+#include "bftape.h"
+
+#ifndef brainfuck_bfnative_h
+#define brainfuck_bfnative_h
+
+namespace brainfuck {
+    namespace native {
+        // Machine code of a whole program, callable with cell 0 of a tape. The mapping is
+        // given back when the Code is destroyed
+        class Code {
+        public:
+            typedef void (*entry_func_type)(void *tape);
+
+            // Code compiled with_io, like bf_main, see bfrt.h
+            typedef void *(*io_entry_func_type)(bf_io *io, void *tape);
+
+            explicit Code(const std::vector<uint8_t> &text);
+            Code(Code &&other);
+            Code(const Code &) = delete;
+            Code &operator=(const Code &) = delete;
+            ~Code();
+
+            entry_func_type entry() const { return reinterpret_cast<entry_func_type>(base_); }
+            io_entry_func_type io_entry() const { return reinterpret_cast<io_entry_func_type>(base_); }
+            size_t size() const { return size_; }
+
+        private:
+            void *base_;
+            size_t size_;
+        };
+
+        // Whether this build can emit code for the host, x86-64 only
+        bool supported();
+
+        // Translate IR into machine code for cells of cell_size bits, exits if an operand does not fit.
+        // With with_io the code is entered through io_entry and does its I/O on the bf_io it is given
+        Code compile(const ir::Program &prog, unsigned int cell_size=8, bool with_io=false);
+
+        void run(const Code &code, const tape::options &tape_opts=tape::options());
+
+        void run(std::istream &is, const opt::options &opts=opt::options(), const tape::options &tape_opts=tape::options());
+    }   // End of namespace native
+}   // End of namespace brainfuck
+
+#endif
@@ -0,0 +1,222 @@
+//
+//  bfopt.cpp
+//  brainfuck
+//
+
+#include <stdlib.h>
+#include <map>
+#include <string>
+#include "bfir.h"
+#include "bfopt.h"
+
+namespace brainfuck {
+    namespace opt {
+        namespace details {
+            typedef std::map<ptrdiff_t, int64_t> deltas_type;
+
+            // Summarize a loop made of Add and Move only and with balanced moves,
+            // deltas receives the total change of each touched cell per iteration
+            bool simple_loop(const ir::Program &prog, size_t begin, deltas_type &deltas) {
+                ptrdiff_t offset=0;
+                for (size_t i=begin+1; i<prog[begin].jump_; i++) {
+                    const ir::Op &op=prog[i];
+                    if (op.code_==ir::Add) {
+                        deltas[offset+op.offset_]+=op.value_;
+                    } else if (op.code_==ir::Move) {
+                        offset+=op.value_;
+                        if (offset>ir::max_offset || offset<-ir::max_offset) return false;
+                    } else {
+                        return false;
+                    }
+                }
+                for (deltas_type::iterator i=deltas.begin(); i!=deltas.end(); ) {
+                    if (i->second==0) {
+                        i=deltas.erase(i);
+                    } else {
+                        ++i;
+                    }
+                }
+                return offset==0;
+            }
+
+            // Passes rewrite the program in place, none of them makes it longer
+            void truncate(ir::Program &prog, size_t n) {
+                prog.erase(prog.begin()+n, prog.end());
+                ir::link(prog);
+            }
+        }   // End of namespace details
+
+        bool parse_option(const std::string &arg, options &opts) {
+            if (arg.compare(0, 12, "--eval-fuel=")==0) {
+                opts.eval_fuel=strtoull(arg.c_str()+12, 0, 10);
+                return true;
+            }
+            if (arg.compare(0, 2, "-f")!=0) return false;
+            bool value=true;
+            std::string name=arg.substr(2);
+            if (name.compare(0, 3, "no-")==0) {
+                value=false;
+                name=name.substr(3);
+            }
+            if (name=="merge-deltas") {
+                opts.merge_deltas=value;
+            } else if (name=="fold-offsets") {
+                opts.fold_offsets=value;
+            } else if (name=="clear-loops") {
+                opts.clear_loops=value;
+            } else if (name=="multiply-loops") {
+                opts.multiply_loops=value;
+            } else if (name=="scan-loops") {
+                opts.scan_loops=value;
+            } else if (name=="idioms") {
+                opts.merge_deltas=opts.fold_offsets=opts.clear_loops=opts.multiply_loops=opts.scan_loops=value;
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        void merge_deltas(ir::Program &prog) {
+            size_t n=0;
+            for (size_t i=0; i<prog.size(); i++) {
+                const ir::Op op=prog[i];
+                if (n>0) {
+                    ir::Op &last=prog[n-1];
+                    if (op.code_==ir::Move && last.code_==ir::Move) {
+                        last.value_+=op.value_;
+                        if (last.value_==0) n--;
+                        continue;
+                    }
+                    if (op.code_==ir::Add && (last.code_==ir::Add || last.code_==ir::Set) && last.offset_==op.offset_) {
+                        last.value_+=op.value_;
+                        if (last.code_==ir::Add && last.value_==0) n--;
+                        continue;
+                    }
+                    if (op.code_==ir::Set && (last.code_==ir::Add || last.code_==ir::Set) && last.offset_==op.offset_) {
+                        // Previous value is overwritten
+                        last=op;
+                        continue;
+                    }
+                }
+                if ((op.code_==ir::Add || op.code_==ir::Move) && op.value_==0) continue;
+                prog[n++]=op;
+            }
+            details::truncate(prog, n);
+        }
+
+        void fold_offsets(ir::Program &prog) {
+            // A pending move always stands for at least one Move op already read,
+            // so writing it out never overtakes the read position
+            size_t n=0;
+            int64_t offset=0;
+            for (size_t i=0; i<prog.size(); i++) {
+                ir::Op op=prog[i];
+                switch (op.code_) {
+                    case ir::Move:
+                        offset+=op.value_;
+                        break;
+                    case ir::LoopBegin:
+                    case ir::LoopEnd:
+                    case ir::Scan:
+                        // Loop condition always tests the current cell
+                        if (offset!=0) prog[n++]=ir::Op(ir::Move, offset);
+                        offset=0;
+                        prog[n++]=op;
+                        break;
+                    default:
+                        if (offset>ir::max_offset || offset<-ir::max_offset) {
+                            prog[n++]=ir::Op(ir::Move, offset);
+                            offset=0;
+                        }
+                        op.offset_+=offset;
+                        op.src_+=offset;
+                        prog[n++]=op;
+                        break;
+                }
+            }
+            if (offset!=0) prog[n++]=ir::Op(ir::Move, offset);
+            details::truncate(prog, n);
+        }
+
+        void clear_loops(ir::Program &prog) {
+            size_t n=0;
+            for (size_t i=0; i<prog.size(); i++) {
+                details::deltas_type deltas;
+                if (prog[i].code_==ir::LoopBegin
+                    && details::simple_loop(prog, i, deltas)
+                    && deltas.size()==1
+                    && deltas.begin()->first==0
+                    && (deltas.begin()->second & 1))
+                {
+                    // An odd step reaches 0 with any cell width
+                    i=prog[i].jump_;
+                    prog[n++]=ir::Op(ir::Set, 0);
+                    continue;
+                }
+                prog[n++]=prog[i];
+            }
+            details::truncate(prog, n);
+        }
+
+        void multiply_loops(ir::Program &prog) {
+            size_t n=0;
+            for (size_t i=0; i<prog.size(); i++) {
+                details::deltas_type deltas;
+                if (prog[i].code_==ir::LoopBegin
+                    && details::simple_loop(prog, i, deltas)
+                    && deltas.size()>1
+                    && deltas.count(0)
+                    && (deltas[0]==1 || deltas[0]==-1))
+                {
+                    // Loop runs cell[0] times when counting down, -cell[0] times when counting up.
+                    // Keep the loop as a guard so target cells are not touched when cell[0] is 0,
+                    // the body runs at most once as it ends with clearing cell[0].
+                    // The loop had an Add for each cell, so the rewrite is no longer
+                    int64_t sign=deltas[0]==-1 ? 1 : -1;
+                    int32_t number=prog[i].src_;
+                    i=prog[i].jump_;
+                    prog[n++]=ir::Op(ir::LoopBegin, 0, 0, number);
+                    for (const auto &d : deltas) {
+                        if (d.first==0) continue;
+                        prog[n++]=ir::Op(ir::MulAdd, d.second*sign, int32_t(d.first), 0);
+                    }
+                    prog[n++]=ir::Op(ir::Set, 0);
+                    prog[n++]=ir::Op(ir::LoopEnd, 0, 0, number);
+                    continue;
+                }
+                prog[n++]=prog[i];
+            }
+            details::truncate(prog, n);
+        }
+
+        void scan_loops(ir::Program &prog) {
+            size_t n=0;
+            for (size_t i=0; i<prog.size(); i++) {
+                if (prog[i].code_==ir::LoopBegin
+                    && prog[i].jump_==i+2
+                    && prog[i+1].code_==ir::Move)
+                {
+                    // Search for a zero cell, done by vectorized kernels in the runtime
+                    int64_t stride=prog[i+1].value_;
+                    int32_t number=prog[i].src_;
+                    i=prog[i].jump_;
+                    prog[n++]=ir::Op(ir::Scan, stride, 0, number);
+                    continue;
+                }
+                prog[n++]=prog[i];
+            }
+            details::truncate(prog, n);
+        }
+
+        void optimize(ir::Program &prog, const options &opts) {
+            if (opts.merge_deltas) merge_deltas(prog);
+            if (opts.clear_loops) clear_loops(prog);
+            if (opts.multiply_loops) multiply_loops(prog);
+            if (opts.fold_offsets) fold_offsets(prog);
+            // Folding brings more ops next to each other
+            if (opts.merge_deltas) merge_deltas(prog);
+            // Needs moves merged into one
+            if (opts.scan_loops) scan_loops(prog);
+        }
+    }   // End of namespace opt
+}   // End of namespace brainfuck
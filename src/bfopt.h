@@ -0,0 +1,50 @@
+//
+//  bfopt.h
+//  brainfuck
+//
+//  Idiom recognition on the mid-level IR, runs between parser and codegen.
+//
+
+#include <cstdint>
+#include <string>
+#include "bfir.h"
+
+#ifndef brainfuck_bfopt_h
+#define brainfuck_bfopt_h
+
+namespace brainfuck {
+    namespace opt {
+        struct options {
+            inline options()
+            : merge_deltas(true)
+            , fold_offsets(true)
+            , clear_loops(true)
+            , multiply_loops(true)
+            , scan_loops(true)
+            , eval_fuel(1000000)
+            {}
+
+            bool merge_deltas;      // +-+- => Add[n], >><< => Move[n]
+            bool fold_offsets;      // >+< => Add[1,1]
+            bool clear_loops;       // [-] => Set[0,0]
+            bool multiply_loops;    // [->+>++<<] => [MulAdd[1,0,1],MulAdd[2,0,2],Set[0,0]]
+            bool scan_loops;        // [>>>>] => Scan[4]
+            uint64_t eval_fuel;     // Ops run at compile time before the first input, see bfeval.h
+        };
+
+        // Handle -f<name>, -fno-<name> and --eval-fuel=N, returns false if arg is not an
+        // optimizer switch
+        bool parse_option(const std::string &arg, options &opts);
+
+        void merge_deltas(ir::Program &prog);
+        void fold_offsets(ir::Program &prog);
+        void clear_loops(ir::Program &prog);
+        void multiply_loops(ir::Program &prog);
+        void scan_loops(ir::Program &prog);
+
+        // Run all enabled passes
+        void optimize(ir::Program &prog, const options &opts=options());
+    }   // End of namespace opt
+}   // End of namespace brainfuck
+
+#endif
@@ -0,0 +1,103 @@
+//
+//  bfparsebench.cpp
+//  brainfuck
+//
+//  Parse throughput of the hand-written parser against the Boost.Spirit
+//  grammar it replaced, both producing linked IR.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include "bfast.h"
+#include "bfgrammar.h"
+#include "bfir.h"
+#include "bfparser.h"
+
+namespace {
+    // Best of trials, in seconds
+    template<typename F>
+    double measure(int trials, F f) {
+        double best=0;
+        for (int i=0; i<trials; i++) {
+            auto start=std::chrono::steady_clock::now();
+            f();
+            std::chrono::duration<double> d=std::chrono::steady_clock::now()-start;
+            if (i==0 || d.count()<best) best=d.count();
+        }
+        return best;
+    }
+
+    // Commented program with runs, I/O and loops nested a few levels deep
+    std::string synthetic(size_t size) {
+        static const char *const pieces[] = {
+            "++++++++", "[->+>+<<]", ">>>", "<<", "[-]", "--", ".", ",",
+            "[>[-<+>]<-]", "comment ", "\n",
+        };
+        std::string s;
+        unsigned seed=1;
+        while (s.size()<size) {
+            seed=seed*1103515245+12345;
+            s+=pieces[(seed>>16)%(sizeof(pieces)/sizeof(pieces[0]))];
+        }
+        return s;
+    }
+
+    void bench(const std::string &name, const std::string &src, int trials) {
+        size_t ops_grammar=0, ops_parser=0;
+        double t_grammar=measure(trials, [&]() {
+            brainfuck::ast::Program ast;
+            if (!brainfuck::grammar::parse(src.begin(), src.end(), ast)) {
+                std::cerr << name << ": syntax error\n";
+                exit(1);
+            }
+            ops_grammar=brainfuck::grammar::lower(ast).size();
+        });
+        double t_parser=measure(trials, [&]() {
+            // Reserved up front like frontend::load does
+            brainfuck::ir::Program prog;
+            prog.reserve(src.size());
+            brainfuck::parser::parser p(prog);
+            if (!p.feed(src.data(), src.size()) || !p.finish()) {
+                std::cerr << name << ": " << p.error() << "\n";
+                exit(1);
+            }
+            ops_parser=prog.size();
+        });
+        double mb=src.size()/(1024.0*1024.0);
+        printf("%-24s %10zu bytes  grammar %8.1f MB/s %9zu ops  parser %8.1f MB/s %9zu ops  %6.1fx\n",
+               name.c_str(), src.size(), mb/t_grammar, ops_grammar, mb/t_parser, ops_parser,
+               t_grammar/t_parser);
+    }
+}
+
+// Usage: bf-parse-bench [-tN] [files...], a synthetic program is used without files
+int main(int argc, const char * argv[])
+{
+    int trials=5;
+    int files=0;
+    for (int i=1; i<argc; i++) {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 2, "-t")==0) {
+            trials=std::max(1, atoi(arg.c_str()+2));
+            continue;
+        }
+        std::ifstream is(argv[i], std::ios::binary);
+        if (!is) {
+            std::cerr << "Can not open " << arg << "\n";
+            return 1;
+        }
+        std::string src((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+        bench(arg, src, trials);
+        files++;
+    }
+    if (files==0) {
+        bench("synthetic", synthetic(16*1024*1024), trials);
+    }
+    return 0;
+}
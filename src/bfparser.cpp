@@ -0,0 +1,126 @@
+//
+//  bfparser.cpp
+//  brainfuck
+//
+
+#include <string>
+#include "bfir.h"
+#include "bfparser.h"
+
+namespace brainfuck {
+    namespace parser {
+        parser::parser(ir::Program &prog)
+        : prog_(prog)
+        , run_(ir::Add)
+        , count_(0)
+        , offset_(0)
+        , line_(1)
+        , line_start_(0)
+        , next_loop_(0)
+        , positions_(nullptr)
+        , brainfork_(false)
+        {}
+
+        bool parser::feed(const char *p, size_t n) {
+            if (!error_.empty()) return false;
+            for (size_t i=0; i<n; i++) {
+                switch (p[i]) {
+                    case '+':
+                    case '-':
+                        if (run_!=ir::Add) {
+                            flush();
+                            run_=ir::Add;
+                        }
+                        count_+=p[i]=='+' ? 1 : -1;
+                        break;
+                    case '>':
+                    case '<':
+                        if (run_!=ir::Move) {
+                            flush();
+                            run_=ir::Move;
+                        }
+                        count_+=p[i]=='>' ? 1 : -1;
+                        break;
+                    case ',':
+                        flush();
+                        prog_.push_back(ir::Op(ir::Input));
+                        break;
+                    case '.':
+                        flush();
+                        prog_.push_back(ir::Op(ir::Output));
+                        break;
+                    case '[': {
+                        flush();
+                        if (prog_.size()>=UINT32_MAX) {
+                            fail(where(offset_+i), "too many ops to link this loop");
+                            return false;
+                        }
+                        frame f = { prog_.size(), where(offset_+i) };
+                        loops_.push_back(f);
+                        // Numbers which do not fit in the op are left out of profiles
+                        int32_t number=next_loop_<=INT32_MAX ? int32_t(next_loop_) : -1;
+                        if (positions_ && number>=0) positions_->push_back(f.where_);
+                        next_loop_++;
+                        prog_.push_back(ir::Op(ir::LoopBegin, 0, 0, number));
+                        break;
+                    }
+                    case ']': {
+                        flush();
+                        if (loops_.empty()) {
+                            fail(where(offset_+i), "unmatched ']'");
+                            return false;
+                        }
+                        size_t begin=loops_.back().begin_;
+                        loops_.pop_back();
+                        prog_[begin].jump_=prog_.size();
+                        prog_.push_back(ir::Op(ir::LoopEnd, 0, 0, prog_[begin].src_));
+                        prog_.back().jump_=begin;
+                        break;
+                    }
+                    case 'Y':
+                        if (brainfork_) {
+                            flush();
+                            prog_.push_back(ir::Op(ir::Fork));
+                        }
+                        break;
+                    case '\n':
+                        line_++;
+                        line_start_=offset_+i+1;
+                        break;
+                    default:
+                        // All chars other than the 8 commands are comments
+                        break;
+                }
+            }
+            offset_+=n;
+            return true;
+        }
+
+        bool parser::finish() {
+            if (!error_.empty()) return false;
+            flush();
+            if (!loops_.empty()) {
+                fail(loops_.back().where_, "'[' is never closed");
+                return false;
+            }
+            return true;
+        }
+
+        void parser::flush() {
+            if (count_!=0) {
+                prog_.push_back(ir::Op(run_, count_));
+                count_=0;
+            }
+        }
+
+        location parser::where(size_t pos) const {
+            location loc = { line_, pos-line_start_+1 };
+            return loc;
+        }
+
+        void parser::fail(const location &where, const char *what) {
+            error_ = "line " + std::to_string(where.line_) + ", column " +
+                     std::to_string(where.column_) + ": " + what;
+        }
+    }   // End of namespace parser
+}   // End of namespace brainfuck
@@ -1,107 +1,73 @@
+//
 //  bfparser.h
 //  brainfuck
 //
-//  Created by Xu Chen on 12-9-8.
-//  Copyright (c) 2012 Xu Chen. All rights reserved.
+//  Single pass parser from source text straight to IR. Source is fed in
+//  chunks of any size, so a program never has to be held in memory as a
+//  whole, and the only state kept besides the IR is one entry per open loop.
 //
 
-//#define BOOST_SPIRIT_DEBUG
-#include <boost/spirit/include/qi.hpp>
-#include <boost/spirit/include/support_istream_iterator.hpp>
-#include "bfast.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "bfir.h"
 
 #ifndef brainfuck_bfparser_h
 #define brainfuck_bfparser_h
 
 namespace brainfuck {
     namespace parser {
-        template<typename Iterator>
-        struct skipper : boost::spirit::qi::grammar<Iterator> {
-            skipper() : skipper::base_type(start) {
-                using boost::spirit::ascii::char_;
-                using boost::spirit::no_skip;
-                using boost::spirit::lexeme;
-                // All chars other than these 8 are ignored
-                start = char_ - char_("-<>+,.[]")
-                ;
-            }
-            boost::spirit::qi::rule<Iterator> start;
+        // Position in the source, line and column count from 1
+        struct location {
+            size_t line_;
+            size_t column_;
         };
-        
-        template<typename Iterator>
-        struct parser : boost::spirit::qi::grammar<Iterator, ast::Program(), skipper<Iterator> > {
-            parser() : parser::base_type(program) {
-                using boost::spirit::ascii::char_;
-                
-                program = +command >> boost::spirit::eoi
-                ;
-                
-                loop = '[' >> *command >> ']'
-                ;
-                
-                command = loop
-                        | primitive
-                ;
-                
-                primitive = moveleft
-                          | moveright
-                          | add
-                          | minus
-                          | input
-                          | output
-                ;
-                
-                moveleft = +char_('<')
-                ;
-                
-                moveright = +char_('>')
-                ;
-                
-                add = +char_('+')
-                ;
-                
-                minus = +char_('-')
-                ;
-                
-                input = char_(',')
-                ;
-                
-                output = char_('.')
-                ;
-                
-                BOOST_SPIRIT_DEBUG_NODE(program);
-                BOOST_SPIRIT_DEBUG_NODE(command);
-                BOOST_SPIRIT_DEBUG_NODE(loop);
-                BOOST_SPIRIT_DEBUG_NODE(primitive);
-                BOOST_SPIRIT_DEBUG_NODE(moveleft);
-                BOOST_SPIRIT_DEBUG_NODE(moveright);
-                BOOST_SPIRIT_DEBUG_NODE(add);
-                BOOST_SPIRIT_DEBUG_NODE(minus);
-                BOOST_SPIRIT_DEBUG_NODE(input);
-                BOOST_SPIRIT_DEBUG_NODE(output);
-            }
-            
-            bool parse(Iterator first, Iterator last, ast::Program& prog) {
-                return boost::spirit::qi::phrase_parse(first, last, *this, skipper<Iterator>(), prog);
-            }
-            
-            boost::spirit::qi::rule<Iterator, ast::Program(), skipper<Iterator> > program;
-            boost::spirit::qi::rule<Iterator, ast::Command(), skipper<Iterator> > command;
-            boost::spirit::qi::rule<Iterator, ast::Loop(), skipper<Iterator> > loop;
-            boost::spirit::qi::rule<Iterator, ast::Primitive(), skipper<Iterator> > primitive;
-            boost::spirit::qi::rule<Iterator, ast::MoveLeft(), skipper<Iterator> > moveleft;
-            boost::spirit::qi::rule<Iterator, ast::MoveRight(), skipper<Iterator> > moveright;
-            boost::spirit::qi::rule<Iterator, ast::Add(), skipper<Iterator> > add;
-            boost::spirit::qi::rule<Iterator, ast::Minus(), skipper<Iterator> > minus;
-            boost::spirit::qi::rule<Iterator, ast::Input(), skipper<Iterator> > input;
-            boost::spirit::qi::rule<Iterator, ast::Output(), skipper<Iterator> > output;
+
+        struct parser {
+            // Ops are appended to prog, loops come out linked
+            parser(ir::Program &prog);
+
+            // Append the position of each '[' to loops, indexed by loop number
+            void record(std::vector<location> *loops) { positions_ = loops; }
+
+            // Parse 'Y' as a Fork op instead of a comment, see bffork.h
+            void brainfork(bool enabled) { brainfork_ = enabled; }
+
+            // Parse the next chunk of source, returns false after a syntax error
+            bool feed(const char *p, size_t n);
+
+            // Call at the end of the source, returns false if a loop is left open
+            bool finish();
+
+            // Description of the syntax error, with its line and column
+            const std::string &error() const { return error_; }
+
+        private:
+            struct frame {
+                size_t begin_;      // Index of the LoopBegin op
+                location where_;
+            };
+
+            // Append the pending run of +- or <> as a single op
+            void flush();
+
+            location where(size_t pos) const;
+
+            void fail(const location &where, const char *what);
+
+            ir::Program &prog_;
+            ir::Opcode run_;        // Add or Move
+            int64_t count_;         // Net value of the pending run
+            size_t offset_;         // Source offset of the current chunk
+            size_t line_;
+            size_t line_start_;     // Source offset of the first character of line_
+            std::vector<frame> loops_;
+            uint64_t next_loop_;    // Number of the next '['
+            std::vector<location> *positions_;
+            bool brainfork_;
+            std::string error_;
         };  // End of parser
-        
-        template<typename Iterator>
-        bool parse(Iterator first, Iterator last, ast::Program &prog) {
-            parser<Iterator> parser;
-            return parser.parse(first, last, prog);
-        }
     }   // End of namespace parser
 }   // End of namespace brainfuck
 
@@ -0,0 +1,71 @@
+//
+//  bfprofile.cpp
+//  brainfuck
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "bfprofile.h"
+
+namespace brainfuck {
+    namespace profile {
+        bool parse_option(const std::string &arg, options &opts) {
+            if (arg=="--profile") {
+                opts.enabled=true;
+            } else if (arg.compare(0, 10, "--profile=")==0) {
+                opts.enabled=true;
+                opts.path=arg.substr(10);
+            } else if (arg.compare(0, 14, "--use-profile=")==0) {
+                opts.use=arg.substr(14);
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        report read(const std::string &path, const loop_table &loops) {
+            std::ifstream is(path);
+            if (!is) {
+                std::cerr << "Could not read profile " << path << "\n";
+                exit(1);
+            }
+
+            report r;
+            loop_count none = { false, 0, 0, 0 };
+            r.loops.assign(loops.size(), none);
+            size_t stale=0, line_number=0;
+            std::string line;
+            while (std::getline(is, line)) {
+                line_number++;
+                if (line.empty() || line[0]=='#') continue;
+                // ops, share, number, line:column, entries, iterations, body ops
+                std::istringstream fields(line);
+                std::string share;
+                uint64_t ops, number, entries, iterations, body;
+                size_t l, c;
+                char colon;
+                if (!(fields >> ops >> share >> number >> l >> colon >> c >> entries >> iterations >> body)
+                    || colon!=':')
+                {
+                    std::cerr << path << ":" << line_number << ": not a profile line\n";
+                    exit(1);
+                }
+                if (number>=loops.size() || loops[number].line_!=l || loops[number].column_!=c) {
+                    stale++;
+                    continue;
+                }
+                loop_count count = { true, entries, iterations, ops };
+                r.loops[number]=count;
+                r.total+=ops;
+            }
+            if (stale) {
+                std::cerr << "Profile " << path << " does not match the source, " << stale << " loops ignored\n";
+            }
+            return r;
+        }
+    }   // End of namespace profile
+}   // End of namespace brainfuck
@@ -0,0 +1,68 @@
+//
+//  bfprofile.h
+//  brainfuck
+//
+//  Loop profiles of compiled programs. Code built for profiling counts how
+//  often each loop is entered and iterated in a side array of counters, and
+//  the runtime writes them out at exit, sorted by the ops each loop ran.
+//  Reading such a report back lets codegen lay out and unroll loops by how
+//  they actually ran.
+//
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "bfparser.h"
+
+#ifndef brainfuck_bfprofile_h
+#define brainfuck_bfprofile_h
+
+namespace brainfuck {
+    namespace profile {
+        struct options {
+            inline options()
+            : enabled(false)
+            {}
+
+            bool enabled;
+            std::string path;       // Report written at exit, empty for $BF_PROFILE or bf.profile
+            std::string use;        // Report of an earlier run to optimize with, empty for none
+        };
+
+        // Handle --profile, --profile=FILE and --use-profile=FILE, returns false if arg is
+        // not a profile option
+        bool parse_option(const std::string &arg, options &opts);
+
+        // Source position of each loop, indexed by loop number
+        typedef std::vector<parser::location> loop_table;
+
+        // What an earlier run recorded for one loop
+        struct loop_count {
+            bool known;             // The report has this loop at the same position
+            uint64_t entries;
+            uint64_t iterations;
+            uint64_t ops;           // Ops its iterations ran
+        };
+
+        struct report {
+            inline report()
+            : total(0)
+            {}
+
+            std::vector<loop_count> loops;  // Indexed by loop number
+            uint64_t total;                 // Ops run in all loops
+
+            // Count of loop number n, null if the report does not have it
+            const loop_count *find(int64_t n) const {
+                return n>=0 && size_t(n)<loops.size() && loops[n].known ? &loops[n] : nullptr;
+            }
+        };
+
+        // Read the report at path for a program with the given loops, loops at another
+        // position than in the report are left out with a warning. Exits if the file can
+        // not be read
+        report read(const std::string &path, const loop_table &loops);
+    }   // End of namespace profile
+}   // End of namespace brainfuck
+
+#endif
@@ -0,0 +1,880 @@
+/*
+ *  bfrt.c
+ *  brainfuck
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <time.h>
+#include <sys/syscall.h>
+#define BF_TIMEOUT_TIMERS 1
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BF_SCAN_X86 1
+#endif
+#include "bfrt.h"
+
+static struct {
+    int initialized;
+    int policy_set;
+    enum bf_flush_policy policy;
+
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+
+    const unsigned char *in;
+    size_t in_pos;
+    size_t in_len;
+    int in_checked;
+    int in_eof;
+    unsigned char in_buf[BF_INPUT_BUFFER_SIZE];
+} rt;
+
+struct bf_tape {
+    char *base;             /* Whole reservation, guard pages included */
+    size_t reserved;
+    char *origin;           /* Cell 0 */
+    char *lo, *hi;          /* Mapped cells */
+    char *limit_lo, *limit_hi;
+    size_t cell_bytes;
+    size_t page;
+    int growth;
+    int used;               /* A run has touched it since it was cleared */
+    sigjmp_buf escape;      /* Where bf_tape_run resumes after a tape error */
+    char message[160];
+
+    double timeout;         /* Seconds a run may take, 0 for no limit */
+#ifdef BF_TIMEOUT_TIMERS
+    timer_t timer;
+#endif
+    int timing;             /* timer exists */
+    int timed_out;          /* The run was stopped by its time limit */
+    volatile sig_atomic_t armed;    /* The time limit of the current run has not expired yet */
+    volatile sig_atomic_t busy;     /* In runtime code that must not be left, see bf_enter */
+    volatile sig_atomic_t expired;  /* The time limit expired while busy */
+};
+
+/* The tape of bf_tape_init */
+static struct bf_tape tape;
+
+/* The tape of the bf_tape_run going on in this thread, faults on it are its own */
+static __thread struct bf_tape *bf_thread_tape;
+
+static struct {
+    int installed;
+    struct sigaction old_segv;
+    struct sigaction old_bus;
+    int timeout_installed;
+    struct sigaction old_timeout;
+} handler;
+
+/* Value of the timer signals of time limits, anything else is the host's */
+static int bf_timeout_cookie;
+
+static struct {
+    const struct bf_profile_loop *loops;
+    const uint64_t *counts;
+    size_t n;
+    const char *path;
+    int registered;
+} profile;
+
+static void bf_init(void) {
+    const char *env;
+
+    if (rt.initialized) return;
+    rt.initialized = 1;
+
+    if (!rt.policy_set) {
+        env = getenv("BF_FLUSH");
+        if (env && bf_parse_flush_policy(env) >= 0) {
+            rt.policy = (enum bf_flush_policy)bf_parse_flush_policy(env);
+        } else {
+            rt.policy = isatty(STDOUT_FILENO) ? BF_FLUSH_LINE : BF_FLUSH_SIZE;
+        }
+    }
+
+    rt.out_cap = BF_OUTPUT_BUFFER_SIZE;
+    rt.out = (char *)malloc(rt.out_cap);
+    if (!rt.out) {
+        perror("bf_init");
+        exit(1);
+    }
+    atexit(bf_flush);
+}
+
+/* Write all iovecs, retrying on short writes */
+static void bf_writev_all(struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(STDOUT_FILENO, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            /* Nowhere to report to, drop the output like stdio does */
+            return;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+/* Make room for n more bytes, returns 0 if they do not fit even in an empty buffer */
+static int bf_reserve(size_t n) {
+    if (rt.out_len + n <= rt.out_cap) return 1;
+    if (rt.policy == BF_FLUSH_EXIT && rt.out_len + n <= BF_OUTPUT_LIMIT) {
+        size_t cap = rt.out_cap;
+        char *out;
+        while (cap < rt.out_len + n) cap *= 2;
+        if (cap > BF_OUTPUT_LIMIT) cap = BF_OUTPUT_LIMIT;
+        out = (char *)realloc(rt.out, cap);
+        if (out) {
+            rt.out = out;
+            rt.out_cap = cap;
+            return 1;
+        }
+    }
+    if (n > rt.out_cap) {
+        /* Caller writes buffered data and its own in one go */
+        return 0;
+    }
+    bf_flush();
+    return 1;
+}
+
+void bf_set_flush_policy(enum bf_flush_policy policy) {
+    rt.policy = policy;
+    rt.policy_set = 1;
+}
+
+int bf_parse_flush_policy(const char *name) {
+    if (strcmp(name, "line") == 0) return BF_FLUSH_LINE;
+    if (strcmp(name, "size") == 0) return BF_FLUSH_SIZE;
+    if (strcmp(name, "exit") == 0) return BF_FLUSH_EXIT;
+    return -1;
+}
+
+int bf_getchar(void) {
+    ssize_t n;
+
+    if (rt.in_pos < rt.in_len) return rt.in[rt.in_pos++];
+    if (rt.in_eof) return EOF;
+
+    bf_init();
+    if (rt.policy == BF_FLUSH_LINE) {
+        /* Prompts must be visible before blocking on input */
+        bf_flush();
+    }
+
+    if (!rt.in_checked) {
+        struct stat st;
+        rt.in_checked = 1;
+        if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            off_t pos = lseek(STDIN_FILENO, 0, SEEK_CUR);
+            void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+            if (p != MAP_FAILED) {
+                rt.in = (const unsigned char *)p;
+                rt.in_pos = pos > 0 ? (size_t)pos : 0;
+                rt.in_len = (size_t)st.st_size;
+                rt.in_eof = 1;
+                if (rt.in_pos < rt.in_len) return rt.in[rt.in_pos++];
+                return EOF;
+            }
+        }
+    }
+
+    do {
+        n = read(STDIN_FILENO, rt.in_buf, sizeof(rt.in_buf));
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        rt.in_eof = 1;
+        return EOF;
+    }
+    rt.in = rt.in_buf;
+    rt.in_pos = 1;
+    rt.in_len = (size_t)n;
+    return rt.in[0];
+}
+
+void bf_putchar(int c) {
+    if (rt.out_len >= rt.out_cap) {
+        bf_init();
+        bf_reserve(1);
+    }
+    rt.out[rt.out_len++] = (char)c;
+    if (c == '\n' && rt.policy == BF_FLUSH_LINE) bf_flush();
+}
+
+void bf_write(const char *buf, size_t n) {
+    bf_init();
+    if (!bf_reserve(n)) {
+        /* Larger than the buffer, hand both to the kernel without copying */
+        struct iovec iov[2];
+        iov[0].iov_base = rt.out;
+        iov[0].iov_len = rt.out_len;
+        iov[1].iov_base = (void *)buf;
+        iov[1].iov_len = n;
+        bf_writev_all(iov, 2);
+        rt.out_len = 0;
+        return;
+    }
+    memcpy(rt.out + rt.out_len, buf, n);
+    rt.out_len += n;
+    if (rt.policy == BF_FLUSH_LINE && memchr(buf, '\n', n)) bf_flush();
+}
+
+void bf_flush(void) {
+    struct iovec iov[1];
+    if (rt.out_len == 0) return;
+    iov[0].iov_base = rt.out;
+    iov[0].iov_len = rt.out_len;
+    bf_writev_all(iov, 1);
+    rt.out_len = 0;
+}
+
+/* Out of memory in a run stops the run, see bf_tape_run */
+static void bf_io_fail(size_t n);
+
+/* So does a sink returning nonzero */
+static void bf_io_stop(size_t n);
+
+/*
+ * Around realloc and sinks, which must not be left with siglongjmp. A time limit
+ * expiring in between stops the run in bf_leave.
+ */
+static void bf_enter(void);
+static void bf_leave(void);
+
+static void bf_io_sink(struct bf_io *io, const char *buf, size_t n) {
+    int stop;
+    if (n == 0) return;
+    bf_enter();
+    stop = io->sink(io->sink_ctx, buf, n);
+    bf_leave();
+    if (stop) bf_io_stop(n);
+}
+
+/* Hand out to the sink and empty it */
+static void bf_io_drain(struct bf_io *io) {
+    bf_io_sink(io, io->out, io->out_len);
+    io->out_len = 0;
+}
+
+int bf_io_getchar(struct bf_io *io) {
+    if (!io) return bf_getchar();
+    if (io->in_pos < io->in_len) return io->in[io->in_pos++];
+    return EOF;
+}
+
+/* Make room for n more bytes of output */
+static void bf_io_reserve(struct bf_io *io, size_t n) {
+    size_t cap = io->out_cap ? io->out_cap : BF_OUTPUT_BUFFER_SIZE;
+    char *out;
+    if (io->out_len + n <= io->out_cap) return;
+    while (cap < io->out_len + n) cap *= 2;
+    bf_enter();
+    out = (char *)realloc(io->out, cap);
+    if (out) {
+        io->out = out;
+        io->out_cap = cap;
+    }
+    bf_leave();
+    if (!out) bf_io_fail(cap);
+}
+
+void bf_io_putchar(struct bf_io *io, int c) {
+    if (!io) {
+        bf_putchar(c);
+        return;
+    }
+    if (io->out_len >= io->out_cap) {
+        if (!io->sink) {
+            bf_io_reserve(io, 1);
+        } else {
+            bf_io_drain(io);
+            if (io->out_cap == 0) {
+                char b = (char)c;
+                bf_io_sink(io, &b, 1);
+                return;
+            }
+        }
+    }
+    io->out[io->out_len++] = (char)c;
+}
+
+void bf_io_write(struct bf_io *io, const char *buf, size_t n) {
+    if (!io) {
+        bf_write(buf, n);
+        return;
+    }
+    if (io->sink && io->out_len + n > io->out_cap) {
+        /* Fill out first, a buffer that is never emptied ends up as full as it gets */
+        size_t room = io->out_cap - io->out_len;
+        if (room > 0) {
+            memcpy(io->out + io->out_len, buf, room);
+            io->out_len += room;
+            buf += room;
+            n -= room;
+        }
+        bf_io_drain(io);
+        if (n > io->out_cap) {
+            bf_io_sink(io, buf, n);
+            return;
+        }
+    }
+    bf_io_reserve(io, n);
+    memcpy(io->out + io->out_len, buf, n);
+    io->out_len += n;
+}
+
+int bf_io_flush(struct bf_io *io) {
+    int ret = 0;
+    if (io->sink && io->out_len > 0) {
+        ret = io->sink(io->sink_ctx, io->out, io->out_len);
+        if (ret == 0) io->out_len = 0;
+    }
+    return ret;
+}
+
+static unsigned char *bf_scan_scalar(unsigned char *p, ptrdiff_t stride) {
+    while (*p) p += stride;
+    return p;
+}
+
+#ifdef BF_SCAN_X86
+/*
+ * The vector kernels only use aligned loads, which never cross into an unmapped
+ * page, so reading a few bytes outside the tape is harmless. Bit i of a zero mask
+ * stands for block[i], it is and'ed with the cells that are a multiple
+ * of stride away from p. That lattice is lattice << phase, where phase is the
+ * distance from block to p modulo stride.
+ */
+
+/* Bits 0, s, 2s, ... of 64 for each stride s */
+static const uint64_t bf_scan_lattice[BF_SCAN_MAX_VECTOR_STRIDE + 1] = {
+    0x0000000000000000ull, 0xffffffffffffffffull, 0x5555555555555555ull,
+    0x9249249249249249ull, 0x1111111111111111ull, 0x1084210842108421ull,
+    0x1041041041041041ull, 0x8102040810204081ull, 0x0101010101010101ull,
+};
+
+__attribute__((target("sse2")))
+static unsigned char *bf_scan_sse2(unsigned char *p, ptrdiff_t stride) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t s = (size_t)(stride < 0 ? -stride : stride);
+    uint64_t lattice;
+    size_t phase, step;
+    unsigned char *b;
+    uint32_t m;
+
+    /* Most scans stop within a few cells, try those before setting up vectors */
+    if (!*p) return p;
+    if (s > BF_SCAN_MAX_VECTOR_STRIDE) return bf_scan_scalar(p, stride);
+
+    lattice = bf_scan_lattice[s];
+    b = (unsigned char *)((uintptr_t)p & ~(uintptr_t)15);
+    phase = (size_t)(p - b) % s;
+    step = 16 % s;
+    m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i *)b), zero));
+
+    if (stride > 0) {
+        m &= ~0u << (p - b);
+        for (;;) {
+            m &= (uint32_t)(lattice << phase);
+            if (m) return b + __builtin_ctz(m);
+            b += 16;
+            phase = phase >= step ? phase - step : phase + s - step;
+            m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i *)b), zero));
+        }
+    } else {
+        m &= (2u << (p - b)) - 1;
+        for (;;) {
+            m &= (uint32_t)(lattice << phase);
+            if (m) return b + 31 - __builtin_clz(m);
+            b -= 16;
+            phase += step;
+            if (phase >= s) phase -= s;
+            m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i *)b), zero));
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static unsigned char *bf_scan_avx2(unsigned char *p, ptrdiff_t stride) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t s = (size_t)(stride < 0 ? -stride : stride);
+    uint64_t lattice;
+    size_t phase, step;
+    unsigned char *b;
+    uint32_t m;
+
+    if (!*p) return p;
+    if (s > BF_SCAN_MAX_VECTOR_STRIDE) return bf_scan_scalar(p, stride);
+
+    lattice = bf_scan_lattice[s];
+    b = (unsigned char *)((uintptr_t)p & ~(uintptr_t)31);
+    phase = (size_t)(p - b) % s;
+    step = 32 % s;
+    m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)b), zero));
+
+    if (stride > 0) {
+        m &= ~0u << (p - b);
+        for (;;) {
+            m &= (uint32_t)(lattice << phase);
+            if (m) return b + __builtin_ctz(m);
+            b += 32;
+            phase = phase >= step ? phase - step : phase + s - step;
+            m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)b), zero));
+        }
+    } else {
+        m &= (2u << (p - b)) - 1;
+        for (;;) {
+            m &= (uint32_t)(lattice << phase);
+            if (m) return b + 31 - __builtin_clz(m);
+            b -= 32;
+            phase += step;
+            if (phase >= s) phase -= s;
+            m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)b), zero));
+        }
+    }
+}
+#endif
+
+bf_scan_func bf_select_scan(void) {
+#ifdef BF_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return bf_scan_avx2;
+    if (__builtin_cpu_supports("sse2")) return bf_scan_sse2;
+#endif
+    return bf_scan_scalar;
+}
+
+unsigned char *bf_scan(unsigned char *p, ptrdiff_t stride) {
+    static bf_scan_func kernel;
+    if (!kernel) kernel = bf_select_scan();
+    return kernel(p, stride);
+}
+
+int bf_cpu_level(void) {
+    static int level = -1;
+    if (level >= 0) return level;
+#ifdef BF_SCAN_X86
+    /* The features of each level that compilers use, the rest come with them in practice */
+    __builtin_cpu_init();
+    level = 1;
+    if (__builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        level = 2;
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2")
+            && __builtin_cpu_supports("fma")) {
+            level = 3;
+            if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+                && __builtin_cpu_supports("avx512cd") && __builtin_cpu_supports("avx512dq")
+                && __builtin_cpu_supports("avx512vl")) {
+                level = 4;
+            }
+        }
+    }
+#else
+    level = 0;
+#endif
+    return level;
+}
+
+int bf_parse_tape_growth(const char *name) {
+    if (strcmp(name, "fixed") == 0) return BF_TAPE_FIXED;
+    if (strcmp(name, "right") == 0) return BF_TAPE_RIGHT;
+    if (strcmp(name, "both") == 0) return BF_TAPE_BOTH;
+    return -1;
+}
+
+/* Signal handlers can not use stdio */
+static void bf_tape_error(struct bf_tape *t, const char *prefix, size_t n, const char *suffix) {
+    char buf[sizeof(t->message)];
+    char digits[24];
+    size_t len = strlen(prefix), k = 0;
+
+    memcpy(buf, prefix, len);
+    do {
+        digits[k++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n);
+    while (k) buf[len++] = digits[--k];
+    memcpy(buf + len, suffix, strlen(suffix));
+    len += strlen(suffix);
+
+    if (t == bf_thread_tape) {
+        /* Only the run fails, bf_tape_run hands the message to its caller */
+        memcpy(t->message, buf, len);
+        t->message[len] = '\0';
+        siglongjmp(t->escape, 1);
+    }
+    bf_flush();
+    if (write(STDERR_FILENO, buf, len) < 0) {
+        /* Exiting anyway */
+    }
+    _exit(1);
+}
+
+static void bf_io_fail(size_t n) {
+    bf_tape_error(bf_thread_tape ? bf_thread_tape : &tape, "bf: out of memory growing the output to ", n, " bytes\n");
+}
+
+static void bf_io_stop(size_t n) {
+    bf_tape_error(bf_thread_tape ? bf_thread_tape : &tape, "bf: output stopped by the sink, ", n, " bytes not taken\n");
+}
+
+static void bf_tape_expire(struct bf_tape *t) {
+    t->armed = 0;
+    t->expired = 0;
+    t->timed_out = 1;
+    bf_tape_error(t, "bf: time limit of ", (size_t)(t->timeout * 1000 + 0.5), " ms exceeded\n");
+}
+
+static void bf_enter(void) {
+    if (bf_thread_tape) bf_thread_tape->busy = 1;
+}
+
+static void bf_leave(void) {
+    struct bf_tape *t = bf_thread_tape;
+    if (!t) return;
+    t->busy = 0;
+    if (t->expired) bf_tape_expire(t);
+}
+
+static void bf_tape_timeout(int sig, siginfo_t *info, void *context) {
+    struct bf_tape *t = bf_thread_tape;
+
+    if (info->si_code == SI_TIMER && info->si_value.sival_ptr == &bf_timeout_cookie) {
+        /* Timers only signal the thread of their run, one left from an earlier run finds nothing armed */
+        if (!t || !t->armed) return;
+        if (t->busy) {
+            t->expired = 1;
+            return;
+        }
+        bf_tape_expire(t);
+    }
+    if (handler.old_timeout.sa_flags & SA_SIGINFO) {
+        if (handler.old_timeout.sa_sigaction) handler.old_timeout.sa_sigaction(sig, info, context);
+    } else if (handler.old_timeout.sa_handler != SIG_DFL && handler.old_timeout.sa_handler != SIG_IGN) {
+        handler.old_timeout.sa_handler(sig);
+    }
+}
+
+static int bf_tape_map(char *lo, char *hi) {
+    return mprotect(lo, (size_t)(hi - lo), PROT_READ | PROT_WRITE);
+}
+
+static int bf_tape_owns(const struct bf_tape *t, const char *addr) {
+    return t && t->base && addr >= t->base && addr < t->base + t->reserved;
+}
+
+static void bf_tape_fault(int sig, siginfo_t *info, void *context) {
+    char *addr = (char *)info->si_addr;
+    struct bf_tape *t = bf_thread_tape;
+    size_t used;
+    (void)context;
+
+    if (!bf_tape_owns(t, addr)) t = &tape;
+    if (!bf_tape_owns(t, addr)) {
+        /* Not a tape access, let the fault happen again with the previous handler */
+        sigaction(sig, sig == SIGBUS ? &handler.old_bus : &handler.old_segv, NULL);
+        return;
+    }
+
+    /* Grow by doubling the mapped part, or at least to the touched page */
+    used = (size_t)(t->hi - t->lo);
+    if (addr >= t->hi && addr < t->limit_hi && t->growth != BF_TAPE_FIXED) {
+        char *hi = t->hi + used;
+        if (hi <= addr) hi = t->lo + ((size_t)(addr - t->lo) / t->page + 1) * t->page;
+        if (hi > t->limit_hi) hi = t->limit_hi;
+        /* Mapped cells past hi would not be cleared for the next run */
+        bf_enter();
+        if (bf_tape_map(t->hi, hi) == 0) {
+            t->hi = hi;
+            bf_leave();
+            return;
+        }
+        bf_leave();
+        bf_tape_error(t, "bf: out of memory growing the tape to ", (size_t)(hi - t->lo) / t->cell_bytes, " cells\n");
+    }
+    if (addr < t->lo && addr >= t->limit_lo && t->growth == BF_TAPE_BOTH) {
+        char *lo = t->lo - used;
+        if (lo > addr) lo = t->hi - ((size_t)(t->hi - addr) / t->page + 1) * t->page;
+        if (lo < t->limit_lo) lo = t->limit_lo;
+        bf_enter();
+        if (bf_tape_map(lo, t->lo) == 0) {
+            t->lo = lo;
+            bf_leave();
+            return;
+        }
+        bf_leave();
+        bf_tape_error(t, "bf: out of memory growing the tape to ", (size_t)(t->hi - lo) / t->cell_bytes, " cells\n");
+    }
+
+    if (addr < t->lo) {
+        bf_tape_error(t, "bf: tape access left of the first cell, at cell -",
+                      (size_t)(t->origin - addr + t->cell_bytes - 1) / t->cell_bytes, "\n");
+    }
+    bf_tape_error(t, "bf: tape access past the last cell, the tape is limited to ",
+                  (size_t)(t->limit_hi - t->origin) / t->cell_bytes, " cells\n");
+}
+
+static size_t bf_round_pages(const struct bf_tape *t, size_t n) {
+    return (n + t->page - 1) / t->page * t->page;
+}
+
+/* Reserve and map a tape, returns -1 with errno set on failure */
+static int bf_tape_setup(struct bf_tape *t, size_t cell_bytes, size_t size, size_t limit, int growth) {
+    size_t right, left, initial;
+
+    t->page = (size_t)sysconf(_SC_PAGESIZE);
+    t->cell_bytes = cell_bytes;
+    t->growth = growth;
+    t->used = 0;
+
+    if (size == 0) size = 1;
+    if (limit < size) limit = size;
+    initial = bf_round_pages(t, size * cell_bytes);
+    right = growth == BF_TAPE_FIXED ? initial : bf_round_pages(t, limit * cell_bytes);
+    left = growth == BF_TAPE_BOTH ? right : 0;
+
+    /* Address space only, pages are mapped as the tape grows */
+    t->reserved = left + right + 2 * t->page;
+    t->base = (char *)mmap(NULL, t->reserved, PROT_NONE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (t->base == (char *)MAP_FAILED) {
+        t->base = NULL;
+        return -1;
+    }
+    t->origin = t->base + t->page + left;
+    t->limit_lo = t->origin - left;
+    t->limit_hi = t->origin + right;
+    t->lo = t->origin;
+    t->hi = t->origin + initial;
+    if (bf_tape_map(t->lo, t->hi) != 0) {
+        munmap(t->base, t->reserved);
+        t->base = NULL;
+        return -1;
+    }
+
+    if (!handler.installed) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = bf_tape_fault;
+        action.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &handler.old_segv);
+        sigaction(SIGBUS, &action, &handler.old_bus);
+        handler.installed = 1;
+    }
+    return 0;
+}
+
+void *bf_tape_init(size_t cell_bytes, size_t size, size_t limit, int growth) {
+    if (tape.base) munmap(tape.base, tape.reserved);
+    if (bf_tape_setup(&tape, cell_bytes, size, limit, growth) != 0) {
+        perror("bf_tape_init");
+        exit(1);
+    }
+    return tape.origin;
+}
+
+struct bf_tape *bf_tape_create(size_t cell_bytes, size_t size, size_t limit, int growth) {
+    struct bf_tape *t = (struct bf_tape *)calloc(1, sizeof(struct bf_tape));
+    if (t && bf_tape_setup(t, cell_bytes, size, limit, growth) != 0) {
+        free(t);
+        t = NULL;
+    }
+    return t;
+}
+
+void bf_tape_destroy(struct bf_tape *t) {
+    if (!t) return;
+    munmap(t->base, t->reserved);
+    free(t);
+}
+
+int bf_tape_set_timeout(struct bf_tape *t, double seconds) {
+#ifdef BF_TIMEOUT_TIMERS
+    if (seconds > 0 && !handler.timeout_installed) {
+        /* Threads may race to get here, none of them must take the handler for the host's */
+        struct sigaction action, old;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = bf_tape_timeout;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(BF_TIMEOUT_SIGNAL, &action, &old);
+        if (!(old.sa_flags & SA_SIGINFO) || old.sa_sigaction != bf_tape_timeout) handler.old_timeout = old;
+        handler.timeout_installed = 1;
+    }
+    t->timeout = seconds > 0 ? seconds : 0;
+    return 0;
+#else
+    t->timeout = 0;
+    return seconds > 0 ? -1 : 0;
+#endif
+}
+
+/* Start the timer of the time limit, returns -1 if it could not be set */
+static int bf_tape_arm(struct bf_tape *t) {
+#ifdef BF_TIMEOUT_TIMERS
+    struct sigevent event;
+    struct itimerspec spec;
+
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = BF_TIMEOUT_SIGNAL;
+    event.sigev_value.sival_ptr = &bf_timeout_cookie;
+    event.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+    if (timer_create(CLOCK_MONOTONIC, &event, &t->timer) != 0) return -1;
+    t->timing = 1;
+
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = (time_t)t->timeout;
+    spec.it_value.tv_nsec = (long)((t->timeout - (double)spec.it_value.tv_sec) * 1e9);
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) spec.it_value.tv_nsec = 1;
+    t->armed = 1;
+    if (timer_settime(t->timer, 0, &spec, NULL) != 0) return -1;
+    return 0;
+#else
+    (void)t;
+    return -1;
+#endif
+}
+
+static void bf_tape_disarm(struct bf_tape *t) {
+    /* A signal still on its way finds nothing armed */
+    t->armed = 0;
+#ifdef BF_TIMEOUT_TIMERS
+    if (t->timing) timer_delete(t->timer);
+#endif
+    t->timing = 0;
+}
+
+int bf_tape_run(struct bf_tape *t, void (*run)(void *arg, void *origin), void *arg) {
+    static const char arm_failed[] = "bf: could not start the timer of the time limit\n";
+
+    if (t->used) {
+        /* Small tapes are quicker to clear than to fault in again */
+        size_t mapped = (size_t)(t->hi - t->lo);
+        if (mapped <= BF_TAPE_CLEAR_SIZE || madvise(t->lo, mapped, MADV_DONTNEED) != 0) memset(t->lo, 0, mapped);
+    }
+    t->used = 1;
+    t->message[0] = '\0';
+    t->timed_out = 0;
+    t->busy = 0;
+    t->expired = 0;
+    bf_thread_tape = t;
+    if (sigsetjmp(t->escape, 1)) {
+        bf_tape_disarm(t);
+        bf_thread_tape = NULL;
+        return t->timed_out ? -2 : -1;
+    }
+    if (t->timeout > 0 && bf_tape_arm(t) != 0) {
+        bf_tape_disarm(t);
+        bf_thread_tape = NULL;
+        memcpy(t->message, arm_failed, sizeof(arm_failed));
+        return -1;
+    }
+    run(arg, t->origin);
+    bf_tape_disarm(t);
+    bf_thread_tape = NULL;
+    return 0;
+}
+
+const char *bf_tape_message(const struct bf_tape *t) {
+    return t->message;
+}
+
+void bf_tape_mapped(const struct bf_tape *t, void **lo, void **hi) {
+    *lo = t->lo;
+    *hi = t->hi;
+}
+
+/* Ops run by the iterations of loop i */
+static uint64_t bf_profile_ops(size_t i) {
+    return profile.counts[2 * i + 1] * profile.loops[i].ops;
+}
+
+static int bf_profile_compare(const void *a, const void *b) {
+    uint64_t x = bf_profile_ops(*(const size_t *)a), y = bf_profile_ops(*(const size_t *)b);
+    if (x != y) return x > y ? -1 : 1;
+    return *(const size_t *)a < *(const size_t *)b ? -1 : 1;
+}
+
+static void bf_profile_write(void) {
+    const char *path = getenv("BF_PROFILE");
+    FILE *f;
+    size_t *order, i;
+    uint64_t total = 0;
+
+    if (!path || !*path) path = profile.path ? profile.path : BF_PROFILE_PATH;
+    f = strcmp(path, "-") == 0 ? stderr : fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return;
+    }
+    order = (size_t *)malloc((profile.n ? profile.n : 1) * sizeof(size_t));
+    if (!order) {
+        perror("bf_profile_write");
+        if (f != stderr) fclose(f);
+        return;
+    }
+    for (i = 0; i < profile.n; i++) {
+        order[i] = i;
+        total += bf_profile_ops(i);
+    }
+    qsort(order, profile.n, sizeof(size_t), bf_profile_compare);
+
+    fprintf(f, "# bf profile, loops by ops run\n");
+    fprintf(f, "# %" PRIu64 " ops in %zu loops\n", total, profile.n);
+    fprintf(f, "# %14s %7s %8s %12s %14s %16s %6s\n",
+            "ops", "%", "loop", "line:column", "entries", "iterations", "body");
+    for (i = 0; i < profile.n; i++) {
+        const struct bf_profile_loop *l = &profile.loops[order[i]];
+        uint64_t ops = bf_profile_ops(order[i]);
+        char position[48];
+        snprintf(position, sizeof(position), "%" PRIu64 ":%" PRIu64, l->line, l->column);
+        fprintf(f, "%16" PRIu64 " %6.2f%% %8" PRIu64 " %12s %14" PRIu64 " %16" PRIu64 " %6" PRIu64 "\n",
+                ops, total ? 100.0 * (double)ops / (double)total : 0.0, l->number, position,
+                profile.counts[2 * order[i]], profile.counts[2 * order[i] + 1], l->ops);
+    }
+    free(order);
+    if (f == stderr) {
+        fflush(f);
+    } else if (fclose(f) != 0) {
+        perror(path);
+    }
+}
+
+void bf_profile_register(const struct bf_profile_loop *loops, const uint64_t *counts, size_t n, const char *path) {
+    profile.loops = loops;
+    profile.counts = counts;
+    profile.n = n;
+    profile.path = path;
+    if (!profile.registered) {
+        profile.registered = 1;
+        atexit(bf_profile_write);
+    }
+}
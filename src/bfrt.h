@@ -0,0 +1,178 @@
+/*
+ *  bfrt.h
+ *  brainfuck
+ *
+ *  Runtime library linked into the JIT and into compiled executables.
+ *  Output is collected in a large buffer and written with write/writev,
+ *  input is read in large blocks, or mapped when stdin is a regular file.
+ *  The tape is a mapping between guard pages which grows when touched.
+ *
+ *  Compiled programs export 'cell *bf_main(struct bf_io *io, cell *tape)', which
+ *  keeps no state of its own. Several runs may go on at once on different
+ *  threads, each with its own bf_io and a tape of bf_tape_create.
+ */
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef brainfuck_bfrt_h
+#define brainfuck_bfrt_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum bf_flush_policy {
+    BF_FLUSH_LINE,      /* On newline and before reading input, default for terminals */
+    BF_FLUSH_SIZE,      /* When the buffer is full, default otherwise */
+    BF_FLUSH_EXIT,      /* Only at exit, the buffer grows up to BF_OUTPUT_LIMIT */
+};
+
+#define BF_OUTPUT_BUFFER_SIZE   (64*1024)
+#define BF_OUTPUT_LIMIT         (64*1024*1024)
+#define BF_INPUT_BUFFER_SIZE    (64*1024)
+
+enum bf_tape_growth {
+    BF_TAPE_FIXED,      /* Leaving the initial cells is an error */
+    BF_TAPE_RIGHT,      /* Grow past the last cell, moving left of cell 0 is an error */
+    BF_TAPE_BOTH,       /* Grow in both directions */
+};
+
+#define BF_TAPE_SIZE            30000
+#define BF_TAPE_LIMIT           (256*1024*1024)
+
+/* Set flush policy, overrides BF_FLUSH=line|size|exit from the environment */
+void bf_set_flush_policy(enum bf_flush_policy policy);
+
+/* Parse "line", "size" or "exit", returns -1 for anything else */
+int bf_parse_flush_policy(const char *name);
+
+/* Read a byte, EOF at end of input */
+int bf_getchar(void);
+
+/* Append a byte to the output buffer */
+void bf_putchar(int c);
+
+/* Append n bytes to the output buffer */
+void bf_write(const char *buf, size_t n);
+
+/* Write out everything buffered so far */
+void bf_flush(void);
+
+/*
+ * Input and output of one run of bf_main. Input is read from in, output is appended
+ * to out, which grows with realloc and is freed by the caller. With a sink out keeps
+ * its size instead, a full out is handed to the sink and emptied, and writes larger
+ * than out go to the sink directly. A sink returning nonzero stops the run like a tape
+ * error, leaving out as it was. A null bf_io stands for stdin and stdout through the
+ * functions above.
+ */
+struct bf_io {
+    const unsigned char *in;
+    size_t in_len;
+    size_t in_pos;
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+    int (*sink)(void *ctx, const char *buf, size_t n);
+    void *sink_ctx;
+};
+
+int bf_io_getchar(struct bf_io *io);
+
+void bf_io_putchar(struct bf_io *io, int c);
+
+void bf_io_write(struct bf_io *io, const char *buf, size_t n);
+
+/* Hand what is left in out to the sink after a run, returns what the sink returned */
+int bf_io_flush(struct bf_io *io);
+
+/* Zero search of [>>>] style loops, moves p by stride until it points to a zero cell */
+typedef unsigned char *(*bf_scan_func)(unsigned char *p, ptrdiff_t stride);
+
+/*
+ * Map a tape of cell_bytes wide cells and return cell 0, replacing any previous tape.
+ * The first size cells are mapped, growth decides whether touching cells outside
+ * them maps more, up to limit cells each way, or stops the program with an error.
+ */
+void *bf_tape_init(size_t cell_bytes, size_t size, size_t limit, int growth);
+
+/* Parse "fixed", "right" or "both", returns -1 for anything else */
+int bf_parse_tape_growth(const char *name);
+
+/* A tape of its own for each thread running programs, see bf_tape_run */
+struct bf_tape;
+
+/* Like bf_tape_init without replacing the process tape, null on failure */
+struct bf_tape *bf_tape_create(size_t cell_bytes, size_t size, size_t limit, int growth);
+
+void bf_tape_destroy(struct bf_tape *t);
+
+/* Tapes up to this many mapped bytes are cleared with memset, larger ones are unmapped */
+#define BF_TAPE_CLEAR_SIZE      (1024*1024)
+
+/*
+ * Call run(arg, cell 0) on a zeroed t. Returns 0 once run returns, -1 as soon as the
+ * program leaves the tape, runs out of memory or is stopped by its sink, or -2 once it
+ * ran longer than the time limit of t, with the reason in bf_tape_message. Such errors
+ * stop only this run instead of the process.
+ */
+int bf_tape_run(struct bf_tape *t, void (*run)(void *arg, void *origin), void *arg);
+
+/* Signal of the timer behind time limits, handlers the host had for it are still called */
+#define BF_TIMEOUT_SIGNAL       SIGVTALRM
+
+/*
+ * Limit each following bf_tape_run of t to seconds of wall time, 0 for no limit. A run
+ * going on when it expires is stopped, or right after the runtime call it is in.
+ * Returns -1 where timers can not signal a single thread, only Linux has them.
+ */
+int bf_tape_set_timeout(struct bf_tape *t, double seconds);
+
+const char *bf_tape_message(const struct bf_tape *t);
+
+/* Mapped cells of t, *lo is the first byte and *hi one past the last, both move as it grows */
+void bf_tape_mapped(const struct bf_tape *t, void **lo, void **hi);
+
+/* Callers check this many cells themselves before calling bf_scan */
+#define BF_SCAN_INLINE_STEPS    4
+
+/* Longer strides leave too few candidates per vector, a plain loop is faster */
+#define BF_SCAN_MAX_VECTOR_STRIDE   8
+
+/* Dispatches to the best kernel for the host CPU */
+unsigned char *bf_scan(unsigned char *p, ptrdiff_t stride);
+
+/* Kernel bf_scan dispatches to, lets a JIT bind it directly */
+bf_scan_func bf_select_scan(void);
+
+/*
+ * x86-64 micro-architecture level of the CPU, 1 to 4 for x86-64 to x86-64-v4, 0 on other
+ * CPUs. Programs built with bfc1 --multiversion pick their code by it
+ */
+int bf_cpu_level(void);
+
+/* A loop of a program built for profiling, scans included */
+struct bf_profile_loop {
+    uint64_t number;    /* Counts '[' in the source from 0 */
+    uint64_t line;
+    uint64_t column;
+    uint64_t ops;       /* Ops run by one iteration, not counting nested loops */
+};
+
+#define BF_PROFILE_PATH     "bf.profile"
+
+/*
+ * Write a report of n loops at exit, counts holds entries and iterations of each of
+ * them and is updated by the program as it runs. The report goes to path, or to
+ * BF_PROFILE_PATH if it is null, BF_PROFILE in the environment overrides both and
+ * "-" stands for stderr.
+ */
+void bf_profile_register(const struct bf_profile_loop *loops, const uint64_t *counts, size_t n, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,378 @@
+//
+//  bfserve.cpp
+//  brainfuck
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <memory>
+#include <string>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include "bfcodegen.h"
+#include "bfeval.h"
+#include "bfir.h"
+#include "bfjit.h"
+#include "bfopt.h"
+#include "bfparser.h"
+#include "bfrt.h"
+#include "bfserve.h"
+#include "bfstats.h"
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace brainfuck {
+    namespace serve {
+        namespace details {
+            // Longest header line accepted, three 20 digit numbers fit easily
+            const size_t max_header = 80;
+
+            volatile sig_atomic_t stopping=0;
+
+            void stop(int) {
+                stopping=1;
+            }
+
+            double now() {
+                struct timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                return ts.tv_sec + ts.tv_nsec * 1e-9;
+            }
+
+            bool read_all(int fd, char *p, size_t n) {
+                while (n>0) {
+                    ssize_t got=read(fd, p, n);
+                    if (got<0 && errno==EINTR) continue;
+                    if (got<=0) return false;
+                    p+=got;
+                    n-=size_t(got);
+                }
+                return true;
+            }
+
+            bool write_all(int fd, const char *p, size_t n) {
+                while (n>0) {
+                    ssize_t done=write(fd, p, n);
+                    if (done<0 && errno==EINTR) continue;
+                    if (done<=0) return false;
+                    p+=done;
+                    n-=size_t(done);
+                }
+                return true;
+            }
+
+            // Read up to a newline, false at the end of input or on a line too long to be a header
+            bool read_line(int fd, std::string &line) {
+                line.clear();
+                char c;
+                while (line.size()<max_header) {
+                    if (!read_all(fd, &c, 1)) return false;
+                    if (c=='\n') return true;
+                    line+=c;
+                }
+                return false;
+            }
+
+            // Anonymous file holding data, positioned at its start
+            int anonymous_file(const std::string &data) {
+#ifdef __linux__
+                int fd=memfd_create("bf-serve", 0);
+#else
+                char name[]="/tmp/bf-serve-XXXXXX";
+                int fd=mkstemp(name);
+                if (fd>=0) unlink(name);
+#endif
+                if (fd<0) {
+                    perror("bf --serve");
+                    exit(1);
+                }
+                if (!write_all(fd, data.data(), data.size()) || lseek(fd, 0, SEEK_SET)<0) {
+                    perror("bf --serve");
+                    exit(1);
+                }
+                return fd;
+            }
+
+            std::string contents(int fd) {
+                std::string ret;
+                off_t size=lseek(fd, 0, SEEK_END);
+                if (size>0 && lseek(fd, 0, SEEK_SET)==0) {
+                    ret.resize(size_t(size));
+                    if (!read_all(fd, &ret[0], ret.size())) ret.clear();
+                }
+                close(fd);
+                return ret;
+            }
+
+            struct server {
+                server(int optimization_level, const opt::options &opts, const tape::options &tape_opts,
+                       unsigned int timeout);
+
+                // Serve requests read from in until its end, returns false if a request was
+                // malformed or the peer went away
+                bool session(int in, int out);
+
+                // Jobs per second since the previous report
+                void report(const char *what);
+
+            private:
+                // Read the rest of the request after its header, run it and respond
+                bool job(const std::string &header, int in, int out);
+
+                // Compile the program into the JIT under rt, returns its main or null with
+                // the reason in error
+                jit::main_func_type compile(const std::string &src, const ResourceTrackerSP &rt, std::string &error);
+
+                // Run main in a child with input on stdin, returns the exit status
+                int execute(jit::main_func_type fp, const std::string &input, std::string &output, std::string &error);
+
+                int optimization_level_;
+                opt::options opts_;
+                tape::options tape_opts_;
+                unsigned int timeout_;
+                std::unique_ptr<LLJIT> jit_;
+
+                uint64_t jobs_;
+                double compile_;        // Seconds spent compiling since the last report
+                double run_;
+                double since_;          // Time of the last report
+            };  // End of server
+
+            server::server(int optimization_level, const opt::options &opts, const tape::options &tape_opts,
+                           unsigned int timeout)
+            : optimization_level_(optimization_level)
+            , opts_(opts)
+            , tape_opts_(tape_opts)
+            , timeout_(timeout)
+            , jit_(jit::create_jit())
+            , jobs_(0)
+            , compile_(0)
+            , run_(0)
+            , since_(now())
+            {}
+
+            bool server::session(int in, int out) {
+                std::string header;
+                while (!stopping && read_line(in, header)) {
+                    if (!job(header, in, out)) return false;
+                }
+                // Input may only end between requests
+                return header.empty();
+            }
+
+            bool server::job(const std::string &header, int in, int out) {
+                unsigned long long program_size, input_size;
+                char extra;
+                if (sscanf(header.c_str(), "%llu %llu %c", &program_size, &input_size, &extra)!=2) {
+                    fprintf(stderr, "bf --serve: bad request header '%s'\n", header.c_str());
+                    return false;
+                }
+                std::string src(program_size, '\0'), input(input_size, '\0');
+                if (!read_all(in, &src[0], src.size()) || !read_all(in, &input[0], input.size())) {
+                    fprintf(stderr, "bf --serve: request cut short\n");
+                    return false;
+                }
+
+                double start=now();
+                ResourceTrackerSP rt=jit_->getMainJITDylib().createResourceTracker();
+                std::string output, error;
+                int status=1;
+                jit::main_func_type fp=compile(src, rt, error);
+                double compiled=now();
+                if (fp) status=execute(fp, input, output, error);
+                double done=now();
+
+                // Code and data of the job go away with its tracker
+                if (auto Err=rt->remove()) {
+                    fprintf(stderr, "bf --serve: could not remove job: %s\n", toString(std::move(Err)).c_str());
+                    exit(1);
+                }
+                jobs_++;
+                compile_+=compiled-start;
+                run_+=done-compiled;
+                stats::add("jobs", 1);
+
+                char line[max_header];
+                snprintf(line, sizeof(line), "%d %zu %zu\n", status, output.size(), error.size());
+                return write_all(out, line, strlen(line))
+                    && write_all(out, output.data(), output.size())
+                    && write_all(out, error.data(), error.size());
+            }
+
+            jit::main_func_type server::compile(const std::string &src, const ResourceTrackerSP &rt, std::string &error) {
+                // The front end exits on syntax errors, the server reports them instead
+                ir::Program prog;
+                {
+                    stats::timer t("parse");
+                    prog.reserve(src.size());
+                    parser::parser p(prog);
+                    if (!p.feed(src.data(), src.size()) || !p.finish()) {
+                        error="Syntax error at " + p.error() + "\n";
+                        return nullptr;
+                    }
+                }
+                {
+                    stats::timer t("optimize");
+                    opt::optimize(prog, opts_);
+                }
+                eval::snapshot start=eval::run(prog, opts_.eval_fuel, tape_opts_);
+
+                auto context=std::make_unique<LLVMContext>();
+                auto module=std::make_unique<Module>("brainfuck", *context);
+                module->setDataLayout(jit_->getDataLayout());
+                stats::timer cg("codegen");
+                brainfuck::codegen(*module, prog, tape_opts_, nullptr, "", nullptr, &start);
+                cg.stop();
+                jit::optimize_for_host(*module, optimization_level_);
+
+                stats::timer t("link");
+                if (auto Err=jit_->addIRModule(rt, ThreadSafeModule(std::move(module), std::move(context)))) {
+                    error="Could not add IR module: " + toString(std::move(Err)) + "\n";
+                    return nullptr;
+                }
+                auto Sym=jit_->lookup("main");
+                if (!Sym) {
+                    error="Could not find main function: " + toString(Sym.takeError()) + "\n";
+                    return nullptr;
+                }
+#if LLVM_VERSION_MAJOR >= 15
+                return reinterpret_cast<jit::main_func_type>(Sym->getValue());
+#else
+                return reinterpret_cast<jit::main_func_type>(Sym->getAddress());
+#endif
+            }
+
+            int server::execute(jit::main_func_type fp, const std::string &input, std::string &output,
+                                std::string &error) {
+                stats::timer t("run");
+                int in=anonymous_file(input);
+                int out=anonymous_file("");
+                int err=anonymous_file("");
+                pid_t pid=fork();
+                if (pid<0) {
+                    perror("fork");
+                    exit(1);
+                }
+                if (pid==0) {
+                    // Runtime state is the child's own, the server never does program I/O
+                    if (dup2(in, 0)<0 || dup2(out, 1)<0 || dup2(err, 2)<0) _exit(127);
+                    signal(SIGPIPE, SIG_DFL);
+                    signal(SIGINT, SIG_DFL);
+                    signal(SIGTERM, SIG_DFL);
+                    if (timeout_) alarm(timeout_);
+                    fp();
+                    bf_flush();
+                    _exit(0);
+                }
+                close(in);
+                int status=0;
+                while (waitpid(pid, &status, 0)<0 && errno==EINTR) {}
+                output=contents(out);
+                error+=contents(err);
+                if (WIFSIGNALED(status)) {
+                    if (WTERMSIG(status)==SIGALRM) error+="Timed out\n";
+                    return 128+WTERMSIG(status);
+                }
+                return WEXITSTATUS(status);
+            }
+
+            void server::report(const char *what) {
+                double elapsed=now()-since_;
+                fprintf(stderr, "bf --serve: %s, %llu jobs in %.3fs, %.1f jobs/s, %.3fms compile and %.3fms run per job\n",
+                        what, (unsigned long long)jobs_, elapsed, elapsed>0 ? jobs_/elapsed : 0.0,
+                        jobs_ ? compile_*1e3/jobs_ : 0.0, jobs_ ? run_*1e3/jobs_ : 0.0);
+                jobs_=0;
+                compile_=0;
+                run_=0;
+                since_=now();
+            }
+
+            int listen_on(const std::string &path) {
+                struct sockaddr_un addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sun_family=AF_UNIX;
+                if (path.size()>=sizeof(addr.sun_path)) {
+                    fprintf(stderr, "Socket path %s is too long\n", path.c_str());
+                    exit(1);
+                }
+                memcpy(addr.sun_path, path.c_str(), path.size()+1);
+                int fd=socket(AF_UNIX, SOCK_STREAM, 0);
+                if (fd<0) {
+                    perror("socket");
+                    exit(1);
+                }
+                unlink(path.c_str());
+                if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr))!=0 || listen(fd, 16)!=0) {
+                    perror(path.c_str());
+                    exit(1);
+                }
+                return fd;
+            }
+        }   // End of namespace details
+
+        bool parse_option(const std::string &arg, options &opts) {
+            if (arg=="--serve") {
+                opts.enabled=true;
+            } else if (arg.compare(0, 8, "--serve=")==0) {
+                opts.enabled=true;
+                opts.socket=arg.substr(8);
+            } else if (arg.compare(0, 14, "--job-timeout=")==0) {
+                opts.timeout=(unsigned int)strtoul(arg.c_str()+14, 0, 10);
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        int run(const options &serve_opts, int optimization_level, const opt::options &opts,
+                const tape::options &tape_opts) {
+            // A client going away fails its writes instead of killing the server
+            signal(SIGPIPE, SIG_IGN);
+            details::server server(optimization_level, opts, tape_opts, serve_opts.timeout);
+            if (serve_opts.socket.empty()) {
+                bool ok=server.session(0, 1);
+                server.report("end of input");
+                return ok ? 0 : 1;
+            }
+
+            // Interrupting accept ends the server, without SA_RESTART
+            struct sigaction action;
+            memset(&action, 0, sizeof(action));
+            action.sa_handler=details::stop;
+            sigemptyset(&action.sa_mask);
+            sigaction(SIGINT, &action, nullptr);
+            sigaction(SIGTERM, &action, nullptr);
+
+            int listener=details::listen_on(serve_opts.socket);
+            while (!details::stopping) {
+                int fd=accept(listener, nullptr, nullptr);
+                if (fd<0) {
+                    if (errno==EINTR) continue;
+                    perror("accept");
+                    break;
+                }
+                server.session(fd, fd);
+                close(fd);
+                server.report("connection closed");
+            }
+            close(listener);
+            unlink(serve_opts.socket.c_str());
+            return 0;
+        }
+    }   // End of namespace serve
+}   // End of namespace brainfuck
@@ -0,0 +1,50 @@
+//
+//  bfserve.h
+//  brainfuck
+//
+//  Compile server for many small programs, bf --serve. One LLJIT lives for
+//  the whole session, each job is added to it under its own ResourceTracker
+//  which is removed once the job has run. Jobs run in a forked child, so a
+//  crash, a tape error or a timeout only fails that job.
+//
+//  Requests and responses are framed by a header line of decimal sizes:
+//
+//      request:    <program bytes> <input bytes>\n<program><input>
+//      response:   <status> <output bytes> <error bytes>\n<output><error>
+//
+//  status is the exit status of the run, 128 plus the signal if it was
+//  killed, and 1 with the message on the error stream for a syntax error.
+//
+
+#include <string>
+#include "bfopt.h"
+#include "bftape.h"
+
+#ifndef brainfuck_bfserve_h
+#define brainfuck_bfserve_h
+
+namespace brainfuck {
+    namespace serve {
+        struct options {
+            inline options()
+            : enabled(false)
+            , timeout(0)
+            {}
+
+            bool enabled;
+            std::string socket;     // Unix socket to listen on, empty for stdin and stdout
+            unsigned int timeout;   // Seconds a job may run, 0 for no limit
+        };
+
+        // Handle --serve, --serve=SOCKET and --job-timeout=SECONDS, returns false if arg
+        // is not a serve option
+        bool parse_option(const std::string &arg, options &opts);
+
+        // Serve jobs until the end of stdin, or on the socket until interrupted, then
+        // report throughput on stderr. Returns the exit status of bf
+        int run(const options &serve_opts, int optimization_level, const opt::options &opts=opt::options(),
+                const tape::options &tape_opts=tape::options());
+    }   // End of namespace serve
+}   // End of namespace brainfuck
+
+#endif
@@ -0,0 +1,245 @@
+//
+//  bfstats.cpp
+//  brainfuck
+//
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "bfir.h"
+#include "bfstats.h"
+
+namespace brainfuck {
+    namespace stats {
+        namespace details {
+            struct phase {
+                std::string name_;
+                double wall_;
+                double cpu_;
+                uint64_t calls_;
+            };
+
+            struct pass {
+                std::string name_;
+                double seconds_;
+                uint64_t runs_;
+            };
+
+            // Timers run on the tiered engine's compiler thread too
+            std::mutex mutex;
+            std::atomic<bool> on(false);
+            std::vector<phase> phases;
+            std::vector<std::pair<std::string, uint64_t> > counters;
+            std::vector<pass> passes;
+
+            // Passes listed in the table, JSON has all of them
+            const size_t table_passes = 15;
+
+            double seconds(clockid_t clock) {
+                struct timespec ts;
+                clock_gettime(clock, &ts);
+                return ts.tv_sec + ts.tv_nsec * 1e-9;
+            }
+
+            uint64_t &counter(const std::string &name) {
+                for (auto &c : counters) {
+                    if (c.first == name) return c.second;
+                }
+                counters.push_back(std::make_pair(name, uint64_t(0)));
+                return counters.back().second;
+            }
+
+            std::string quote(const std::string &s) {
+                std::string ret = "\"";
+                for (char c : s) {
+                    if (c == '"' || c == '\\') {
+                        ret += '\\';
+                        ret += c;
+                    } else if ((unsigned char)c < 0x20) {
+                        char buf[8];
+                        snprintf(buf, sizeof(buf), "\\u%04x", c);
+                        ret += buf;
+                    } else {
+                        ret += c;
+                    }
+                }
+                return ret + '"';
+            }
+
+            std::string number(double v) {
+                char buf[32];
+                snprintf(buf, sizeof(buf), "%.6f", v);
+                return buf;
+            }
+        }   // End of namespace details
+
+        bool parse_option(const std::string &arg, format &fmt) {
+            if (arg == "--stats" || arg == "--stats=table") {
+                fmt = Table;
+            } else if (arg == "--stats=json") {
+                fmt = JSON;
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        void enable() {
+            details::on.store(true);
+        }
+
+        bool enabled() {
+            return details::on.load(std::memory_order_relaxed);
+        }
+
+        timer::timer(const char *phase)
+        : phase_(enabled() ? phase : nullptr)
+        , wall_(0)
+        , cpu_(0)
+        {
+            if (!phase_) return;
+            wall_ = details::seconds(CLOCK_MONOTONIC);
+            cpu_ = details::seconds(CLOCK_THREAD_CPUTIME_ID);
+        }
+
+        timer::~timer() {
+            stop();
+        }
+
+        void timer::stop() {
+            if (!phase_) return;
+            double wall = details::seconds(CLOCK_MONOTONIC) - wall_;
+            double cpu = details::seconds(CLOCK_THREAD_CPUTIME_ID) - cpu_;
+            std::lock_guard<std::mutex> lock(details::mutex);
+            auto i = std::find_if(details::phases.begin(), details::phases.end(),
+                                  [this](const details::phase &p) { return p.name_ == phase_; });
+            if (i == details::phases.end()) {
+                details::phase p = { phase_, wall, cpu, 1 };
+                details::phases.push_back(p);
+            } else {
+                i->wall_ += wall;
+                i->cpu_ += cpu;
+                i->calls_++;
+            }
+            phase_ = nullptr;
+        }
+
+        void add(const std::string &counter, uint64_t value) {
+            if (!enabled()) return;
+            std::lock_guard<std::mutex> lock(details::mutex);
+            details::counter(counter) += value;
+        }
+
+        void max(const std::string &counter, uint64_t value) {
+            if (!enabled()) return;
+            std::lock_guard<std::mutex> lock(details::mutex);
+            uint64_t &c = details::counter(counter);
+            c = std::max(c, value);
+        }
+
+        void pass(const std::string &name, double seconds) {
+            if (!enabled()) return;
+            std::lock_guard<std::mutex> lock(details::mutex);
+            auto i = std::find_if(details::passes.begin(), details::passes.end(),
+                                  [&name](const details::pass &p) { return p.name_ == name; });
+            if (i == details::passes.end()) {
+                details::pass p = { name, seconds, 1 };
+                details::passes.push_back(p);
+            } else {
+                i->seconds_ += seconds;
+                i->runs_++;
+            }
+        }
+
+        void count(const std::string &prefix, const ir::Program &prog) {
+            if (!enabled()) return;
+            uint64_t loops = 0, depth = 0, deepest = 0;
+            for (const ir::Op &op : prog) {
+                if (op.code_ == ir::LoopBegin) {
+                    loops++;
+                    deepest = std::max(deepest, ++depth);
+                } else if (op.code_ == ir::LoopEnd) {
+                    depth--;
+                }
+            }
+            add(prefix + " ops", prog.size());
+            add(prefix + " loops", loops);
+            max(prefix + " nesting", deepest);
+        }
+
+        void print(std::ostream &os, format fmt) {
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            double user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6;
+            double sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+            uint64_t peak_rss = uint64_t(usage.ru_maxrss) * 1024;
+
+            std::lock_guard<std::mutex> lock(details::mutex);
+            std::vector<details::pass> passes = details::passes;
+            std::sort(passes.begin(), passes.end(), [](const details::pass &a, const details::pass &b) {
+                return a.seconds_ > b.seconds_;
+            });
+
+            if (fmt == JSON) {
+                os << "{\"phases\":[";
+                for (size_t i = 0; i < details::phases.size(); i++) {
+                    const details::phase &p = details::phases[i];
+                    os << (i ? "," : "") << "{\"name\":" << details::quote(p.name_)
+                       << ",\"wall\":" << details::number(p.wall_)
+                       << ",\"cpu\":" << details::number(p.cpu_)
+                       << ",\"calls\":" << p.calls_ << "}";
+                }
+                os << "],\"counters\":{";
+                for (size_t i = 0; i < details::counters.size(); i++) {
+                    os << (i ? "," : "") << details::quote(details::counters[i].first) << ":" << details::counters[i].second;
+                }
+                os << "},\"passes\":[";
+                for (size_t i = 0; i < passes.size(); i++) {
+                    os << (i ? "," : "") << "{\"name\":" << details::quote(passes[i].name_)
+                       << ",\"seconds\":" << details::number(passes[i].seconds_)
+                       << ",\"runs\":" << passes[i].runs_ << "}";
+                }
+                os << "],\"peak_rss\":" << peak_rss
+                   << ",\"user\":" << details::number(user)
+                   << ",\"sys\":" << details::number(sys) << "}\n";
+                return;
+            }
+
+            char line[256];
+            snprintf(line, sizeof(line), "%-28s %12s %12s %8s\n", "phase", "wall (s)", "cpu (s)", "calls");
+            os << line;
+            for (const details::phase &p : details::phases) {
+                snprintf(line, sizeof(line), "%-28s %12.6f %12.6f %8llu\n", p.name_.c_str(), p.wall_, p.cpu_,
+                         (unsigned long long)p.calls_);
+                os << line;
+            }
+            os << "\n";
+            for (const auto &c : details::counters) {
+                snprintf(line, sizeof(line), "%-28s %12llu\n", c.first.c_str(), (unsigned long long)c.second);
+                os << line;
+            }
+            snprintf(line, sizeof(line), "%-28s %12llu\n", "peak rss (KB)", (unsigned long long)(peak_rss / 1024));
+            os << line;
+            snprintf(line, sizeof(line), "%-28s %12.6f\n%-28s %12.6f\n", "user cpu (s)", user, "system cpu (s)", sys);
+            os << line;
+            if (!passes.empty()) {
+                snprintf(line, sizeof(line), "\n%-40s %12s %8s\n", "llvm pass", "time (s)", "runs");
+                os << line;
+                for (size_t i = 0; i < passes.size() && i < details::table_passes; i++) {
+                    snprintf(line, sizeof(line), "%-40.40s %12.6f %8llu\n", passes[i].name_.c_str(), passes[i].seconds_,
+                             (unsigned long long)passes[i].runs_);
+                    os << line;
+                }
+                if (passes.size() > details::table_passes) {
+                    os << "(" << passes.size() - details::table_passes << " more, see --stats=json)\n";
+                }
+            }
+        }
+    }   // End of namespace stats
+}   // End of namespace brainfuck
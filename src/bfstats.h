@@ -0,0 +1,64 @@
+//
+//  bfstats.h
+//  brainfuck
+//
+//  Where a run spends its time and memory, for --stats. Phases and counters
+//  are collected process wide and cost nothing until stats are enabled.
+//
+
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include "bfir.h"
+
+#ifndef brainfuck_bfstats_h
+#define brainfuck_bfstats_h
+
+namespace brainfuck {
+    namespace stats {
+        enum format {
+            Off,
+            Table,      // Aligned columns for people
+            JSON,       // One object, for scripts
+        };
+
+        // Handle --stats and --stats=table|json, returns false if arg is not a stats option
+        bool parse_option(const std::string &arg, format &fmt);
+
+        // Start collecting, before this timers and counters are ignored
+        void enable();
+
+        bool enabled();
+
+        // Wall and CPU time of the calling thread spent in a phase, from construction
+        // until destruction or stop(). Phases seen more than once add up
+        struct timer {
+            timer(const char *phase);
+            ~timer();
+
+            void stop();
+
+        private:
+            const char *phase_;
+            double wall_;
+            double cpu_;
+        };  // End of timer
+
+        // Add to a counter, counters are listed in the order they first appear
+        void add(const std::string &counter, uint64_t value);
+
+        // Keep the largest value seen
+        void max(const std::string &counter, uint64_t value);
+
+        // Time of one run of an LLVM pass
+        void pass(const std::string &name, double seconds);
+
+        // Ops, loops and deepest nesting of prog, as counters "<prefix> ops" and so on
+        void count(const std::string &prefix, const ir::Program &prog);
+
+        // Print everything collected together with peak RSS and total CPU time
+        void print(std::ostream &os, format fmt);
+    }   // End of namespace stats
+}   // End of namespace brainfuck
+
+#endif
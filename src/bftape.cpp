@@ -0,0 +1,55 @@
+//
+//  bftape.cpp
+//  brainfuck
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "bfrt.h"
+#include "bftape.h"
+
+namespace brainfuck {
+    namespace tape {
+        namespace details {
+            size_t count(const std::string &arg, size_t prefix) {
+                char *end=0;
+                unsigned long long n=strtoull(arg.c_str()+prefix, &end, 10);
+                if (arg.size()==prefix || *end || n==0) {
+                    fprintf(stderr, "Bad value in %s\n", arg.c_str());
+                    exit(1);
+                }
+                return size_t(n);
+            }
+        }   // End of namespace details
+
+        bool parse_option(const std::string &arg, options &opts) {
+            if (arg.compare(0, 12, "--cell-size=")==0) {
+                size_t n=details::count(arg, 12);
+                if (n!=8 && n!=16 && n!=32 && n!=64) {
+                    fprintf(stderr, "Cell size must be 8, 16, 32 or 64\n");
+                    exit(1);
+                }
+                opts.cell_size=(unsigned int)n;
+            } else if (arg.compare(0, 12, "--tape-size=")==0) {
+                opts.size=details::count(arg, 12);
+            } else if (arg.compare(0, 13, "--tape-limit=")==0) {
+                opts.limit=details::count(arg, 13);
+            } else if (arg.compare(0, 14, "--tape-growth=")==0) {
+                int growth=bf_parse_tape_growth(arg.c_str()+14);
+                if (growth<0) {
+                    fprintf(stderr, "Unknown tape growth %s\n", arg.c_str()+14);
+                    exit(1);
+                }
+                opts.growth=bf_tape_growth(growth);
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        void *allocate(const options &opts) {
+            return bf_tape_init(opts.cell_size/8, opts.size, opts.limit, opts.growth);
+        }
+    }   // End of namespace tape
+}   // End of namespace brainfuck
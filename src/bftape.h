@@ -0,0 +1,40 @@
+//
+//  bftape.h
+//  brainfuck
+//
+//  Tape layout shared by all engines and by compiled programs.
+//
+
+#include <cstddef>
+#include <string>
+#include "bfrt.h"
+
+#ifndef brainfuck_bftape_h
+#define brainfuck_bftape_h
+
+namespace brainfuck {
+    namespace tape {
+        struct options {
+            inline options()
+            : cell_size(8)
+            , size(BF_TAPE_SIZE)
+            , limit(BF_TAPE_LIMIT)
+            , growth(BF_TAPE_RIGHT)
+            {}
+
+            unsigned int cell_size;     // Bits per cell, 8, 16, 32 or 64
+            size_t size;                // Cells mapped at start
+            size_t limit;               // Cells the tape may grow to
+            bf_tape_growth growth;
+        };
+
+        // Handle --cell-size=, --tape-size=, --tape-limit= and --tape-growth=, exits on bad
+        // values, returns false if arg is not a tape option
+        bool parse_option(const std::string &arg, options &opts);
+
+        // Map a fresh tape, returns cell 0
+        void *allocate(const options &opts);
+    }   // End of namespace tape
+}   // End of namespace brainfuck
+
+#endif
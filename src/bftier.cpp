@@ -0,0 +1,194 @@
+//
+//  bftier.cpp
+//  brainfuck
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+
+#include "bfir.h"
+#include "bfcodegen.h"
+#include "bffrontend.h"
+#include "bfjit.h"
+#include "bfinterp.h"
+#include "bfrt.h"
+#include "bftape.h"
+#include "bfstats.h"
+#include "bftier.h"
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace brainfuck {
+    namespace tier {
+        namespace details {
+            // Compiled loop, takes and returns the data pointer
+            typedef void *(*loop_func_type)(void *);
+
+            // Compiles hot loops on a background thread, the interpreter picks up
+            // the result from the slot of the loop once it is published
+            struct compiler_thread {
+                compiler_thread(const ir::Program &prog, int optimization_level, unsigned int cell_size)
+                : prog_(prog)
+                , optimization_level_(optimization_level)
+                , cell_size_(cell_size)
+                , slots_(new std::atomic<loop_func_type>[prog.size()])
+                , stop_(false)
+                {
+                    for (size_t i=0; i<prog.size(); i++) {
+                        slots_[i].store(0, std::memory_order_relaxed);
+                    }
+                }
+
+                ~compiler_thread() {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        stop_=true;
+                    }
+                    cond_.notify_one();
+                    if (thread_.joinable()) thread_.join();
+                }
+
+                void submit(size_t begin) {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        queue_.push_back(begin);
+                    }
+                    // LLVM is only brought up when the first loop gets hot
+                    if (!thread_.joinable()) thread_=std::thread(&compiler_thread::work, this);
+                    cond_.notify_one();
+                }
+
+                loop_func_type get(size_t begin) const {
+                    return slots_[begin].load(std::memory_order_acquire);
+                }
+
+                void work() {
+                    std::unique_ptr<LLJIT> JIT=jit::create_jit();
+                    for (;;) {
+                        size_t begin;
+                        {
+                            std::unique_lock<std::mutex> lock(mutex_);
+                            cond_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+                            if (stop_) break;
+                            begin=queue_.front();
+                            queue_.pop_front();
+                        }
+
+                        stats::timer t("tier compile");
+                        stats::add("tier loops compiled", 1);
+                        std::string name="loop_" + std::to_string(begin);
+                        auto context=std::make_unique<LLVMContext>();
+                        auto module=std::make_unique<Module>(name, *context);
+                        brainfuck::codegen_loop(*module, prog_, begin, name, cell_size_);
+                        jit::optimize_for_host(*module, optimization_level_);
+
+                        ThreadSafeModule TSM(std::move(module), std::move(context));
+                        if (auto Err=JIT->addIRModule(std::move(TSM))) {
+                            // Keep interpreting this loop
+                            fprintf(stderr, "Could not add IR module: %s\n",
+                                    toString(std::move(Err)).c_str());
+                            continue;
+                        }
+                        void *fp=jit::lookup(*JIT, name);
+                        slots_[begin].store(reinterpret_cast<loop_func_type>(fp), std::memory_order_release);
+                    }
+                }
+
+                const ir::Program &prog_;
+                int optimization_level_;
+                unsigned int cell_size_;
+                std::unique_ptr<std::atomic<loop_func_type>[]> slots_;
+
+                std::thread thread_;
+                std::mutex mutex_;
+                std::condition_variable cond_;
+                std::deque<size_t> queue_;
+                bool stop_;
+            };  // End of compiler_thread
+
+            template<typename Cell>
+            void interpret(const ir::Program &prog, const options &tier_opts) {
+                compiler_thread compiler(prog, tier_opts.optimization_level, tier_opts.tape.cell_size);
+                std::vector<size_t> counters(prog.size(), 0);
+                Cell *p=static_cast<Cell *>(tape::allocate(tier_opts.tape));
+
+                for (size_t pc=0; pc<prog.size(); pc++) {
+                    const ir::Op &op=prog[pc];
+                    switch (op.code_) {
+                        case ir::Add:
+                            p[op.offset_]+=Cell(op.value_);
+                            break;
+                        case ir::Move:
+                            p+=op.value_;
+                            break;
+                        case ir::Set:
+                            p[op.offset_]=Cell(op.value_);
+                            break;
+                        case ir::MulAdd:
+                            p[op.offset_]+=Cell(uint64_t(p[op.src_])*uint64_t(Cell(op.value_)));
+                            break;
+                        case ir::Input:
+                            p[op.offset_]=Cell(bf_getchar());
+                            break;
+                        case ir::Output:
+                            bf_putchar(p[op.offset_]);
+                            break;
+                        case ir::Scan:
+                            p=interp::scan(p, op.value_);
+                            break;
+                        case ir::LoopBegin:
+                            if (p[0]==0) {
+                                pc=op.jump_;
+                            } else if (loop_func_type fn=compiler.get(pc)) {
+                                p=static_cast<Cell *>(fn(p));
+                                pc=op.jump_;
+                            }
+                            break;
+                        case ir::LoopEnd:
+                            if (p[0]==0) break;
+                            if (++counters[op.jump_]==tier_opts.threshold) {
+                                compiler.submit(op.jump_);
+                            }
+                            if (loop_func_type fn=compiler.get(op.jump_)) {
+                                // Switch to native code at the loop head
+                                p=static_cast<Cell *>(fn(p));
+                            } else {
+                                pc=op.jump_;
+                            }
+                            break;
+                        case ir::Fork:
+                            ir::brainfork_only();
+                    }
+                }
+            }
+        }   // End of namespace details
+
+        void run(const ir::Program &prog, const options &tier_opts) {
+            stats::timer t("run");
+            switch (tier_opts.tape.cell_size) {
+                case 16:    details::interpret<uint16_t>(prog, tier_opts); break;
+                case 32:    details::interpret<uint32_t>(prog, tier_opts); break;
+                case 64:    details::interpret<uint64_t>(prog, tier_opts); break;
+                default:    details::interpret<uint8_t>(prog, tier_opts); break;
+            }
+        }
+
+        void run(std::istream &is, const options &tier_opts, const opt::options &opts) {
+            ir::Program prog=frontend::load(is, opts);
+            run(prog, tier_opts);
+        }
+    }   // End of namespace tier
+}   // End of namespace brainfuck
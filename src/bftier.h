@@ -0,0 +1,37 @@
+//
+//  bftier.h
+//  brainfuck
+//
+//  Tiered execution, programs start in an interpreter and hot loops are
+//  compiled to native code in the background.
+//
+
+#include <cstddef>
+#include <istream>
+#include "bfir.h"
+#include "bfopt.h"
+#include "bftape.h"
+
+#ifndef brainfuck_bftier_h
+#define brainfuck_bftier_h
+
+namespace brainfuck {
+    namespace tier {
+        struct options {
+            inline options()
+            : threshold(1000)
+            , optimization_level(2)
+            {}
+
+            size_t threshold;           // Back edges taken before a loop is compiled
+            int optimization_level;     // LLVM optimization level of compiled loops
+            tape::options tape;
+        };
+
+        void run(const ir::Program &prog, const options &tier_opts=options());
+
+        void run(std::istream &is, const options &tier_opts=options(), const opt::options &opts=opt::options());
+    }   // End of namespace tier
+}   // End of namespace brainfuck
+
+#endif
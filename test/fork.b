@@ -0,0 +1,16 @@
+Example of the brainfork dialect for bf with the brainfork option
+The main task forks eight tasks which each print their number and then
+spin through sixteen million loop iterations
+Output is 76543210 and a newline with any number of threads
+
+>>+<<                               a one the main task keeps for the end
+++++++++[
+    ->Y                             count down and fork with the copy one cell to the right
+    [                               only the copy sees a one here
+        -<<[->>>+<<<]>>>            move the count next to the copy
+        >++++++[-<++++++++>]<.      print it as a digit
+        >-[>-[>-[>-[-]<-]<-]<-]<    spin
+        [-]                         clear the digit so the copy leaves both loops and ends
+    ]<
+]
+>>[->++++++++++.[-]]                only the main task has a one here and prints a newline
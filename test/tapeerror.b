@@ -0,0 +1,7 @@
+Writes Hi and a newline and then leaves the tape on the left
+Every engine must write the output that comes before the error
+and exit with the error on stderr
+
+++++++++[>+++++++++<-]>.            H
++++++++++++++++++++++++++++++++++.  i
+[-]++++++++++.<<<.                  newline and then a cell left of the tape